@@ -0,0 +1,97 @@
+#include "bit_pack.h"
+#include <algorithm>
+
+// SSE2 is part of every x64 target, MSVC only reports it through _M_X64 / _M_IX86_FP
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HPC_HAVE_SSE2
+#endif
+
+int hpc::PackedWidth(Span<const int> input, int * base)
+{
+	const size_t n = input.size();
+	if (n == 0)
+	{
+		*base = 0;
+		return 1;
+	}
+
+	// SSE2 has no 32 bit min / max, the scalar loop is left to the compiler
+	int minValue = input[0], maxValue = input[0];
+	for (size_t i = 1; i < n; ++i)
+	{
+		minValue = std::min(minValue, input[i]);
+		maxValue = std::max(maxValue, input[i]);
+	}
+
+	// unsigned difference, the full int range still fits in 32 bits
+	const unsigned int range = (unsigned int)maxValue - (unsigned int)minValue;
+	int width = 1;
+	while (width < 32 && (range >> width) != 0)
+		width *= 2;
+	*base = minValue;
+	return width;
+}
+
+size_t hpc::PackedWords(size_t count, int width)
+{
+	const size_t perBlock = (size_t)PACK_LANES * (32 / width);
+	return (count + perBlock - 1) / perBlock * PACK_LANES;
+}
+
+void hpc::Pack(Span<const int> input, PackedInts& packed)
+{
+	int base;
+	const int width = PackedWidth(input, &base);
+	Pack(input, width, base, packed);
+}
+
+void hpc::Pack(Span<const int> input, int width, int base, PackedInts& packed)
+{
+	packed.count = input.size();
+	packed.width = width;
+	packed.base = base;
+	packed.words.assign(PackedWords(packed.count, packed.width), 0);
+
+	const size_t slots = 32 / width;
+	const size_t perBlock = PACK_LANES * slots;
+	const int * src = input.data();
+	unsigned int * dst = packed.words.empty() ? NULL : &packed.words[0];
+
+	size_t b = 0;
+#if defined(HPC_HAVE_SSE2)
+	// one load per slot fills that slot of all PACK_LANES words
+	const __m128i vbase = _mm_set1_epi32(base);
+	for (; (b + 1) * perBlock <= packed.count; ++b)
+	{
+		const int * block = src + b * perBlock;
+		__m128i acc = _mm_setzero_si128();
+		for (size_t s = 0; s < slots; ++s)
+		{
+			__m128i v = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(block + s * PACK_LANES)), vbase);
+			acc = _mm_or_si128(acc, _mm_sll_epi32(v, _mm_cvtsi32_si128((int)(s * width))));
+		}
+		_mm_storeu_si128((__m128i *)(dst + b * PACK_LANES), acc);
+	}
+#endif
+
+	// scalar blocks and the padded tail, padding packs as 0 (= base)
+	for (size_t i = b * perBlock; i < packed.count; ++i)
+	{
+		const size_t r = i % perBlock;
+		dst[i / perBlock * PACK_LANES + r % PACK_LANES] |= ((unsigned int)src[i] - (unsigned int)base) << (r / PACK_LANES * width);
+	}
+}
+
+void hpc::Unpack(const PackedInts& packed, Span<int> output)
+{
+	const int width = packed.width;
+	const size_t perBlock = (size_t)PACK_LANES * (32 / width);
+	const unsigned int mask = width == 32 ? 0xffffffffu : (1u << width) - 1;
+	for (size_t i = 0; i < packed.count; ++i)
+	{
+		const size_t r = i % perBlock;
+		const unsigned int word = packed.words[i / perBlock * PACK_LANES + r % PACK_LANES];
+		output[i] = (int)(((word >> (r / PACK_LANES * width)) & mask) + (unsigned int)packed.base);
+	}
+}
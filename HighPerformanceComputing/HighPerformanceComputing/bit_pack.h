@@ -0,0 +1,37 @@
+// frame-of-reference bit packing of int columns, so low-range data crosses the bus in a few bits per value
+// every value is stored as value - base in width bits, width is a power of two so no value crosses a word
+// blocks of PACK_LANES words interleave their values: value i of a block is in word i % PACK_LANES
+// at bit (i / PACK_LANES) * width, which lets the host pack PACK_LANES values per SIMD step
+
+#pragma once
+
+#include "span.h"
+#include <stddef.h>
+#include <vector>
+
+namespace hpc {
+
+	// words per interleaved block, PACK_LANES in the kernels
+	const int PACK_LANES = 4;
+
+	struct PackedInts
+	{
+		int base;			// smallest value
+		int width;			// bits per value, 1, 2, 4, 8, 16 or 32
+		size_t count;			// number of values
+		std::vector<unsigned int> words;	// whole blocks, the last one padded with base
+	};
+
+	// smallest width that holds every value of the input minus base, base is the smallest value
+	int PackedWidth(Span<const int> input, int * base);
+
+	// words of count values packed with the given width
+	size_t PackedWords(size_t count, int width);
+
+	void Pack(Span<const int> input, PackedInts& packed);
+	// with the width and base PackedWidth returned for this input
+	void Pack(Span<const int> input, int width, int base, PackedInts& packed);
+
+	// output needs room for packed.count values
+	void Unpack(const PackedInts& packed, Span<int> output);
+}
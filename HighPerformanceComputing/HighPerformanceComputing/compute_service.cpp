@@ -0,0 +1,548 @@
+#include "compute_service.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <windows.h>
+// AF_UNIX sockets exist since Windows 10 1803, older SDKs lack the header
+#if defined(__has_include)
+#if __has_include(<afunix.h>)
+#include <afunix.h>
+#define HPC_HAVE_AFUNIX
+#endif
+#endif
+#ifndef HPC_HAVE_AFUNIX
+#ifndef AF_UNIX
+#define AF_UNIX 1
+#endif
+struct sockaddr_un
+{
+	ADDRESS_FAMILY sun_family;
+	char sun_path[108];
+};
+#endif
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+
+	// sockets are intptr_t in the class, SOCKET on Windows and a descriptor otherwise, -1 if invalid
+#ifdef _WIN32
+	typedef int IoSize;
+	typedef int AddressSize;
+
+	// Winsock has to be started once per process
+	bool StartSockets()
+	{
+		static const bool started = []()
+		{
+			WSADATA data;
+			return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}();
+		return started;
+	}
+
+	intptr_t OpenSocket()
+	{
+		SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+		return s == INVALID_SOCKET ? -1 : (intptr_t)s;
+	}
+
+	void CloseSocket(intptr_t s)
+	{
+		closesocket((SOCKET)s);
+	}
+
+	bool Interrupted()
+	{
+		return WSAGetLastError() == WSAEINTR;
+	}
+
+	std::string SocketError()
+	{
+		return "error " + std::to_string(WSAGetLastError());
+	}
+
+	// a socket file left behind by a service that didn't shut down cleanly
+	void RemoveSocketFile(const std::string& path)
+	{
+		DeleteFileA(path.c_str());
+	}
+
+	int ProcessId()
+	{
+		return _getpid();
+	}
+#else
+	typedef size_t IoSize;
+	typedef socklen_t AddressSize;
+
+	bool StartSockets()
+	{
+		return true;
+	}
+
+	intptr_t OpenSocket()
+	{
+		return socket(AF_UNIX, SOCK_STREAM, 0);
+	}
+
+	void CloseSocket(intptr_t s)
+	{
+		close((int)s);
+	}
+
+	bool Interrupted()
+	{
+		return errno == EINTR;
+	}
+
+	std::string SocketError()
+	{
+		return strerror(errno);
+	}
+
+	void RemoveSocketFile(const std::string& path)
+	{
+		unlink(path.c_str());
+	}
+
+	int ProcessId()
+	{
+		return (int)getpid();
+	}
+#endif
+
+	bool ReadAll(intptr_t s, void * data, size_t size)
+	{
+		char * p = (char *)data;
+		while (size > 0)
+		{
+			auto got = recv(s, p, (IoSize)size, 0);
+			if (got < 0 && Interrupted())
+				continue;
+			if (got <= 0)
+				return false;
+			p += got;
+			size -= (size_t)got;
+		}
+		return true;
+	}
+
+	// MSG_NOSIGNAL: a client that went away must not kill the service with SIGPIPE
+	bool WriteAll(intptr_t s, const void * data, size_t size)
+	{
+		const char * p = (const char *)data;
+		while (size > 0)
+		{
+			auto sent = send(s, p, (IoSize)size, MSG_NOSIGNAL);
+			if (sent < 0 && Interrupted())
+				continue;
+			if (sent <= 0)
+				return false;
+			p += sent;
+			size -= (size_t)sent;
+		}
+		return true;
+	}
+
+	bool SocketAddress(const std::string& path, sockaddr_un& addr)
+	{
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path))
+			return false;
+		memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+		return true;
+	}
+
+	// a mapping of at least one byte, mmap refuses empty ones
+	size_t MappedSize(uint64_t inputBytes, uint64_t outputBytes)
+	{
+		return std::max<size_t>((size_t)(inputBytes + outputBytes), 1);
+	}
+
+	// the payload of a job, POSIX shared memory or a named file mapping on Windows
+	struct SharedMemory
+	{
+		void * data;
+		size_t size;
+#ifdef _WIN32
+		HANDLE mapping;
+#endif
+	};
+
+#ifdef _WIN32
+	std::string SharedName(unsigned int id)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "Local\\hpc-job-%d-%u", ProcessId(), id);
+		return name;
+	}
+
+	// client side, false if the object exists already
+	bool CreateShared(const char * name, size_t size, SharedMemory& shared)
+	{
+		const unsigned long long bytes = size;
+		shared.size = size;
+		shared.data = NULL;
+		shared.mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(bytes >> 32), (DWORD)bytes, name);
+		if (shared.mapping == NULL)
+			return false;
+		if (GetLastError() == ERROR_ALREADY_EXISTS)
+		{
+			CloseHandle(shared.mapping);
+			return false;
+		}
+		shared.data = MapViewOfFile(shared.mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (shared.data == NULL)
+		{
+			CloseHandle(shared.mapping);
+			return false;
+		}
+		return true;
+	}
+
+	// service side, a view larger than the client's object fails instead of faulting later
+	bool OpenShared(const char * name, size_t size, SharedMemory& shared)
+	{
+		shared.size = size;
+		shared.data = NULL;
+		shared.mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+		if (shared.mapping == NULL)
+			return false;
+		shared.data = MapViewOfFile(shared.mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		CloseHandle(shared.mapping);
+		shared.mapping = NULL;
+		return shared.data != NULL;
+	}
+
+	// the object goes away with the last handle and view, nothing to unlink
+	void CloseShared(const char *, SharedMemory& shared, bool)
+	{
+		if (shared.data != NULL)
+			UnmapViewOfFile(shared.data);
+		if (shared.mapping != NULL)
+			CloseHandle(shared.mapping);
+	}
+#else
+	std::string SharedName(unsigned int id)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "/hpc-job-%d-%u", ProcessId(), id);
+		return name;
+	}
+
+	bool CreateShared(const char * name, size_t size, SharedMemory& shared)
+	{
+		shared.size = size;
+		int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0)
+			return false;
+		void * data = ftruncate(fd, (off_t)size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		close(fd);
+		shared.data = data == MAP_FAILED ? NULL : data;
+		if (shared.data == NULL)
+			shm_unlink(name);
+		return shared.data != NULL;
+	}
+
+	// the sizes come from the client, a mapping past the end of the object would kill
+	// the whole service with SIGBUS once the handler touches it
+	bool OpenShared(const char * name, size_t size, SharedMemory& shared)
+	{
+		shared.size = size;
+		int fd = shm_open(name, O_RDWR, 0);
+		struct stat st;
+		const bool fits = fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= 0 && (uint64_t)st.st_size >= (uint64_t)size;
+		void * data = fits ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		if (fd >= 0)
+			close(fd);
+		shared.data = data == MAP_FAILED ? NULL : data;
+		return shared.data != NULL;
+	}
+
+	void CloseShared(const char * name, SharedMemory& shared, bool owner)
+	{
+		if (shared.data != NULL)
+			munmap(shared.data, shared.size);
+		if (owner)
+			shm_unlink(name);
+	}
+#endif
+
+}
+
+hpc::ComputeService::ComputeService(int batchWindowMs, size_t maxBatch)
+	: batchWindowMs(batchWindowMs), maxBatch(std::max<size_t>(maxBatch, 1)), connections(0), stopping(false), listener(-1)
+{
+}
+
+void hpc::ComputeService::handle(const std::string& kind, JobHandler handler)
+{
+	handlers[kind] = handler;
+}
+
+int hpc::ComputeService::serve(const std::string& socketPath)
+{
+	sockaddr_un addr;
+	if (!SocketAddress(socketPath, addr))
+	{
+		std::cerr << "Socket path too long: " << socketPath << std::endl;
+		return 1;
+	}
+	listener = StartSockets() ? OpenSocket() : -1;
+	if (listener < 0)
+	{
+		std::cerr << "Could not create a Unix domain socket: " << SocketError() << std::endl;
+		return 1;
+	}
+	RemoveSocketFile(socketPath);
+	if (bind(listener, (sockaddr *)&addr, (AddressSize)sizeof(addr)) != 0 || listen(listener, 64) != 0)
+	{
+		std::cerr << "Could not listen on " << socketPath << ": " << SocketError() << std::endl;
+		CloseSocket(listener);
+		listener = -1;
+		return 1;
+	}
+	std::cout << "Serving on " << socketPath << std::endl;
+
+	std::thread dispatcher(&ComputeService::dispatch, this);
+	for (;;)
+	{
+		intptr_t client = (intptr_t)accept(listener, NULL, NULL);
+		if (client < 0)
+		{
+			if (Interrupted())
+				continue;
+			break;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if (stopping)
+		{
+			CloseSocket(client);
+			break;
+		}
+		++connections;
+		std::thread(&ComputeService::connection, this, client).detach();
+	}
+
+	stop();
+	dispatcher.join();
+	{
+		// connection threads still hold replies to send
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this]() { return connections == 0; });
+	}
+#ifndef _WIN32
+	// on Windows stop() closed it already to end the accept
+	CloseSocket(listener);
+#endif
+	RemoveSocketFile(socketPath);
+	return 0;
+}
+
+void hpc::ComputeService::connection(intptr_t client)
+{
+	JobRequest request;
+	JobReply reply;
+	memset(&reply, 0, sizeof(reply));
+	if (ReadAll(client, &request, sizeof(request)))
+	{
+		request.kind[sizeof(request.kind) - 1] = 0;
+		request.shm[sizeof(request.shm) - 1] = 0;
+		std::string kind = request.kind;
+		if (kind == "shutdown")
+		{
+			stop();
+		}
+		else if (handlers.find(kind) == handlers.end())
+		{
+			reply.status = -1;
+		}
+		else
+		{
+			// the payload stays in the client's shared memory, the handler works on the mapping
+			const uint64_t maxSize = (uint64_t)std::numeric_limits<size_t>::max();
+			const bool sizesValid = request.inputBytes <= maxSize && request.outputBytes <= maxSize - request.inputBytes;
+			SharedMemory shared;
+			if (!sizesValid || !OpenShared(request.shm, MappedSize(request.inputBytes, request.outputBytes), shared))
+			{
+				reply.status = -2;
+			}
+			else
+			{
+				unsigned char * data = (unsigned char *)shared.data;
+				Pending job;
+				job.kind = kind;
+				job.job.input = data;
+				job.job.inputBytes = (size_t)request.inputBytes;
+				job.job.output = data + request.inputBytes;
+				job.job.outputBytes = (size_t)request.outputBytes;
+				job.job.params = request.params;
+				memset(&job.job.reply, 0, sizeof(job.job.reply));
+				job.done = false;
+
+				std::unique_lock<std::mutex> lock(mutex);
+				if (stopping)
+				{
+					// the dispatcher may already be gone
+					job.job.reply.status = -4;
+				}
+				else
+				{
+					pending.push_back(&job);
+					wake.notify_one();
+					finished.wait(lock, [&job]() { return job.done; });
+				}
+				lock.unlock();
+
+				reply = job.job.reply;
+				CloseShared(request.shm, shared, false);
+			}
+		}
+	}
+	WriteAll(client, &reply, sizeof(reply));
+	CloseSocket(client);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	--connections;
+	finished.notify_all();
+}
+
+void hpc::ComputeService::dispatch()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		wake.wait(lock, [this]() { return !pending.empty() || stopping; });
+		if (pending.empty())
+			break;
+
+		// give concurrent clients of the same kind a moment to join the batch
+		if (batchWindowMs > 0 && pending.size() < maxBatch)
+		{
+			lock.unlock();
+			std::this_thread::sleep_for(std::chrono::milliseconds(batchWindowMs));
+			lock.lock();
+		}
+
+		const std::string kind = pending.front()->kind;
+		std::vector<Pending *> taken;
+		std::vector<Job *> batch;
+		for (std::deque<Pending *>::iterator it = pending.begin(); it != pending.end() && batch.size() < maxBatch;)
+		{
+			if ((*it)->kind == kind)
+			{
+				taken.push_back(*it);
+				batch.push_back(&(*it)->job);
+				it = pending.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+		lock.unlock();
+
+		try
+		{
+			handlers[kind](batch);
+		}
+		catch (...)
+		{
+			for (size_t i = 0; i < batch.size(); ++i)
+				batch[i]->reply.status = -3;
+		}
+
+		lock.lock();
+		for (size_t i = 0; i < taken.size(); ++i)
+			taken[i]->done = true;
+		finished.notify_all();
+	}
+}
+
+// wakes the dispatcher to drain the queue and the accept loop to return
+// Winsock only ends a blocking accept by closing the socket, elsewhere it is shut down
+void hpc::ComputeService::stop()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopping)
+		return;
+	stopping = true;
+	wake.notify_all();
+	if (listener >= 0)
+	{
+#ifdef _WIN32
+		CloseSocket(listener);
+#else
+		shutdown((int)listener, SHUT_RDWR);
+#endif
+	}
+}
+
+bool hpc::SubmitJob(const std::string& socketPath, const std::string& kind, const int32_t * params, size_t paramCount,
+	const void * input, size_t inputBytes, void * output, size_t outputBytes, JobReply& reply)
+{
+	static std::atomic<unsigned int> counter(0);
+	JobRequest request;
+	memset(&request, 0, sizeof(request));
+	strncpy(request.kind, kind.c_str(), sizeof(request.kind) - 1);
+	strncpy(request.shm, SharedName(counter++).c_str(), sizeof(request.shm) - 1);
+	request.inputBytes = inputBytes;
+	request.outputBytes = outputBytes;
+	memcpy(request.params, params, sizeof(int32_t) * std::min(paramCount, JOB_PARAMS));
+
+	sockaddr_un addr;
+	if (!SocketAddress(socketPath, addr) || !StartSockets())
+		return false;
+
+	SharedMemory shared;
+	if (!CreateShared(request.shm, MappedSize(inputBytes, outputBytes), shared))
+		return false;
+	if (inputBytes > 0)
+		memcpy(shared.data, input, inputBytes);
+
+	intptr_t sock = OpenSocket();
+	bool ok = sock >= 0 && connect(sock, (sockaddr *)&addr, (AddressSize)sizeof(addr)) == 0
+		&& WriteAll(sock, &request, sizeof(request)) && ReadAll(sock, &reply, sizeof(reply));
+	if (sock >= 0)
+		CloseSocket(sock);
+	if (ok && outputBytes > 0)
+		memcpy(output, (unsigned char *)shared.data + inputBytes, outputBytes);
+	CloseShared(request.shm, shared, true);
+	return ok;
+}
+
+std::string hpc::DefaultSocketPath(const std::string& service)
+{
+#ifdef _WIN32
+	char temp[MAX_PATH + 1];
+	DWORD length = GetTempPathA(sizeof(temp), temp);
+	if (length > 0 && length < sizeof(temp))
+		return std::string(temp) + "hpc-" + service + ".sock";
+#endif
+	return "/tmp/hpc-" + service + ".sock";
+}
@@ -0,0 +1,98 @@
+// long-running local service that keeps the OpenCL context and built programs of an executable warm
+// jobs arrive over a Unix domain socket, their payloads live in POSIX shared memory so only a small
+// header crosses the socket; jobs of one kind that arrive together reach their handler as one batch
+// on Windows the socket is AF_UNIX as well (Windows 10 1803 and later) and the payload a named file mapping
+
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace hpc {
+
+	const size_t JOB_PARAMS = 8;
+
+	// sent by the client, the shared memory object holds inputBytes of input followed by outputBytes of output
+	struct JobRequest
+	{
+		char kind[32];
+		char shm[64];
+		uint64_t inputBytes;
+		uint64_t outputBytes;
+		int32_t params[JOB_PARAMS];
+	};
+
+	// sent back once the output is in shared memory
+	struct JobReply
+	{
+		int32_t status;				// 0 on success, -1 unknown kind or rejected by the handler,
+							// -2 payload missing or smaller than the sizes, -3 handler failed, -4 shutting down
+		int32_t values[JOB_PARAMS];		// job specific results, e.g. element counts
+	};
+
+	// one job as a handler sees it, input and output point into the client's shared memory
+	struct Job
+	{
+		const unsigned char * input;
+		size_t inputBytes;
+		unsigned char * output;
+		size_t outputBytes;
+		const int32_t * params;
+		JobReply reply;
+	};
+
+	// processes every job of one kind that arrived together and fills in their replies
+	// a handler that throws fails the whole batch
+	typedef std::function<void(std::vector<Job *>& batch)> JobHandler;
+
+	class ComputeService
+	{
+	public:
+		// the first job of a batch waits batchWindowMs for others of its kind, at most maxBatch are merged
+		explicit ComputeService(int batchWindowMs = 1, size_t maxBatch = 256);
+
+		void handle(const std::string& kind, JobHandler handler);
+
+		// accepts jobs until a "shutdown" job arrives, returns 0 after a clean shutdown
+		int serve(const std::string& socketPath);
+
+	private:
+		struct Pending
+		{
+			std::string kind;
+			Job job;
+			bool done;
+		};
+
+		void connection(intptr_t client);
+		void dispatch();
+		void stop();
+
+		int batchWindowMs;
+		size_t maxBatch;
+		std::map<std::string, JobHandler> handlers;
+
+		std::mutex mutex;
+		std::condition_variable wake;		// new jobs or shutdown, for the dispatcher
+		std::condition_variable finished;	// finished jobs and closed connections
+		std::deque<Pending *> pending;
+		size_t connections;
+		bool stopping;
+		intptr_t listener;		// SOCKET on Windows, -1 until serve() listens
+	};
+
+	// client side, runs one job and waits for its reply
+	// output receives outputBytes of the job's output, false if the service couldn't be reached
+	bool SubmitJob(const std::string& socketPath, const std::string& kind, const int32_t * params, size_t paramCount,
+		const void * input, size_t inputBytes, void * output, size_t outputBytes, JobReply& reply);
+
+	// socket of a service when none is given on the command line
+	std::string DefaultSocketPath(const std::string& service);
+
+}
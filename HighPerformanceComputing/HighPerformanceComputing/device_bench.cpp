@@ -0,0 +1,327 @@
+#include "device_bench.h"
+#include "program_cache.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+namespace {
+
+	const char * BENCH_SOURCE =
+		"__kernel void bench_empty()\n"
+		"{\n"
+		"}\n"
+		"\n"
+		"__kernel void bench_copy(__global const float4 * in, __global float4 * out)\n"
+		"{\n"
+		"	size_t i = get_global_id(0);\n"
+		"	out[i] = in[i];\n"
+		"}\n"
+		"\n"
+		"// every item reads and writes LOCAL_ITERATIONS words of local memory\n"
+		"__kernel void bench_local(__global float * out, __local float * temp)\n"
+		"{\n"
+		"	const int lid = get_local_id(0);\n"
+		"	const int size = get_local_size(0);\n"
+		"	temp[lid] = lid;\n"
+		"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	float sum = 0.0f;\n"
+		"	for (int i = 0; i < LOCAL_ITERATIONS; ++i)\n"
+		"	{\n"
+		"		int j = (lid + i) % size;\n"
+		"		sum += temp[j];\n"
+		"		temp[j] = sum;\n"
+		"	}\n"
+		"	out[get_global_id(0)] = sum;\n"
+		"}\n"
+		"\n"
+		"__kernel void bench_atomic_contended(__global int * counter)\n"
+		"{\n"
+		"	atomic_inc(counter);\n"
+		"}\n"
+		"\n"
+		"__kernel void bench_atomic_distinct(__global int * counters)\n"
+		"{\n"
+		"	atomic_inc(&counters[get_global_id(0)]);\n"
+		"}\n"
+		"\n"
+		"__kernel void bench_atomic_local(__global int * out, __local int * counters)\n"
+		"{\n"
+		"	const int lid = get_local_id(0);\n"
+		"	if (lid < 32)\n"
+		"	{\n"
+		"		counters[lid] = 0;\n"
+		"	}\n"
+		"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	for (int i = 0; i < LOCAL_ITERATIONS; ++i)\n"
+		"	{\n"
+		"		atomic_inc(&counters[(lid + i) & 31]);\n"
+		"	}\n"
+		"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	if (lid < 32)\n"
+		"	{\n"
+		"		out[get_group_id(0) * 32 + lid] = counters[lid];\n"
+		"	}\n"
+		"}\n"
+		"\n"
+		"// two independent multiply-add chains of type T, built once per type and width\n"
+		"__kernel void bench_ops(__global T * out, S a, S b)\n"
+		"{\n"
+		"	T x = (T)((S)get_global_id(0));\n"
+		"	T y = (T)(a);\n"
+		"	for (int i = 0; i < OPS_ITERATIONS; ++i)\n"
+		"	{\n"
+		"		x = x * (T)(a) + (T)(b);\n"
+		"		y = y * (T)(a) + (T)(b);\n"
+		"	}\n"
+		"	out[get_global_id(0)] = x + y;\n"
+		"}\n";
+
+	const int LOCAL_ITERATIONS = 256;
+	const int OPS_ITERATIONS = 256;
+	const int REPEAT = 5;
+	const int LAUNCHES = 1000;
+
+	cl::Program Build(const cl::Context& context, const cl::Device& device, const std::string& options)
+	{
+		std::string sourceCode(BENCH_SOURCE);
+		std::ostringstream opts;
+		opts << "-DLOCAL_ITERATIONS=" << LOCAL_ITERATIONS << " -DOPS_ITERATIONS=" << OPS_ITERATIONS << " " << options;
+		return hpc::BuildProgram(context, std::vector<cl::Device>(1, device), sourceCode, opts.str());
+	}
+
+	// best of REPEAT runs of a profiled kernel in ms
+	double TimeKernel(const cl::CommandQueue& queue, const cl::Kernel& kernel, const cl::NDRange& global, const cl::NDRange& local)
+	{
+		double best = 0.0;
+		for (int r = 0; r < REPEAT; ++r)
+		{
+			cl::Event event;
+			queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local, NULL, &event);
+			event.wait();
+			double ms = hpc::ElapsedMs(event);
+			if (r == 0 || ms < best)
+				best = ms;
+		}
+		return best;
+	}
+
+	// best of REPEAT transfers in GB/s
+	double TimeTransfer(const cl::CommandQueue& queue, const cl::Buffer& buffer, void * host, size_t bytes, bool write)
+	{
+		double best = 0.0;
+		for (int r = 0; r < REPEAT; ++r)
+		{
+			cl::Event event;
+			if (write)
+				queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, bytes, host, NULL, &event);
+			else
+				queue.enqueueReadBuffer(buffer, CL_TRUE, 0, bytes, host, NULL, &event);
+			double ms = hpc::ElapsedMs(event);
+			if (ms > 0.0)
+				best = std::max(best, bytes / (ms * 1e6));
+		}
+		return best;
+	}
+
+	void Transfers(const cl::Context& context, const cl::CommandQueue& queue, const cl::Device& device, hpc::BenchResult& r)
+	{
+		size_t bytes = (size_t)std::min<cl_ulong>(64 << 20, device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / 4);
+		cl::Buffer buffer(context, CL_MEM_READ_WRITE, bytes);
+
+		std::vector<unsigned char> pageable(bytes, 1);
+		r.h2dPageable = TimeTransfer(queue, buffer, &pageable[0], bytes, true);
+		r.d2hPageable = TimeTransfer(queue, buffer, &pageable[0], bytes, false);
+
+		// pinned: host memory allocated by the runtime and mapped once
+		cl::Buffer pinned(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes);
+		void * host = queue.enqueueMapBuffer(pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes);
+		r.h2dPinned = TimeTransfer(queue, buffer, host, bytes, true);
+		r.d2hPinned = TimeTransfer(queue, buffer, host, bytes, false);
+		queue.enqueueUnmapMemObject(pinned, host);
+		queue.finish();
+	}
+
+	void Kernels(const cl::Context& context, const cl::CommandQueue& queue, const cl::Device& device, hpc::BenchResult& r)
+	{
+		cl::Program program = Build(context, device, "-DT=float -DS=float");
+		const size_t maxGroup = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+		const size_t group = std::min<size_t>(256, maxGroup);
+		const size_t units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+
+		// launch latency: wall clock of many empty launches
+		cl::Kernel empty(program, "bench_empty");
+		queue.enqueueNDRangeKernel(empty, cl::NullRange, cl::NDRange(1));
+		queue.finish();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < LAUNCHES; ++i)
+		{
+			queue.enqueueNDRangeKernel(empty, cl::NullRange, cl::NDRange(1));
+			queue.finish();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		r.launchLatency = std::chrono::duration<double, std::micro>(end - start).count() / LAUNCHES;
+
+		// global memory
+		size_t bytes = (size_t)std::min<cl_ulong>(64 << 20, device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / 4);
+		bytes -= bytes % (16 * group);
+		cl::Buffer in(context, CL_MEM_READ_ONLY, bytes);
+		cl::Buffer out(context, CL_MEM_WRITE_ONLY, bytes);
+		cl::Kernel copy(program, "bench_copy");
+		copy.setArg(0, in);
+		copy.setArg(1, out);
+		double ms = TimeKernel(queue, copy, cl::NDRange(bytes / 16), cl::NDRange(group));
+		r.globalBandwidth = ms > 0.0 ? 2.0 * bytes / (ms * 1e6) : 0.0;
+
+		// local memory
+		size_t items = units * 16 * group;
+		cl::Buffer result(context, CL_MEM_WRITE_ONLY, items * sizeof(cl_int));
+		cl::Kernel local(program, "bench_local");
+		local.setArg(0, result);
+		local.setArg(1, cl::Local(group * sizeof(cl_float)));
+		ms = TimeKernel(queue, local, cl::NDRange(items), cl::NDRange(group));
+		r.localBandwidth = ms > 0.0 ? 2.0 * items * LOCAL_ITERATIONS * sizeof(cl_float) / (ms * 1e6) : 0.0;
+
+		// atomics
+		cl::Buffer counters(context, CL_MEM_READ_WRITE, items * sizeof(cl_int));
+		cl::Kernel contended(program, "bench_atomic_contended");
+		contended.setArg(0, counters);
+		ms = TimeKernel(queue, contended, cl::NDRange(items), cl::NDRange(group));
+		r.atomicContended = ms > 0.0 ? items / (ms * 1e3) : 0.0;
+
+		cl::Kernel distinct(program, "bench_atomic_distinct");
+		distinct.setArg(0, counters);
+		ms = TimeKernel(queue, distinct, cl::NDRange(items), cl::NDRange(group));
+		r.atomicDistinct = ms > 0.0 ? items / (ms * 1e3) : 0.0;
+
+		cl::Kernel atomicLocal(program, "bench_atomic_local");
+		atomicLocal.setArg(0, counters);
+		atomicLocal.setArg(1, cl::Local(32 * sizeof(cl_int)));
+		ms = TimeKernel(queue, atomicLocal, cl::NDRange(items), cl::NDRange(group));
+		r.atomicLocal = ms > 0.0 ? (double)items * LOCAL_ITERATIONS / (ms * 1e3) : 0.0;
+
+		// arithmetic throughput per type and vector width
+		for (int w = 0; w < hpc::BENCH_WIDTH_COUNT; ++w)
+		{
+			for (int isFloat = 0; isFloat < 2; ++isFloat)
+			{
+				const char * scalar = isFloat ? "float" : "int";
+				std::ostringstream opts;
+				opts << "-DS=" << scalar << " -DT=" << scalar;
+				if (hpc::BENCH_WIDTHS[w] > 1)
+					opts << hpc::BENCH_WIDTHS[w];
+				cl::Program typed = Build(context, device, opts.str());
+
+				size_t opsItems = units * 64 * group / hpc::BENCH_WIDTHS[w];
+				opsItems -= opsItems % group;
+				cl::Buffer opsOut(context, CL_MEM_WRITE_ONLY, opsItems * hpc::BENCH_WIDTHS[w] * sizeof(cl_float));
+				cl::Kernel ops(typed, "bench_ops");
+				ops.setArg(0, opsOut);
+				if (isFloat)
+				{
+					ops.setArg(1, 0.999f);
+					ops.setArg(2, 0.001f);
+				}
+				else
+				{
+					ops.setArg(1, (cl_int)3);
+					ops.setArg(2, (cl_int)1);
+				}
+				ms = TimeKernel(queue, ops, cl::NDRange(opsItems), cl::NDRange(group));
+
+				// 2 chains * (mul + add) per iteration and component
+				double count = (double)opsItems * hpc::BENCH_WIDTHS[w] * OPS_ITERATIONS * 4;
+				double rate = ms > 0.0 ? count / (ms * 1e6) : 0.0;
+				if (isFloat)
+					r.floatOps[w] = rate;
+				else
+					r.intOps[w] = rate;
+			}
+		}
+	}
+
+	std::string JsonString(const std::string& s)
+	{
+		std::ostringstream out;
+		out << '"';
+		for (size_t i = 0; i < s.size(); ++i)
+		{
+			unsigned char c = (unsigned char)s[i];
+			if (c == '"' || c == '\\')
+				out << '\\' << c;
+			else if (c < 0x20)
+			{
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out << buf;
+			}
+			else if (c != 0)
+				out << c;
+		}
+		out << '"';
+		return out.str();
+	}
+
+}
+
+hpc::BenchResult hpc::RunBenchmarks(const cl::Device& device, unsigned int platformIndex, unsigned int deviceIndex)
+{
+	BenchResult r = BenchResult();
+	r.platformIndex = platformIndex;
+	r.deviceIndex = deviceIndex;
+	r.name = device.getInfo<CL_DEVICE_NAME>();
+	r.vendor = device.getInfo<CL_DEVICE_VENDOR>();
+	r.driver = device.getInfo<CL_DRIVER_VERSION>();
+
+	try
+	{
+		cl::Context context(device);
+		cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+		Transfers(context, queue, device, r);
+		Kernels(context, queue, device, r);
+	}
+	catch (cl::Error err)
+	{
+		std::ostringstream msg;
+		msg << err.what() << "(" << err.err() << ")";
+		r.error = msg.str();
+	}
+	return r;
+}
+
+void hpc::WriteBenchJson(std::ostream& out, const std::vector<BenchResult>& results)
+{
+	out << "{\n  \"devices\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const BenchResult& r = results[i];
+		out << (i == 0 ? "\n" : ",\n") << "    {\n";
+		out << "      \"platform\": " << r.platformIndex << ",\n";
+		out << "      \"device\": " << r.deviceIndex << ",\n";
+		out << "      \"name\": " << JsonString(r.name) << ",\n";
+		out << "      \"vendor\": " << JsonString(r.vendor) << ",\n";
+		out << "      \"driver\": " << JsonString(r.driver) << ",\n";
+		if (!r.error.empty())
+			out << "      \"error\": " << JsonString(r.error) << ",\n";
+		out << "      \"h2d_pageable_gbps\": " << r.h2dPageable << ",\n";
+		out << "      \"d2h_pageable_gbps\": " << r.d2hPageable << ",\n";
+		out << "      \"h2d_pinned_gbps\": " << r.h2dPinned << ",\n";
+		out << "      \"d2h_pinned_gbps\": " << r.d2hPinned << ",\n";
+		out << "      \"launch_latency_us\": " << r.launchLatency << ",\n";
+		out << "      \"global_bandwidth_gbps\": " << r.globalBandwidth << ",\n";
+		out << "      \"local_bandwidth_gbps\": " << r.localBandwidth << ",\n";
+		out << "      \"atomic_contended_mops\": " << r.atomicContended << ",\n";
+		out << "      \"atomic_distinct_mops\": " << r.atomicDistinct << ",\n";
+		out << "      \"atomic_local_mops\": " << r.atomicLocal << ",\n";
+		out << "      \"int_gops\": {";
+		for (int w = 0; w < BENCH_WIDTH_COUNT; ++w)
+			out << (w == 0 ? " " : ", ") << "\"" << BENCH_WIDTHS[w] << "\": " << r.intOps[w];
+		out << " },\n";
+		out << "      \"float_gflops\": {";
+		for (int w = 0; w < BENCH_WIDTH_COUNT; ++w)
+			out << (w == 0 ? " " : ", ") << "\"" << BENCH_WIDTHS[w] << "\": " << r.floatOps[w];
+		out << " }\n";
+		out << "    }";
+	}
+	out << "\n  ]\n}\n";
+}
@@ -0,0 +1,44 @@
+// device microbenchmarks for the query tool (--bench)
+// results are written as JSON for the tuning and scheduling code
+
+#pragma once
+
+#include "device_select.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace hpc {
+
+	// vector widths measured by the arithmetic throughput benchmarks
+	const int BENCH_WIDTHS[] = { 1, 2, 4, 8, 16 };
+	const int BENCH_WIDTH_COUNT = 5;
+
+	struct BenchResult
+	{
+		unsigned int platformIndex;
+		unsigned int deviceIndex;
+		std::string name;
+		std::string vendor;
+		std::string driver;
+		std::string error;		// set if a benchmark failed, the rest stays 0
+
+		double h2dPageable;		// GB/s
+		double d2hPageable;		// GB/s
+		double h2dPinned;		// GB/s
+		double d2hPinned;		// GB/s
+		double launchLatency;		// us per empty kernel, enqueue to completion
+		double globalBandwidth;		// GB/s, read + write of a copy kernel
+		double localBandwidth;		// GB/s, read + write of local memory
+		double atomicContended;		// million atomic_inc per second on one counter
+		double atomicDistinct;		// million atomic_inc per second on one counter per work item
+		double atomicLocal;		// million atomic_inc per second on local counters
+		double intOps[BENCH_WIDTH_COUNT];	// G int ops per second per vector width
+		double floatOps[BENCH_WIDTH_COUNT];	// GFLOP/s per vector width
+	};
+
+	BenchResult RunBenchmarks(const cl::Device& device, unsigned int platformIndex, unsigned int deviceIndex);
+
+	void WriteBenchJson(std::ostream& out, const std::vector<BenchResult>& results);
+
+}
@@ -0,0 +1,349 @@
+#include "device_select.h"
+#include "program_cache.h"
+#include "tuning.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+namespace {
+
+	const char * PROBE_SOURCE =
+		"__kernel void probe_copy(__global const float4 * in, __global float4 * out)\n"
+		"{\n"
+		"	size_t i = get_global_id(0);\n"
+		"	out[i] = in[i];\n"
+		"}\n"
+		"\n"
+		"__kernel void probe_mad(__global float * out, float a, float b)\n"
+		"{\n"
+		"	float x = (float)get_global_id(0);\n"
+		"	float y = a;\n"
+		"	for (int i = 0; i < 256; ++i)\n"
+		"	{\n"
+		"		x = mad(x, a, b);\n"
+		"		y = mad(y, b, a);\n"
+		"	}\n"
+		"	out[get_global_id(0)] = x + y;\n"
+		"}\n";
+
+	const int PROBE_REPEAT = 3;
+	const double MAD_FLOPS_PER_ITEM = 256 * 2 * 2;
+
+	// keys of the persisted measurements in the device's tuning file, in MB/s and MFLOP/s
+	const char * BANDWIDTH_KEY = "probe.bandwidth_mbps";
+	const char * COMPUTE_KEY = "probe.compute_mflops";
+
+	// raw measurements, independent of the workload
+	struct Probe
+	{
+		cl::Platform platform;
+		cl::Device device;
+		unsigned int platformIndex;
+		unsigned int deviceIndex;
+		double bandwidth;
+		double compute;
+		double limits;
+	};
+
+	std::vector<Probe> probes;
+	bool probed = false;
+	std::mutex probeMutex;
+
+	// measurements of an earlier run, false if the device was never probed successfully
+	bool LoadProbe(Probe& p)
+	{
+		hpc::Tuning tuning = hpc::Tuning::Load(p.device);
+		p.bandwidth = tuning.get(BANDWIDTH_KEY, 0) / 1000.0;
+		p.compute = tuning.get(COMPUTE_KEY, 0) / 1000.0;
+		return p.bandwidth > 0.0 && p.compute > 0.0;
+	}
+
+	void RunProbes(Probe& p)
+	{
+		if (LoadProbe(p))
+			return;
+
+		p.bandwidth = 0.0;
+		p.compute = 0.0;
+		try
+		{
+			cl::Context context(p.device);
+			cl::CommandQueue queue(context, p.device, CL_QUEUE_PROFILING_ENABLE);
+			std::string sourceCode(PROBE_SOURCE);
+			cl::Program program = hpc::BuildProgram(context, std::vector<cl::Device>(1, p.device), sourceCode);
+
+			// bandwidth: copy 16 MB (or a quarter of the largest allocation)
+			size_t bytes = (size_t)std::min<cl_ulong>(16 << 20, p.device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / 4);
+			bytes -= bytes % 16;
+			cl::Buffer in(context, CL_MEM_READ_ONLY, bytes);
+			cl::Buffer out(context, CL_MEM_WRITE_ONLY, bytes);
+			cl::Kernel copy(program, "probe_copy");
+			copy.setArg(0, in);
+			copy.setArg(1, out);
+			double best = 0.0;
+			for (int r = 0; r < PROBE_REPEAT; ++r)
+			{
+				cl::Event event;
+				queue.enqueueNDRangeKernel(copy, cl::NullRange, cl::NDRange(bytes / 16), cl::NullRange, NULL, &event);
+				event.wait();
+				double ms = hpc::ElapsedMs(event);
+				if (ms > 0.0)
+					best = std::max(best, 2.0 * bytes / (ms * 1e6));
+			}
+			p.bandwidth = best;
+
+			// compute: dependent mads, enough items to fill every compute unit
+			size_t items = (size_t)p.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 2048;
+			cl::Buffer result(context, CL_MEM_WRITE_ONLY, items * sizeof(cl_float));
+			cl::Kernel mad(program, "probe_mad");
+			mad.setArg(0, result);
+			mad.setArg(1, 0.999f);
+			mad.setArg(2, 0.001f);
+			best = 0.0;
+			for (int r = 0; r < PROBE_REPEAT; ++r)
+			{
+				cl::Event event;
+				queue.enqueueNDRangeKernel(mad, cl::NullRange, cl::NDRange(items), cl::NullRange, NULL, &event);
+				event.wait();
+				double ms = hpc::ElapsedMs(event);
+				if (ms > 0.0)
+					best = std::max(best, items * MAD_FLOPS_PER_ITEM / (ms * 1e6));
+			}
+			p.compute = best;
+		}
+		catch (cl::Error err)
+		{
+			// a device that can't run the probes is still scored by its limits
+			std::cerr << "device probe failed: " << err.what() << "(" << err.err() << ")" << std::endl;
+		}
+
+		// a failed probe isn't kept, the next run tries again
+		if (p.bandwidth > 0.0 && p.compute > 0.0)
+			hpc::StoreProbe(p.device, p.bandwidth, p.compute);
+	}
+
+	Probe MakeProbe(const cl::Platform& platform, const cl::Device& device, unsigned int platformIndex, unsigned int deviceIndex)
+	{
+		Probe p;
+		p.platform = platform;
+		p.device = device;
+		p.platformIndex = platformIndex;
+		p.deviceIndex = deviceIndex;
+		p.bandwidth = 0.0;
+		p.compute = 0.0;
+		p.limits = (double)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>()
+			* device.getInfo<CL_DEVICE_MAX_CLOCK_FREQUENCY>();
+		return p;
+	}
+
+	std::vector<cl::Platform> Platforms()
+	{
+		std::vector<cl::Platform> platforms;
+		try
+		{
+			cl::Platform::get(&platforms);
+		}
+		catch (cl::Error)
+		{
+			platforms.clear();
+		}
+		return platforms;
+	}
+
+	// the device HPC_DEVICE names, without probing any device
+	bool FindDevice(unsigned int platformIndex, unsigned int deviceIndex, Probe& p)
+	{
+		std::vector<cl::Platform> platforms = Platforms();
+		if (platformIndex >= platforms.size())
+			return false;
+		std::vector<cl::Device> devices;
+		try
+		{
+			platforms[platformIndex].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+		}
+		catch (cl::Error)
+		{
+			return false;
+		}
+		if (deviceIndex >= devices.size() || !devices[deviceIndex].getInfo<CL_DEVICE_AVAILABLE>())
+			return false;
+		p = MakeProbe(platforms[platformIndex], devices[deviceIndex], platformIndex, deviceIndex);
+		LoadProbe(p);
+		return true;
+	}
+
+	void ProbeAll()
+	{
+		std::vector<cl::Platform> platforms = Platforms();
+
+		for (unsigned int i = 0; i < platforms.size(); ++i)
+		{
+			std::vector<cl::Device> devices;
+			try
+			{
+				platforms[i].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+			}
+			catch (cl::Error)
+			{
+				continue;
+			}
+
+			for (unsigned int j = 0; j < devices.size(); ++j)
+			{
+				if (!devices[j].getInfo<CL_DEVICE_AVAILABLE>())
+					continue;
+				Probe p = MakeProbe(platforms[i], devices[j], i, j);
+				RunProbes(p);
+				probes.push_back(p);
+			}
+		}
+	}
+
+}
+
+double hpc::ElapsedMs(const cl::Event& event)
+{
+	cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+	return (end - start) * 1e-6;
+}
+
+std::vector<hpc::DeviceScore> hpc::ScoreDevices(Workload workload)
+{
+	{
+		std::lock_guard<std::mutex> lock(probeMutex);
+		if (!probed)
+		{
+			ProbeAll();
+			probed = true;
+		}
+	}
+
+	double maxBandwidth = 0.0, maxCompute = 0.0, maxLimits = 0.0;
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		maxBandwidth = std::max(maxBandwidth, probes[i].bandwidth);
+		maxCompute = std::max(maxCompute, probes[i].compute);
+		maxLimits = std::max(maxLimits, probes[i].limits);
+	}
+
+	// memory bound kernels mostly care about bandwidth, the rotation about both
+	const double wBandwidth = workload == WORKLOAD_MEMORY ? 0.8 : 0.4;
+	const double wCompute = 1.0 - wBandwidth;
+	const double wLimits = 0.1;
+
+	std::vector<DeviceScore> scores;
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		const Probe& p = probes[i];
+		DeviceScore s;
+		s.platform = p.platform;
+		s.device = p.device;
+		s.platformIndex = p.platformIndex;
+		s.deviceIndex = p.deviceIndex;
+		s.bandwidth = p.bandwidth;
+		s.compute = p.compute;
+		s.limits = p.limits;
+
+		double limits = maxLimits > 0.0 ? p.limits / maxLimits : 0.0;
+		double measured = (maxBandwidth > 0.0 ? wBandwidth * p.bandwidth / maxBandwidth : 0.0)
+			+ (maxCompute > 0.0 ? wCompute * p.compute / maxCompute : 0.0);
+		// without any measurement the limits are all we have
+		if (p.bandwidth == 0.0 && p.compute == 0.0)
+			measured = 0.5 * limits;
+		s.score = (1.0 - wLimits) * measured + wLimits * limits;
+		scores.push_back(s);
+	}
+	return scores;
+}
+
+void hpc::StoreProbe(const cl::Device& device, double bandwidth, double compute)
+{
+	Tuning tuning = Tuning::Load(device);
+	tuning.set(BANDWIDTH_KEY, (int)(bandwidth * 1000.0));
+	tuning.set(COMPUTE_KEY, (int)(compute * 1000.0));
+	tuning.save();
+}
+
+hpc::DeviceScore hpc::SelectDevice(Workload workload)
+{
+	// the override is resolved before anything is probed
+	const char * env = getenv("HPC_DEVICE");
+	unsigned int platformIndex, deviceIndex;
+	if (env != NULL && sscanf(env, "%u:%u", &platformIndex, &deviceIndex) == 2)
+	{
+		Probe p;
+		if (FindDevice(platformIndex, deviceIndex, p))
+		{
+			DeviceScore s;
+			s.platform = p.platform;
+			s.device = p.device;
+			s.platformIndex = p.platformIndex;
+			s.deviceIndex = p.deviceIndex;
+			s.bandwidth = p.bandwidth;
+			s.compute = p.compute;
+			s.limits = p.limits;
+			s.score = 1.0;
+			return s;
+		}
+		std::cerr << "HPC_DEVICE=" << env << " not found, selecting automatically" << std::endl;
+	}
+
+	std::vector<DeviceScore> scores = ScoreDevices(workload);
+	if (scores.empty())
+		throw cl::Error(CL_DEVICE_NOT_FOUND, "SelectDevice");
+
+	size_t best = 0;
+	for (size_t i = 1; i < scores.size(); ++i)
+	{
+		if (scores[i].score > scores[best].score)
+			best = i;
+	}
+	return scores[best];
+}
+
+std::vector<double> hpc::DeviceWeights(const std::vector<cl::Device>& devices, Workload workload)
+{
+	std::vector<DeviceScore> scores = ScoreDevices(workload);
+	std::vector<double> weights(devices.size(), 0.0);
+	double minMeasured = 0.0;
+	for (size_t d = 0; d < devices.size(); ++d)
+	{
+		for (size_t i = 0; i < scores.size(); ++i)
+		{
+			if (scores[i].device() == devices[d]())
+				weights[d] = workload == WORKLOAD_MEMORY ? scores[i].bandwidth : scores[i].compute;
+		}
+		if (weights[d] > 0.0 && (minMeasured == 0.0 || weights[d] < minMeasured))
+			minMeasured = weights[d];
+	}
+
+	// devices whose probe failed get the share of the slowest measured one
+	double sum = 0.0;
+	for (size_t d = 0; d < weights.size(); ++d)
+	{
+		if (weights[d] <= 0.0)
+			weights[d] = minMeasured > 0.0 ? minMeasured : 1.0;
+		sum += weights[d];
+	}
+	for (size_t d = 0; d < weights.size(); ++d)
+		weights[d] /= sum;
+	return weights;
+}
+
+std::vector<size_t> hpc::SplitRange(size_t n, const std::vector<double>& weights, size_t align)
+{
+	std::vector<size_t> bounds(weights.size() + 1, 0);
+	double acc = 0.0;
+	for (size_t i = 0; i + 1 < weights.size(); ++i)
+	{
+		acc += weights[i];
+		size_t b = (size_t)(acc * n) / align * align;
+		bounds[i + 1] = std::min(std::max(b, bounds[i]), n);
+	}
+	bounds[weights.size()] = n;
+	return bounds;
+}
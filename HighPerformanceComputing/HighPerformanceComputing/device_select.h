@@ -0,0 +1,62 @@
+// benchmark driven platform/device selection shared by all projects
+// every device is scored with a short bandwidth and compute probe plus its
+// reported limits, HPC_DEVICE=<platform>:<device> overrides the choice
+// the probe results are kept in the device's tuning file (probe.* keys), so a device
+// is only measured on its first run, delete the keys to measure it again
+
+#pragma once
+
+// NVidia only supports OpenCL 1.2
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include <vector>
+
+namespace hpc {
+
+	enum Workload
+	{
+		WORKLOAD_MEMORY,		// compaction, scan: bound by global memory bandwidth
+		WORKLOAD_COMPUTE		// rotation, image pipelines: arithmetic per pixel
+	};
+
+	struct DeviceScore
+	{
+		cl::Platform platform;
+		cl::Device device;
+		unsigned int platformIndex;
+		unsigned int deviceIndex;
+		double bandwidth;		// GB/s measured by a copy kernel, 0 if the probe failed
+		double compute;			// GFLOP/s measured by a mad kernel, 0 if the probe failed
+		double limits;			// compute units * clock (MHz) as reported by the driver
+		double score;			// relative to the best device for the workload, in [0, 1]
+	};
+
+	// probe every device of every platform that has no stored probe, once per process
+	std::vector<DeviceScore> ScoreDevices(Workload workload);
+
+	// keeps measured copy bandwidth (GB/s) and mad throughput (GFLOP/s) for the next runs
+	void StoreProbe(const cl::Device& device, double bandwidth, double compute);
+
+	// best device for the workload, HPC_DEVICE is honoured without probing the other devices
+	// throws cl::Error(CL_DEVICE_NOT_FOUND) if there is no device at all
+	DeviceScore SelectDevice(Workload workload);
+
+	// share of the work for each device in proportion to its measured throughput for the
+	// workload (bandwidth or compute), the shares add up to 1
+	std::vector<double> DeviceWeights(const std::vector<cl::Device>& devices, Workload workload);
+
+	// split [0, n) into one range per weight, range i is [bounds[i], bounds[i + 1])
+	// every inner boundary is a multiple of align
+	std::vector<size_t> SplitRange(size_t n, const std::vector<double>& weights, size_t align);
+
+	// milliseconds between start and end of a profiled command
+	double ElapsedMs(const cl::Event& event);
+
+}
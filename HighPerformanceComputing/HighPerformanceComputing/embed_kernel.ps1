@@ -0,0 +1,24 @@
+# embed_kernel.ps1 <kernel.cl> <header> [symbol]
+# pre-build step of the OpenCL projects: turns a kernel source into a byte array
+# header so the executables don't depend on the working directory at runtime
+param([string]$Source, [string]$Header, [string]$Name = "KERNEL_SOURCE")
+
+$bytes = [System.IO.File]::ReadAllBytes($Source)
+$lines = New-Object System.Collections.Generic.List[string]
+$lines.Add("// generated from " + [System.IO.Path]::GetFileName($Source) + " by embed_kernel.ps1, do not edit")
+$lines.Add("#pragma once")
+$lines.Add("")
+$lines.Add("static const char " + $Name + "[] = {")
+for ($i = 0; $i -lt $bytes.Length; $i += 16) {
+	$last = [Math]::Min($i + 15, $bytes.Length - 1)
+	$row = $bytes[$i..$last] | ForEach-Object { "0x{0:x2}," -f $_ }
+	$lines.Add("`t" + ($row -join " "))
+}
+$lines.Add("`t0x00")
+$lines.Add("};")
+
+# only touch the header if the kernel changed so incremental builds stay incremental
+$text = ($lines -join "`r`n") + "`r`n"
+if (!(Test-Path $Header) -or [System.IO.File]::ReadAllText($Header) -ne $text) {
+	[System.IO.File]::WriteAllText($Header, $text)
+}
@@ -1,6 +1,9 @@
 // Author: Markus Schordan, 2011.
 
 #include "CL/cl.h"
+#include "device_bench.h"
+#include "device_select.h"
+#include <fstream>
 #include <malloc.h>
 #include <iostream>
 #include <string>
@@ -101,7 +104,84 @@ void print_dname(std::string s) {
 	print_name(s, 31);
 }
 
+// score every device for each workload and show which one would be selected
+int print_selection() {
+	const char* workloadNames[] = { "memory", "compute" };
+	hpc::Workload workloads[] = { hpc::WORKLOAD_MEMORY, hpc::WORKLOAD_COMPUTE };
+	try {
+		for (int w = 0; w < 2; w++) {
+			print_separation_line("=");
+			std::cout << "WORKLOAD: " << workloadNames[w] << std::endl;
+			print_separation_line("=");
+			std::vector<hpc::DeviceScore> scores = hpc::ScoreDevices(workloads[w]);
+			for (size_t i = 0; i < scores.size(); i++) {
+				print_separation_line("-");
+				std::cout << "DEVICE:" << scores[i].deviceIndex << "  [PLATFORM:" << scores[i].platformIndex << "]  "
+					<< scores[i].device.getInfo<CL_DEVICE_NAME>() << std::endl;
+				print_separation_line("-");
+				print_dname("  Bandwidth (GB/s)"); std::cout << scores[i].bandwidth << std::endl;
+				print_dname("  Compute (GFLOP/s)"); std::cout << scores[i].compute << std::endl;
+				print_dname("  Compute units * clock"); std::cout << scores[i].limits << std::endl;
+				print_dname("  Score"); std::cout << scores[i].score << std::endl;
+			}
+			hpc::DeviceScore selected = hpc::SelectDevice(workloads[w]);
+			print_separation_line("-");
+			print_dname("Selected"); std::cout << selected.platformIndex << ":" << selected.deviceIndex << std::endl;
+		}
+	}
+	catch (cl::Error e) {
+		std::cerr << "OpenCL Error: " << cl_errorstring(e.err()) << std::string(".") << std::endl;
+		return EXIT_FAILURE;
+	}
+	print_separation_line("=");
+	return EXIT_SUCCESS;
+}
+
+// run the microbenchmarks on every device and write JSON to stdout or a file
+int run_benchmarks(const char* filename) {
+	std::vector<hpc::BenchResult> results;
+	try {
+		std::vector<cl::Platform> platforms;
+		cl::Platform::get(&platforms);
+		for (unsigned int i = 0; i < platforms.size(); i++) {
+			std::vector<cl::Device> devices;
+			platforms[i].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+			for (unsigned int j = 0; j < devices.size(); j++) {
+				std::cerr << "Benchmarking " << i << ":" << j << " " << devices[j].getInfo<CL_DEVICE_NAME>() << std::endl;
+				results.push_back(hpc::RunBenchmarks(devices[j], i, j));
+				// the copy and scalar mad rates measure what the selection probes do, keep them for it
+				const hpc::BenchResult& r = results.back();
+				if (r.error.empty() && r.globalBandwidth > 0.0 && r.floatOps[0] > 0.0)
+					hpc::StoreProbe(devices[j], r.globalBandwidth, r.floatOps[0]);
+			}
+		}
+	}
+	catch (cl::Error e) {
+		std::cerr << "OpenCL Error: " << cl_errorstring(e.err()) << std::string(".") << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (filename) {
+		std::ofstream out(filename);
+		if (!out) {
+			std::cerr << "Could not open " << filename << std::endl;
+			return EXIT_FAILURE;
+		}
+		hpc::WriteBenchJson(out, results);
+	}
+	else {
+		hpc::WriteBenchJson(std::cout, results);
+	}
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv) {
+	if (argc > 1 && std::string(argv[1]) == "--select") {
+		return print_selection();
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bench") {
+		return run_benchmarks(argc > 2 ? argv[2] : NULL);
+	}
+
 	cl_int err;
 	cl_uint numPlatforms;
 	cl_platform_id* platformIds;
@@ -178,7 +258,12 @@ int main(int argc, char **argv) {
 			workItemSizes = (size_t*)calloc(maxWorkItemDimensions, sizeof(size_t));
 			err = clGetDeviceInfo(deviceId, CL_DEVICE_MAX_WORK_ITEM_SIZES, maxWorkItemDimensions * sizeof(size_t), workItemSizes, NULL);
 			handle_clerror(err);
-			std::cout << std::endl;
+			std::cout << "(";
+			for (unsigned int k = 0; k < maxWorkItemDimensions; k++) {
+				std::cout << (k ? " " : "") << workItemSizes[k];
+			}
+			std::cout << ")" << std::endl;
+			free(workItemSizes);
 
 			size_t maxWorkGroupSize = 0;
 			err = clGetDeviceInfo(deviceId, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroupSize, NULL);
@@ -0,0 +1,229 @@
+#include "program_cache.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <atomic>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+	const char * DEFAULT_CACHE_DIR = "clcache";
+
+	std::string CacheFile(const std::string& dir, const cl::Device& device, const std::string& sourceCode, const std::string& options)
+	{
+		cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+		unsigned long long h = hpc::HASH_SEED;
+		h = hpc::HashString(h, sourceCode);
+		h = hpc::HashString(h, options);
+		h = hpc::HashString(h, device.getInfo<CL_DEVICE_NAME>());
+		h = hpc::HashString(h, device.getInfo<CL_DEVICE_VENDOR>());
+		h = hpc::HashString(h, device.getInfo<CL_DRIVER_VERSION>());
+		h = hpc::HashString(h, platform.getInfo<CL_PLATFORM_VERSION>());
+
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", h);
+		return dir + "/" + name;
+	}
+
+	bool ReadFile(const std::string& filename, std::vector<unsigned char>& data)
+	{
+		std::ifstream file(filename.c_str(), std::ios::binary);
+		if (!file)
+			return false;
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return !data.empty();
+	}
+
+	// replaces target in one step, a reader sees either the old or the new file but never none
+	bool ReplaceAtomically(const std::string& source, const std::string& target)
+	{
+#ifdef _WIN32
+		return MoveFileExA(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return rename(source.c_str(), target.c_str()) == 0;
+#endif
+	}
+
+	// write to a temporary file first so a concurrent reader never sees half a binary
+	// the temporary name is unique per process and write, processes building the same program
+	// at once each write their own file and the last replace wins with a complete binary
+	void WriteFile(const std::string& filename, const std::vector<unsigned char>& data)
+	{
+		static std::atomic<unsigned int> counter(0);
+#ifdef _WIN32
+		const int pid = _getpid();
+#else
+		const int pid = (int)getpid();
+#endif
+		char suffix[48];
+		snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", pid, counter++);
+		std::string temp = filename + suffix;
+		{
+			std::ofstream file(temp.c_str(), std::ios::binary | std::ios::trunc);
+			if (!file)
+				return;
+			file.write((const char *)&data[0], data.size());
+			if (!file)
+			{
+				file.close();
+				remove(temp.c_str());
+				return;
+			}
+		}
+		if (!ReplaceAtomically(temp, filename))
+			remove(temp.c_str());
+	}
+
+	// binaries of a built program in the order of devices
+	std::vector<std::vector<unsigned char> > GetBinaries(const cl::Program& program, const std::vector<cl::Device>& devices)
+	{
+		std::vector<cl::Device> programDevices = program.getInfo<CL_PROGRAM_DEVICES>();
+		std::vector<size_t> sizes(programDevices.size());
+		clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizes.size() * sizeof(size_t), &sizes[0], NULL);
+
+		std::vector<std::vector<unsigned char> > binaries(programDevices.size());
+		std::vector<unsigned char *> pointers(programDevices.size());
+		for (size_t i = 0; i < binaries.size(); ++i)
+		{
+			binaries[i].resize(sizes[i]);
+			pointers[i] = sizes[i] ? &binaries[i][0] : NULL;
+		}
+		clGetProgramInfo(program(), CL_PROGRAM_BINARIES, pointers.size() * sizeof(unsigned char *), &pointers[0], NULL);
+
+		std::vector<std::vector<unsigned char> > result(devices.size());
+		for (size_t d = 0; d < devices.size(); ++d)
+		{
+			for (size_t i = 0; i < programDevices.size(); ++i)
+			{
+				if (programDevices[i]() == devices[d]())
+					result[d].swap(binaries[i]);
+			}
+		}
+		return result;
+	}
+
+	cl::Program BuildFromSource(const cl::Context& context, const std::vector<cl::Device>& devices,
+		const std::string& sourceCode, const std::string& options)
+	{
+		cl::Program::Sources source(1, std::make_pair(sourceCode.c_str(), sourceCode.length() + 1));
+		cl::Program program(context, source);
+		try
+		{
+			program.build(devices, options.c_str());
+		}
+		catch (cl::Error)
+		{
+			for (size_t i = 0; i < devices.size(); ++i)
+			{
+				std::string log;
+				program.getBuildInfo(devices[i], CL_PROGRAM_BUILD_LOG, &log);
+				std::cerr << log << std::endl;
+			}
+			throw;
+		}
+		return program;
+	}
+
+}
+
+unsigned long long hpc::HashString(unsigned long long h, const std::string& s)
+{
+	for (size_t i = 0; i < s.size(); ++i)
+	{
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ULL;
+	}
+	// separator so "ab"+"c" and "a"+"bc" differ
+	h ^= 0xff;
+	h *= 1099511628211ULL;
+	return h;
+}
+
+void hpc::MakeDir(const std::string& dir)
+{
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+}
+
+std::string hpc::ProgramCacheDir()
+{
+	const char * env = getenv("HPC_PROGRAM_CACHE");
+	if (env == NULL || *env == 0)
+		return DEFAULT_CACHE_DIR;
+	if (std::string(env) == "off")
+		return "";
+	return env;
+}
+
+cl::Program hpc::BuildProgram(const cl::Context& context, const std::vector<cl::Device>& devices,
+	const std::string& sourceCode, const std::string& options)
+{
+	const std::string dir = ProgramCacheDir();
+	if (dir.empty() || devices.empty())
+		return BuildFromSource(context, devices, sourceCode, options);
+
+	std::vector<std::string> files(devices.size());
+	std::vector<std::vector<unsigned char> > cached(devices.size());
+	bool hit = true;
+	for (size_t i = 0; i < devices.size(); ++i)
+	{
+		files[i] = CacheFile(dir, devices[i], sourceCode, options);
+		hit = hit && ReadFile(files[i], cached[i]);
+	}
+
+	if (hit)
+	{
+		// a driver update that keeps its version string can still reject a binary
+		try
+		{
+			cl::Program::Binaries binaries;
+			for (size_t i = 0; i < cached.size(); ++i)
+				binaries.push_back(std::make_pair((const void *)&cached[i][0], cached[i].size()));
+			std::vector<cl_int> status;
+			cl::Program program(context, devices, binaries, &status);
+			program.build(devices, options.c_str());
+			return program;
+		}
+		catch (cl::Error)
+		{
+		}
+	}
+
+	cl::Program program = BuildFromSource(context, devices, sourceCode, options);
+
+	// the cache is an optimization, failing to fill it is not an error
+	hpc::MakeDir(dir);
+	std::vector<std::vector<unsigned char> > binaries = GetBinaries(program, devices);
+	for (size_t i = 0; i < devices.size(); ++i)
+	{
+		if (!binaries[i].empty())
+			WriteFile(files[i], binaries[i]);
+	}
+	return program;
+}
+
+cl::Program hpc::ProgramVariants::get(const cl::Context& context, const std::vector<cl::Device>& devices, const std::string& options)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::pair<cl_context, std::string> key(context(), options);
+	std::map<std::pair<cl_context, std::string>, cl::Program>::iterator it = programs.find(key);
+	if (it != programs.end())
+		return it->second;
+	cl::Program program = BuildProgram(context, devices, sourceCode, options);
+	programs[key] = program;
+	return program;
+}
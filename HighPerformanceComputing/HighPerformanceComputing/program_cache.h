@@ -0,0 +1,55 @@
+// persistent cache of compiled program binaries shared by all projects
+// binaries are stored per device under HPC_PROGRAM_CACHE (default ./clcache),
+// keyed on source, build options, device name, driver and platform version;
+// HPC_PROGRAM_CACHE=off disables the cache
+
+#pragma once
+
+// NVidia only supports OpenCL 1.2
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace hpc {
+
+	// load the program from the cache or build it from source and store the binaries
+	// stale or rejected binaries fall back to a source build, build failures print the
+	// build log and rethrow
+	cl::Program BuildProgram(const cl::Context& context, const std::vector<cl::Device>& devices,
+		const std::string& sourceCode, const std::string& options = "");
+
+	// cache directory, empty if the cache is disabled
+	std::string ProgramCacheDir();
+
+	// 64 bit FNV-1a, also used for the tuning file names
+	const unsigned long long HASH_SEED = 14695981039346656037ULL;
+	unsigned long long HashString(unsigned long long h, const std::string& s);
+
+	// create a directory, existing directories and failures are ignored
+	void MakeDir(const std::string& dir);
+
+	// built variants of one kernel source, one program per context and set of -D build options
+	class ProgramVariants
+	{
+	public:
+		explicit ProgramVariants(const std::string& sourceCode) : sourceCode(sourceCode) {}
+
+		cl::Program get(const cl::Context& context, const std::vector<cl::Device>& devices, const std::string& options);
+
+	private:
+		std::string sourceCode;
+		std::map<std::pair<cl_context, std::string>, cl::Program> programs;
+		std::mutex mutex;
+	};
+
+}
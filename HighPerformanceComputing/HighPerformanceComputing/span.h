@@ -0,0 +1,43 @@
+// non-owning view of contiguous memory, for host APIs that shouldn't copy their inputs
+// or allocate their outputs (a small stand-in for C++20 std::span)
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+namespace hpc {
+
+	template <typename T>
+	class Span
+	{
+	public:
+		Span() : ptr(NULL), count(0) {}
+		Span(T * data, size_t size) : ptr(data), count(size) {}
+
+		// views of a whole vector, Span<const T> also binds to const vectors
+		template <typename U>
+		Span(std::vector<U>& v) : ptr(v.empty() ? NULL : &v[0]), count(v.size()) {}
+		template <typename U>
+		Span(const std::vector<U>& v) : ptr(v.empty() ? NULL : &v[0]), count(v.size()) {}
+
+		// Span<T> -> Span<const T>
+		template <typename U>
+		Span(const Span<U>& other) : ptr(other.data()), count(other.size()) {}
+
+		T * data() const { return ptr; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		T * begin() const { return ptr; }
+		T * end() const { return ptr + count; }
+		T& operator[](size_t i) const { return ptr[i]; }
+
+		Span subspan(size_t offset, size_t length) const { return Span(ptr + offset, length); }
+		Span subspan(size_t offset) const { return Span(ptr + offset, count - offset); }
+
+	private:
+		T * ptr;
+		size_t count;
+	};
+
+}
@@ -0,0 +1,93 @@
+#include "tuning.h"
+#include "program_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+
+hpc::Tuning hpc::Tuning::Load(const cl::Device& device)
+{
+	std::string name = device.getInfo<CL_DEVICE_NAME>();
+	unsigned long long h = HASH_SEED;
+	h = HashString(h, name);
+	h = HashString(h, device.getInfo<CL_DEVICE_VENDOR>());
+	h = HashString(h, device.getInfo<CL_DRIVER_VERSION>());
+
+	// readable prefix, the hash tells devices with the same name and drivers apart
+	std::string prefix;
+	for (size_t i = 0; i < name.size() && prefix.size() < 32; ++i)
+	{
+		char c = name[i];
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+			prefix += c;
+		else if (!prefix.empty() && prefix[prefix.size() - 1] != '_')
+			prefix += '_';
+	}
+	char suffix[24];
+	snprintf(suffix, sizeof(suffix), "%016llx", h);
+
+	Tuning tuning;
+	tuning.filename = TuningDir() + "/" + prefix + "-" + suffix + ".tune";
+
+	std::ifstream file(tuning.filename.c_str());
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t eq = line.find('=');
+		if (line.empty() || line[0] == '#' || eq == std::string::npos)
+			continue;
+		tuning.values[line.substr(0, eq)] = atoi(line.c_str() + eq + 1);
+	}
+	return tuning;
+}
+
+bool hpc::Tuning::save() const
+{
+	MakeDir(TuningDir());
+	std::ofstream file(filename.c_str(), std::ios::trunc);
+	if (!file)
+		return false;
+	file << "# written by --autotune, delete to return to the defaults" << std::endl;
+	for (std::map<std::string, int>::const_iterator it = values.begin(); it != values.end(); ++it)
+		file << it->first << "=" << it->second << std::endl;
+	return (bool)file;
+}
+
+int hpc::Tuning::get(const std::string& key, int fallback) const
+{
+	std::map<std::string, int>::const_iterator it = values.find(key);
+	return it != values.end() ? it->second : fallback;
+}
+
+void hpc::Tuning::set(const std::string& key, int value)
+{
+	values[key] = value;
+}
+
+std::string hpc::TuningDir()
+{
+	const char * env = getenv("HPC_TUNING_DIR");
+	return env != NULL && *env != 0 ? env : "tuning";
+}
+
+double hpc::TimeBestOf(const std::function<void()>& run, int repeats)
+{
+	double best = -1.0;
+	try
+	{
+		for (int r = 0; r < repeats; ++r)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			run();
+			auto end = std::chrono::high_resolution_clock::now();
+			double ms = std::chrono::duration<double, std::milli>(end - start).count();
+			if (best < 0.0 || ms < best)
+				best = ms;
+		}
+	}
+	catch (cl::Error)
+	{
+		return -1.0;
+	}
+	return best;
+}
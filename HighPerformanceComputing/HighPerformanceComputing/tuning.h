@@ -0,0 +1,48 @@
+// per-device kernel configurations found by the --autotune modes
+// one file of key=value lines per device under HPC_TUNING_DIR (default ./tuning),
+// every program reads its keys at startup and keeps its defaults for missing ones
+
+#pragma once
+
+// NVidia only supports OpenCL 1.2
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include <functional>
+#include <map>
+#include <string>
+
+namespace hpc {
+
+	class Tuning
+	{
+	public:
+		// settings of the device, empty if it was never tuned
+		static Tuning Load(const cl::Device& device);
+
+		// writes all keys, including the ones other programs tuned
+		bool save() const;
+
+		int get(const std::string& key, int fallback) const;
+		void set(const std::string& key, int value);
+
+		const std::string& file() const { return filename; }
+
+	private:
+		std::string filename;
+		std::map<std::string, int> values;
+	};
+
+	std::string TuningDir();
+
+	// best wall clock time of repeats runs in ms, a cl::Error counts as an invalid configuration
+	// and returns a negative time
+	double TimeBestOf(const std::function<void()>& run, int repeats);
+
+}
@@ -0,0 +1,121 @@
+#include "work_queue.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <thread>
+
+hpc::WorkQueue::WorkQueue(size_t n, size_t workers, size_t minChunk, size_t align)
+	: n(n), position(0), minChunk(std::max<size_t>(minChunk, 1)), align(std::max<size_t>(align, 1)), rates(workers, 0.0)
+{
+}
+
+bool hpc::WorkQueue::next(size_t worker, size_t * begin, size_t * end)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!returned.empty())
+	{
+		*begin = returned.back().first;
+		*end = returned.back().second;
+		returned.pop_back();
+		return true;
+	}
+	if (position >= n)
+		return false;
+
+	// a worker without a measurement gets one small chunk to measure its rate
+	size_t chunk = minChunk;
+	if (rates[worker] > 0.0)
+	{
+		// workers that haven't measured yet count as the slowest measured one
+		double slowest = 0.0, sum = 0.0;
+		for (size_t i = 0; i < rates.size(); ++i)
+		{
+			if (rates[i] > 0.0 && (slowest == 0.0 || rates[i] < slowest))
+				slowest = rates[i];
+		}
+		for (size_t i = 0; i < rates.size(); ++i)
+			sum += rates[i] > 0.0 ? rates[i] : slowest;
+
+		// half of this worker's share of the rest, the other half is left for balancing the tail
+		chunk = std::max(minChunk, (size_t)((n - position) * rates[worker] / sum / 2));
+	}
+	chunk = (chunk + align - 1) / align * align;
+
+	*begin = position;
+	*end = std::min(n, position + chunk);
+	position = *end;
+	return true;
+}
+
+void hpc::WorkQueue::report(size_t worker, size_t items, double ms)
+{
+	if (items == 0)
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	double rate = items / std::max(ms, 1e-3);
+	// smooth out single slow chunks (page faults, first launches)
+	rates[worker] = rates[worker] > 0.0 ? 0.5 * rates[worker] + 0.5 * rate : rate;
+}
+
+void hpc::WorkQueue::giveBack(size_t begin, size_t end)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	returned.push_back(std::make_pair(begin, end));
+}
+
+std::vector<hpc::WorkerStats> hpc::RunWorkers(size_t n, const std::vector<Worker>& workers, size_t minChunk, size_t align)
+{
+	WorkQueue queue(n, workers.size(), minChunk, align);
+	std::vector<WorkerStats> stats(workers.size());
+	std::vector<std::exception_ptr> errors(workers.size());
+
+	std::vector<std::thread> threads;
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		stats[w].name = workers[w].name;
+		stats[w].items = 0;
+		stats[w].chunks = 0;
+		stats[w].busyMs = 0.0;
+		threads.push_back(std::thread([&, w]()
+		{
+			size_t begin, end;
+			while (queue.next(w, &begin, &end))
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				try
+				{
+					workers[w].process(begin, end);
+				}
+				catch (...)
+				{
+					errors[w] = std::current_exception();
+					queue.giveBack(begin, end);
+					return;
+				}
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				queue.report(w, end - begin, ms);
+				stats[w].items += end - begin;
+				stats[w].chunks++;
+				stats[w].busyMs += ms;
+			}
+		}));
+	}
+	for (size_t w = 0; w < threads.size(); ++w)
+		threads[w].join();
+
+	// chunks given back after the other workers had stopped are finished here by
+	// a worker that didn't fail
+	size_t begin, end;
+	while (queue.next(0, &begin, &end))
+	{
+		size_t w = 0;
+		while (w < errors.size() && errors[w])
+			++w;
+		if (w == errors.size())
+			std::rethrow_exception(errors[0]);
+		workers[w].process(begin, end);
+		stats[w].items += end - begin;
+		stats[w].chunks++;
+	}
+	return stats;
+}
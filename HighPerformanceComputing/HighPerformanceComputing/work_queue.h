@@ -0,0 +1,57 @@
+// dynamic work distribution between host threads and OpenCL devices
+// [0, n) is handed out in chunks from a shared queue; every worker gets chunks in
+// proportion to its measured rate and the chunks shrink with the remaining work
+// (guided self-scheduling) so fast and slow workers finish at about the same time
+
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace hpc {
+
+	class WorkQueue
+	{
+	public:
+		// chunks are multiples of align (except the last) and at least minChunk items
+		WorkQueue(size_t n, size_t workers, size_t minChunk, size_t align);
+
+		// next chunk for the worker, false once everything is handed out
+		bool next(size_t worker, size_t * begin, size_t * end);
+
+		// processing time of a finished chunk, updates the worker's rate
+		void report(size_t worker, size_t items, double ms);
+
+		// a chunk a failed worker couldn't process, handed out again before new work
+		void giveBack(size_t begin, size_t end);
+
+	private:
+		std::mutex mutex;
+		size_t n, position, minChunk, align;
+		std::vector<double> rates;		// items per ms, 0 until the first chunk finished
+		std::vector<std::pair<size_t, size_t> > returned;
+	};
+
+	// one worker of RunWorkers, process(begin, end) handles a chunk
+	struct Worker
+	{
+		std::string name;
+		std::function<void(size_t, size_t)> process;
+	};
+
+	struct WorkerStats
+	{
+		std::string name;
+		size_t items;
+		size_t chunks;
+		double busyMs;
+	};
+
+	// run every worker on its own thread until [0, n) is processed
+	// a worker that throws stops, its chunk goes to the others; if all workers fail
+	// the first error is rethrown
+	std::vector<WorkerStats> RunWorkers(size_t n, const std::vector<Worker>& workers, size_t minChunk, size_t align);
+
+}
@@ -1,17 +1,30 @@
-__kernel void image_rotate(
-	__global float * src_data,
-	__global float * dest_data,
+// keep mul and add separate so the host fallback (rotate_cpu.cpp) matches bit for bit
+#pragma OPENCL FP_CONTRACT OFF
+
+// pixel size as a build option (-DBYTES_PER_PIXEL=...) unrolls the channel loops,
+// without it the kernel argument is used
+#ifdef BYTES_PER_PIXEL
+#define PIXEL_BYTES BYTES_PER_PIXEL
+#else
+#define PIXEL_BYTES bytesPerPixel
+#endif
+
+// destination pixel (ix, iy) of a W x H image, unmapped pixels keep their content
+inline void rotate_pixel(
+	__global const uchar * src_data,
+	__global uchar * dest_data,
 	float sinTheta,
-	float cosTheta)
+	float cosTheta,
+	int W,
+	int H,
+	int ix,
+	int iy,
+	int bytesPerPixel)
 {
-	const int ix = get_global_id(0);
-	const int iy = get_global_id(1);
-	int W = get_global_size(0);
-	int H = get_global_size(1);
 	int dest = W * iy + ix;
 	int w2 = W / 2;
 	int h2 = H / 2;
-	
+
 	int xpos = (int)floor((cosTheta * (ix - w2))
 		- (sinTheta * (iy - h2)) + w2);
 	int ypos = (int)floor((sinTheta * (ix - w2))
@@ -22,6 +35,263 @@ __kernel void image_rotate(
 		&& ypos >= 0 && ypos < H
 		&& pos >= 0 && pos < (W * H))
 	{
-		dest_data[dest] = src_data[pos];
+		for (int c = 0; c < PIXEL_BYTES; ++c)
+		{
+			dest_data[dest * PIXEL_BYTES + c] = src_data[pos * PIXEL_BYTES + c];
+		}
+	}
+}
+
+__kernel void image_rotate(
+	__global const uchar * src_data,
+	__global uchar * dest_data,
+	float sinTheta,
+	float cosTheta,
+	int W,
+	int H,
+	int bytesPerPixel)
+{
+	const int ix = get_global_id(0);
+	const int iy = get_global_id(1);
+	if (ix >= W || iy >= H)
+	{
+		return;
+	}
+	rotate_pixel(src_data, dest_data, sinTheta, cosTheta, W, H, ix, iy, bytesPerPixel);
+}
+
+// image_rotate for a batch of images of the same size packed back to back (compute service)
+// the third dimension is the image, trig holds sin and cos of every image's angle
+__kernel void image_rotate_batch(
+	__global const uchar * src_data,
+	__global uchar * dest_data,
+	__global const float2 * trig,
+	int W,
+	int H,
+	int bytesPerPixel)
+{
+	const int ix = get_global_id(0);
+	const int iy = get_global_id(1);
+	const int image = get_global_id(2);
+	if (ix >= W || iy >= H)
+	{
+		return;
+	}
+	const size_t offset = (size_t)image * W * H * PIXEL_BYTES;
+	rotate_pixel(src_data + offset, dest_data + offset, trig[image].x, trig[image].y, W, H, ix, iy, bytesPerPixel);
+}
+
+// one block of the destination for the tile streaming pipeline (rotate_tiled.cpp)
+// src_region holds the source pixels [srcX, srcX + srcW) x [srcY, srcY + srcH),
+// every destination pixel is written, pixels without a source become 0
+__kernel void image_rotate_tile(
+	__global const uchar * src_region,
+	__global uchar * dest_tile,
+	float sinTheta,
+	float cosTheta,
+	int W,
+	int H,
+	int srcX,
+	int srcY,
+	int srcW,
+	int srcH,
+	int destX,
+	int destY,
+	int destW,
+	int destH,
+	int bytesPerPixel)
+{
+	const int tx = get_global_id(0);
+	const int ty = get_global_id(1);
+	if (tx >= destW || ty >= destH)
+	{
+		return;
+	}
+	const int ix = destX + tx;
+	const int iy = destY + ty;
+	int w2 = W / 2;
+	int h2 = H / 2;
+
+	int xpos = (int)floor((cosTheta * (ix - w2))
+		- (sinTheta * (iy - h2)) + w2);
+	int ypos = (int)floor((sinTheta * (ix - w2))
+		+ (cosTheta * (iy - h2)) + h2);
+	int sx = xpos - srcX;
+	int sy = ypos - srcY;
+
+	bool inside = xpos >= 0 && xpos < W
+		&& ypos >= 0 && ypos < H
+		&& sx >= 0 && sx < srcW
+		&& sy >= 0 && sy < srcH;
+	size_t dest = ((size_t)ty * destW + tx) * PIXEL_BYTES;
+	size_t pos = ((size_t)sy * srcW + sx) * PIXEL_BYTES;
+
+	for (int c = 0; c < PIXEL_BYTES; ++c)
+	{
+		dest_tile[dest + c] = inside ? src_region[pos + c] : 0;
+	}
+}
+
+// exact quarter turns and transposes, the destination is H x W
+// dest(x, y) = src(reverseX ? W - 1 - y : y, reverseY ? H - 1 - x : x)
+// reverseX gives the 90 degree, reverseY the 270 degree turn of image_rotate, both the anti-transpose
+// lossless and without cropping
+// square work-groups, every group stages its tile in local memory so reads and writes stay coalesced
+// tile holds local size * (local size + 1) pixels, the extra column avoids bank conflicts
+__kernel void image_rotate_quarter(
+	__global const uchar * src_data,
+	__global uchar * dest_data,
+	int W,
+	int H,
+	int reverseX,
+	int reverseY,
+	__local uchar * tile,
+	int bytesPerPixel)
+{
+	const int T = get_local_size(0);
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int bx = get_group_id(0);
+	const int by = get_group_id(1);
+
+	// source block of this destination block, loaded row by row
+	const int sx0 = reverseX ? W - (by + 1) * T : by * T;
+	const int sy0 = reverseY ? H - (bx + 1) * T : bx * T;
+	const int sx = sx0 + lx;
+	const int sy = sy0 + ly;
+	if (sx >= 0 && sx < W && sy >= 0 && sy < H)
+	{
+		for (int c = 0; c < PIXEL_BYTES; ++c)
+		{
+			tile[(ly * (T + 1) + lx) * PIXEL_BYTES + c] = src_data[((size_t)sy * W + sx) * PIXEL_BYTES + c];
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	const int x = bx * T + lx;
+	const int y = by * T + ly;
+	if (x < H && y < W)
+	{
+		const int t = (reverseY ? T - 1 - lx : lx) * (T + 1) + (reverseX ? T - 1 - ly : ly);
+		for (int c = 0; c < PIXEL_BYTES; ++c)
+		{
+			dest_data[((size_t)y * H + x) * PIXEL_BYTES + c] = tile[t * PIXEL_BYTES + c];
+		}
+	}
+}
+
+// mirror along x and / or y, 180 degrees is both
+__kernel void image_flip(
+	__global const uchar * src_data,
+	__global uchar * dest_data,
+	int W,
+	int H,
+	int flipX,
+	int flipY,
+	int bytesPerPixel)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if (x >= W || y >= H)
+	{
+		return;
+	}
+	const int sx = flipX ? W - 1 - x : x;
+	const int sy = flipY ? H - 1 - y : y;
+	for (int c = 0; c < PIXEL_BYTES; ++c)
+	{
+		dest_data[((size_t)y * W + x) * PIXEL_BYTES + c] = src_data[((size_t)sy * W + sx) * PIXEL_BYTES + c];
+	}
+}
+
+// shears of the three-shear rotation (rotate_shear.cpp), one work-group per row / column
+// in place, every group copies the source part of its row to its own line of scratch
+// dst(x, y) = src(x + offset(y), y), offset(y) = floor(shear * (y - H / 2) + 0.5)
+// columns [srcFirst, srcFirst + srcCount) hold the source, columns [dstFirst, dstFirst + dstCount) are written
+__kernel void shear_rows(
+	__global uchar * data,
+	__global uchar * scratch,
+	int W,
+	int H,
+	int srcFirst,
+	int srcCount,
+	int dstFirst,
+	int dstCount,
+	float shear,
+	int bytesPerPixel)
+{
+	const int lid = get_local_id(0);
+	const int size = get_local_size(0);
+	__global uchar * line = scratch + (size_t)get_group_id(0) * max(W, H) * PIXEL_BYTES;
+
+	for (int y = get_group_id(0); y < H; y += get_num_groups(0))
+	{
+		const int shift = (int)floor(shear * (float)(y - H / 2) + 0.5f) - srcFirst;
+		__global uchar * row = data + (size_t)y * W * PIXEL_BYTES;
+		for (int x = lid; x < srcCount; x += size)
+		{
+			for (int c = 0; c < PIXEL_BYTES; ++c)
+			{
+				line[x * PIXEL_BYTES + c] = row[(srcFirst + x) * PIXEL_BYTES + c];
+			}
+		}
+		barrier(CLK_GLOBAL_MEM_FENCE);
+
+		for (int x = dstFirst + lid; x < dstFirst + dstCount; x += size)
+		{
+			const int sx = x + shift;
+			const bool inside = sx >= 0 && sx < srcCount;
+			for (int c = 0; c < PIXEL_BYTES; ++c)
+			{
+				row[x * PIXEL_BYTES + c] = inside ? line[sx * PIXEL_BYTES + c] : 0;
+			}
+		}
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+}
+
+// in place, every group copies its column to its own line of scratch (max(W, H) pixels per group)
+// out(x, y) = in(x, y + offset(x)), offset(x) = floor(shear * (x - center) + 0.5)
+__kernel void shear_columns(
+	__global uchar * image,
+	__global uchar * scratch,
+	int W,
+	int H,
+	int center,
+	float shear,
+	int bytesPerPixel)
+{
+	const int lid = get_local_id(0);
+	const int size = get_local_size(0);
+	const size_t rowBytes = (size_t)W * PIXEL_BYTES;
+	__global uchar * line = scratch + (size_t)get_group_id(0) * max(W, H) * PIXEL_BYTES;
+
+	for (int x = get_group_id(0); x < W; x += get_num_groups(0))
+	{
+		const int offset = (int)floor(shear * (float)(x - center) + 0.5f);
+		if (offset == 0)
+		{
+			continue;
+		}
+		__global uchar * column = image + x * PIXEL_BYTES;
+		for (int y = lid; y < H; y += size)
+		{
+			for (int c = 0; c < PIXEL_BYTES; ++c)
+			{
+				line[y * PIXEL_BYTES + c] = column[y * rowBytes + c];
+			}
+		}
+		barrier(CLK_GLOBAL_MEM_FENCE);
+
+		for (int y = lid; y < H; y += size)
+		{
+			const int sy = y + offset;
+			const bool inside = sy >= 0 && sy < H;
+			for (int c = 0; c < PIXEL_BYTES; ++c)
+			{
+				column[y * rowBytes + c] = inside ? line[sy * PIXEL_BYTES + c] : 0;
+			}
+		}
+		barrier(CLK_GLOBAL_MEM_FENCE);
 	}
 }
\ No newline at end of file
@@ -18,67 +18,509 @@
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include "tga.h"
+#include "rotate_cpu.h"
+#include "rotate_tiled.h"
+#include "rotate_multi.h"
+#include "rotate_exact.h"
+#include "rotate_shear.h"
+#include "pipeline.h"
+#include "../HighPerformanceComputing/device_select.h"
+#include "../HighPerformanceComputing/program_cache.h"
+#include "../HighPerformanceComputing/tuning.h"
+#include "../HighPerformanceComputing/compute_service.h"
+#include "kernel_cl.h"
 #include <cmath>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <map>
+#include <tuple>
+
+// sweep the work-group shape of image_rotate and keep the fastest in the tuning file
+// a shape only counts if it reproduces the CPU rotation exactly
+int autotune(const cl::Context& context, const cl::Device& device, const cl::Program& program,
+	const tga::TGAImage& image, float sinTheta, float cosTheta, hpc::Tuning& tuning) {
+	const size_t SHAPES[][2] = { { 8, 8 }, { 16, 8 }, { 8, 16 }, { 16, 16 }, { 32, 4 }, { 32, 8 }, { 8, 32 },
+		{ 64, 4 }, { 32, 16 }, { 64, 8 }, { 128, 2 }, { 256, 1 }, { 32, 32 } };
+	const int REPEAT = 5;
+
+	tga::TGAImage expected = image;
+	std::fill(expected.imageData.begin(), expected.imageData.end(), 0);
+	rotation::RotateCPU(image, expected, sinTheta, cosTheta);
+
+	cl::CommandQueue queue(context, device);
+	cl::Kernel kernel(program, "image_rotate");
+	const size_t maxGroup = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+	std::vector<size_t> maxItems = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+	const size_t size = image.imageData.size();
+	std::vector<unsigned char> result(size, 0);
+	cl::Buffer bufferA(context, CL_MEM_READ_ONLY, size);
+	cl::Buffer bufferB(context, CL_MEM_READ_WRITE, size);
+	queue.enqueueWriteBuffer(bufferA, CL_TRUE, 0, size, &image.imageData[0]);
+	kernel.setArg(0, bufferA);
+	kernel.setArg(1, bufferB);
+	kernel.setArg(2, sinTheta);
+	kernel.setArg(3, cosTheta);
+	kernel.setArg(4, (cl_int)image.width);
+	kernel.setArg(5, (cl_int)image.height);
+	kernel.setArg(6, (cl_int)(image.bpp / 8));
+
+	std::cout << "Autotuning " << device.getInfo<CL_DEVICE_NAME>() << std::endl;
+	size_t bestX = 0, bestY = 0;
+	double bestMs = -1.0;
+	for (size_t i = 0; i < sizeof(SHAPES) / sizeof(SHAPES[0]); i++) {
+		const size_t x = SHAPES[i][0], y = SHAPES[i][1];
+		if (x * y > maxGroup || x > maxItems[0] || y > maxItems[1]) {
+			continue;
+		}
+		cl::NDRange global((image.width + x - 1) / x * x, (image.height + y - 1) / y * y);
+		cl::NDRange local(x, y);
+		auto run = [&]() {
+			queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local);
+			queue.finish();
+		};
+
+		// unmapped pixels are never written, start every shape from a cleared buffer
+		queue.enqueueWriteBuffer(bufferB, CL_TRUE, 0, size, &result[0]);
+		double ms = hpc::TimeBestOf(run, 1);
+		std::vector<unsigned char> check(size);
+		if (ms >= 0.0) {
+			queue.enqueueReadBuffer(bufferB, CL_TRUE, 0, size, &check[0]);
+			ms = check == expected.imageData ? hpc::TimeBestOf(run, REPEAT) : -1.0;
+		}
+		std::cout << "  " << x << "x" << y << ": " << (ms < 0.0 ? std::string("invalid") : std::to_string(ms) + " ms") << std::endl;
+		if (ms >= 0.0 && (bestMs < 0.0 || ms < bestMs)) {
+			bestMs = ms;
+			bestX = x;
+			bestY = y;
+		}
+	}
+	if (bestMs < 0.0) {
+		std::cout << "No valid work-group shape found" << std::endl;
+		return 1;
+	}
+
+	tuning.set("rotation.local_x", (int)bestX);
+	tuning.set("rotation.local_y", (int)bestY);
+	if (!tuning.save()) {
+		std::cout << "Could not write " << tuning.file() << std::endl;
+		return 1;
+	}
+	std::cout << "Work-group " << bestX << "x" << bestY << " written to " << tuning.file() << std::endl;
+	return 0;
+}
+
+// -rle writes the outputs run-length encoded
+bool saveOutput(const tga::TGAImage& image, const char * filename, bool compressed) {
+	return compressed ? tga::saveCompressedTGA(image, filename) : tga::saveTGA(image, filename);
+}
+
+// the tiled rotation on the host or the device, writes output.tga and the pyramid levels as output_<level>.tga
+// tiledInput is either tiled from the mapped file already or tiled here from the loaded image, which is
+// released right after so the host holds about two copies of the image at a time
+int rotateTiled(const std::function<void(const tiled::TiledImage&, tiled::TiledImage&, std::vector<tiled::TiledImage> *)>& rotate,
+	tga::TGAImage& image, tiled::TiledImage& tiledInput, tga::TGAImage& imageOutput, bool compressed) {
+	std::vector<unsigned char>().swap(imageOutput.imageData);
+	if (tiledInput.width == 0) {
+		tiledInput = tiled::TiledImage::FromTGA(image);
+	}
+	std::vector<unsigned char>().swap(image.imageData);
+	tiled::TiledImage tiledOutput;
+	std::vector<tiled::TiledImage> pyramid;
+	rotate(tiledInput, tiledOutput, &pyramid);
+	tiledInput = tiled::TiledImage();
+
+	for (size_t l = 0; l <= pyramid.size(); l++) {
+		const tiled::TiledImage& level = l == 0 ? tiledOutput : pyramid[l - 1];
+		std::string filename = l == 0 ? std::string("output.tga") : "output_" + std::to_string(l) + ".tga";
+		if (!level.ToTGA(&imageOutput)) {
+			std::cerr << "Can't export " << level.width << "x" << level.height << " pixels as " << filename << std::endl;
+			return 1;
+		}
+		saveOutput(imageOutput, filename.c_str(), compressed);
+	}
+	std::cout << "Image exported";
+	return 0;
+}
+
+// daemon mode, the context and one program per pixel size stay built between jobs
+// "rotate": pixels as input and output, params width, height, bits per pixel, angle in 1/1000 degrees
+// jobs of the same size that arrive together are packed into one buffer pair and rotated by one launch,
+// the buffers of every size are kept for the next batches
+int serve(const std::string& socketPath) {
+	hpc::DeviceScore selected = hpc::SelectDevice(hpc::WORKLOAD_COMPUTE);
+	cl_context_properties properties[] =
+	{ CL_CONTEXT_PLATFORM, (cl_context_properties)(selected.platform)(), 0 };
+	cl::Context context(CL_DEVICE_TYPE_ALL, properties);
+	std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+	cl::Device device = selected.device;
+	cl::CommandQueue queue(context, device);
+	hpc::ProgramVariants programs(KERNEL_SOURCE);
+	const size_t maxAlloc = (size_t)std::min<cl_ulong>(device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>(), std::numeric_limits<size_t>::max());
+	const size_t cacheLimit = (size_t)std::min<cl_ulong>(device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 2, std::numeric_limits<size_t>::max());
+
+	// buffers for up to capacity images of one size, grown when a larger batch of that size arrives
+	struct BatchBuffers {
+		cl::Buffer src, dest, trig;
+		size_t capacity;
+	};
+	typedef std::tuple<int, int, int> ImageSize;
+	std::map<ImageSize, BatchBuffers> cache;
+	size_t cachedBytes = 0;
+
+	hpc::ComputeService service;
+	service.handle("rotate", [&](std::vector<hpc::Job *>& batch) {
+		std::map<ImageSize, std::vector<hpc::Job *> > groups;
+		for (size_t i = 0; i < batch.size(); i++) {
+			hpc::Job& job = *batch[i];
+			const int width = job.params[0], height = job.params[1], bytesPerPixel = job.params[2] / 8;
+			const size_t size = width > 0 && height > 0 && bytesPerPixel > 0 ? (size_t)width * height * bytesPerPixel : 0;
+			if (size == 0 || size > maxAlloc || job.inputBytes < size || job.outputBytes < size) {
+				job.reply.status = -1;
+				continue;
+			}
+			groups[ImageSize(width, height, bytesPerPixel)].push_back(&job);
+		}
+
+		std::vector<float> trig;
+		for (std::map<ImageSize, std::vector<hpc::Job *> >::iterator g = groups.begin(); g != groups.end(); ++g) {
+			const int width = std::get<0>(g->first), height = std::get<1>(g->first), bytesPerPixel = std::get<2>(g->first);
+			const size_t size = (size_t)width * height * bytesPerPixel;
+			std::vector<hpc::Job *>& jobs = g->second;
+			std::ostringstream options;
+			options << "-DBYTES_PER_PIXEL=" << bytesPerPixel;
+			cl::Kernel kernel(programs.get(context, devices, options.str()), "image_rotate_batch");
+
+			// as many images per launch as one allocation holds
+			const size_t perLaunch = std::min(jobs.size(), maxAlloc / size);
+			std::map<ImageSize, BatchBuffers>::iterator cached = cache.find(g->first);
+			if (cached == cache.end() || cached->second.capacity < perLaunch) {
+				if (cached != cache.end()) {
+					cachedBytes -= cached->second.capacity * size * 2;
+					cache.erase(cached);
+				}
+				if (cachedBytes + perLaunch * size * 2 > cacheLimit) {
+					// too many sizes kept, start over with only this one
+					cache.clear();
+					cachedBytes = 0;
+				}
+				BatchBuffers grown;
+				grown.src = cl::Buffer(context, CL_MEM_READ_ONLY, perLaunch * size);
+				grown.dest = cl::Buffer(context, CL_MEM_READ_WRITE, perLaunch * size);
+				grown.trig = cl::Buffer(context, CL_MEM_READ_ONLY, perLaunch * 2 * sizeof(float));
+				grown.capacity = perLaunch;
+				cached = cache.insert(std::make_pair(g->first, grown)).first;
+				cachedBytes += perLaunch * size * 2;
+			}
+			BatchBuffers& current = cached->second;
+
+			for (size_t first = 0; first < jobs.size(); first += perLaunch) {
+				const size_t count = std::min(perLaunch, jobs.size() - first);
+				trig.resize(count * 2);
+				for (size_t i = 0; i < count; i++) {
+					hpc::Job& job = *jobs[first + i];
+					// unmapped pixels keep the output's content like image_rotate
+					const double radians = job.params[3] / 1000.0 * CL_M_PI / 180.0;
+					trig[i * 2] = (float)sin(radians);
+					trig[i * 2 + 1] = (float)cos(radians);
+					queue.enqueueWriteBuffer(current.src, CL_FALSE, i * size, size, job.input);
+					queue.enqueueWriteBuffer(current.dest, CL_FALSE, i * size, size, job.output);
+				}
+				queue.enqueueWriteBuffer(current.trig, CL_FALSE, 0, count * 2 * sizeof(float), &trig[0]);
+				kernel.setArg(0, current.src);
+				kernel.setArg(1, current.dest);
+				kernel.setArg(2, current.trig);
+				kernel.setArg(3, (cl_int)width);
+				kernel.setArg(4, (cl_int)height);
+				kernel.setArg(5, (cl_int)bytesPerPixel);
+				queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(width, height, count));
+				for (size_t i = 0; i < count; i++) {
+					queue.enqueueReadBuffer(current.dest, CL_FALSE, i * size, size, jobs[first + i]->output);
+				}
+				// trig and the buffers are reused by the next launch
+				queue.finish();
+			}
+		}
+	});
+	return service.serve(socketPath);
+}
 
 int main(int argc, char **argv) {
-	const std::string KERNEL_FILE = "kernel.cl";
 	cl_int err = CL_SUCCESS;
 	cl::Program program;
 	std::vector<cl::Device> devices;
+	cl::Device device;
 
 	try {
+		// --serve [socket] keeps the context warm and takes rotation jobs until shut down
+		if (argc > 1 && std::string(argv[1]) == "--serve") {
+			return serve(argc > 2 ? argv[2] : hpc::DefaultSocketPath("rotation"));
+		}
+
 		float degrees = 5.0f;
 		std::string filename = "1024.tga";
 		tga::TGAImage image, imageOutput;
 
-		std::cout << "Rotation (example -> 32): ";
-		std::cin >> degrees;
-		std::cout << "Filename (example -> 1024.tga): ";
-		std::cin >> filename;
-
-		bool loaded = tga::LoadTGA(&image, filename.c_str());
-		imageOutput.imageData.resize(image.imageData.size());
+		// --autotune rotates a synthetic 32 bit image instead of asking for one
+		bool autotuneMode = argc > 1 && std::string(argv[1]) == "--autotune";
+		if (autotuneMode) {
+			degrees = 30.0f;
+			image.width = image.height = 2048;
+			image.bpp = 32;
+			image.type = 2;
+			image.imageData.resize(image.width * image.height * 4);
+			for (size_t i = 0; i < image.imageData.size(); i++) {
+				image.imageData[i] = (unsigned char)(i * 7 + i / 4096);
+			}
+		}
+		else {
+			std::cout << "Rotation (example -> 32): ";
+			std::cin >> degrees;
+			std::cout << "Filename (example -> 1024.tga): ";
+			std::cin >> filename;
+		}
+		// -shear rotates the loaded image into its own buffer, without an output image on the host
+		// -pyramid <levels> rotates in tiles and also writes that many halved levels of the result
+		// -rle writes the outputs run-length encoded
+		bool shear = false, rle = false;
+		unsigned int pyramidLevels = 0;
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg == "-pyramid" && i + 1 < argc) {
+				pyramidLevels = (unsigned int)std::min(std::max(atoi(argv[++i]), 0), 16);
+			}
+			shear = shear || arg == "-shear";
+			rle = rle || arg == "-rle";
+		}
+		// the tiled rotation reads an uncompressed file straight from its mapping instead of loading it
+		tiled::TiledImage tiledInput;
+		if (!autotuneMode) {
+			tga::TGAView view;
+			if (pyramidLevels > 0 && tga::MapTGA(&view, filename.c_str())) {
+				tiledInput = tiled::TiledImage::FromView(view);
+				image.width = view.width;
+				image.height = view.height;
+				image.bpp = view.bpp;
+				image.type = view.bpp == 24 ? 0 : 1;
+				image.order = tga::ORDER_BGR;
+				tga::UnmapTGA(&view);
+			}
+			else {
+				// rotation doesn't care about channel order, keep file order (BGR) to skip the swizzles
+				tga::LoadTGA(&image, filename.c_str(), true);
+			}
+		}
+		if (!shear) {
+			imageOutput.imageData.resize(image.imageData.size());
+		}
 		imageOutput.bpp = image.bpp;
 		imageOutput.height = image.height;
 		imageOutput.type = image.type;
 		imageOutput.width = image.width;
+		imageOutput.order = image.order;
 		std::cout << "Loaded picture" << std::endl;
 
-		// get available platforms ( NVIDIA, Intel, AMD,...)
-		std::vector<cl::Platform> platforms;
-		cl::Platform::get(&platforms);
-		if (platforms.size() == 0) {
-			std::cout << "No OpenCL platforms available!\n";
+		float sinTheta = (float)sin(degrees * CL_M_PI / 180.0f);
+		float cosTheta = (float)cos(degrees * CL_M_PI / 180.0f);
+
+		// right angles are exact data movement with swapped dimensions, unless point operations
+		// need the fused pipeline; -fliph / -flipv mirror the rotated image and need an exact rotation
+		rotation::ExactTransform transform = rotation::TRANSFORM_IDENTITY, flip = rotation::TRANSFORM_IDENTITY;
+		bool rightAngle = rotation::RightAngleTransform(degrees, transform);
+		bool pointOps = false;
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg == "-fliph" || arg == "-flipv") {
+				flip = arg == "-fliph" ? rotation::TRANSFORM_FLIP_HORIZONTAL : rotation::TRANSFORM_FLIP_VERTICAL;
+			}
+			else if (arg == "-gray" || arg == "-swap" || arg == "-gamma" || arg == "-bc") {
+				pointOps = true;
+			}
+		}
+		if (flip != rotation::TRANSFORM_IDENTITY && (!rightAngle || shear || pointOps || autotuneMode)) {
+			std::cerr << "-fliph / -flipv need a multiple of 90 degrees and can't be combined with -shear or point operations" << std::endl;
+			return 1;
+		}
+		if (pyramidLevels > 0 && (shear || pointOps || autotuneMode || flip != rotation::TRANSFORM_IDENTITY)) {
+			std::cerr << "-pyramid can't be combined with -shear, flips or point operations" << std::endl;
 			return 1;
 		}
+		bool exact = !autotuneMode && !shear && !pointOps && rightAngle && pyramidLevels == 0;
+		// rotation and flip run as one pass
+		transform = rotation::ComposeTransform(transform, flip);
+
+		// pick the best platform/device for the rotation ( NVIDIA, Intel, AMD,...)
+		hpc::DeviceScore selected;
+		bool haveDevice = true;
+		try {
+			selected = hpc::SelectDevice(hpc::WORKLOAD_COMPUTE);
+		}
+		catch (cl::Error) {
+			haveDevice = false;
+		}
+		if (!haveDevice) {
+			std::cout << "No OpenCL device available, rotating on the CPU" << std::endl;
+			if (shear) {
+				rotation::RotateShearCPU(image, degrees);
+				saveOutput(image, "output.tga", rle);
+				std::cout << "Image exported";
+				return 0;
+			}
+			if (pyramidLevels > 0) {
+				tiled::RotateOptions options;
+				options.pyramidLevels = pyramidLevels;
+				return rotateTiled([&](const tiled::TiledImage& src, tiled::TiledImage& dst, std::vector<tiled::TiledImage> * pyramid) {
+					tiled::RotateTiledCPU(src, dst, sinTheta, cosTheta, options, pyramid);
+				}, image, tiledInput, imageOutput, rle);
+			}
+			if (exact) {
+				rotation::TransformCPU(image, imageOutput, transform);
+			}
+			else {
+				rotation::RotateCPU(image, imageOutput, sinTheta, cosTheta);
+			}
+			saveOutput(imageOutput, "output.tga", rle);
+			std::cout << "Image exported";
+			return 0;
+		}
 
 		// create a context and get available devices
-		int platFormNr = 0;
-		cl::Platform platform = platforms[platFormNr]; // on a different machine, you may have to select a different platform!
+		cl::Platform platform = selected.platform;
 		cl_context_properties properties[] =
-		{ CL_CONTEXT_PLATFORM, (cl_context_properties)(platforms[platFormNr])(), 0 };
+		{ CL_CONTEXT_PLATFORM, (cl_context_properties)(platform)(), 0 };
 		cl::Context context(CL_DEVICE_TYPE_ALL, properties);
 
 		devices = context.getInfo<CL_CONTEXT_DEVICES>();
+		device = selected.device;
 
-		// load and build the kernel
-		std::ifstream sourceFile(KERNEL_FILE);
-		if (!sourceFile)
-		{
-			std::cout << "kernel source file " << KERNEL_FILE << " not found!" << std::endl;
-			return 1;
-		}
-		std::string sourceCode(
-			std::istreambuf_iterator<char>(sourceFile),
-			(std::istreambuf_iterator<char>()));
-		cl::Program::Sources source(1, std::make_pair(sourceCode.c_str(), sourceCode.length() + 1));
-		program = cl::Program(context, source);
-		program.build(devices);
+		// build the embedded kernel specialised for the pixel size
+		std::ostringstream options;
+		options << "-DBYTES_PER_PIXEL=" << image.bpp / 8;
+		program = hpc::BuildProgram(context, devices, KERNEL_SOURCE, options.str());
 		//create kernels
 		cl::Kernel kernel(program, "image_rotate", &err);
 		cl::Event event;
-		cl::CommandQueue queue(context, devices[0], 0, &err);
+		cl::CommandQueue queue(context, device, 0, &err);
+
+		// tuned work-group shape of this device, shrunk if the file doesn't fit the driver
+		hpc::Tuning tuning = hpc::Tuning::Load(device);
+		if (autotuneMode) {
+			return autotune(context, device, program, image, sinTheta, cosTheta, tuning);
+		}
+		size_t localX = std::max(tuning.get("rotation.local_x", 16), 1);
+		size_t localY = std::max(tuning.get("rotation.local_y", 16), 1);
+		const size_t maxGroup = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+		while (localX * localY > maxGroup) {
+			if (localY > 1) {
+				localY /= 2;
+			}
+			else {
+				localX /= 2;
+			}
+		}
+
+		// images that don't fit on the device twice are streamed through it in blocks
+		cl_ulong maxAlloc = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+		cl_ulong globalMem = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+		bool fitsDevice = image.imageData.size() <= maxAlloc && 2 * image.imageData.size() <= globalMem / 2;
+		if (shear) {
+			// the canvas of the shears is all the device holds, falls back to the host beyond that
+			size_t canvasBytes = rotation::ShearCanvasBytes(image, degrees);
+			bool fitsOnce = canvasBytes <= maxAlloc && canvasBytes <= globalMem / 2;
+			std::cout << "Rotating image (three shears)" << (fitsOnce ? "" : " on the CPU") << std::endl;
+			if (fitsOnce) {
+				rotation::RotateShearDevice(context, queue, device, program, image, degrees);
+			}
+			else {
+				rotation::RotateShearCPU(image, degrees);
+			}
+			saveOutput(image, "output.tga", rle);
+			std::cout << "Image exported";
+			return 0;
+		}
+		if (exact) {
+			std::cout << "Exact transform" << (fitsDevice ? "" : " on the CPU") << std::endl;
+			if (fitsDevice) {
+				rotation::TransformDevice(context, queue, device, program, image, imageOutput, transform);
+			}
+			else {
+				rotation::TransformCPU(image, imageOutput, transform);
+			}
+			saveOutput(imageOutput, "output.tga", rle);
+			std::cout << "Image exported";
+			return 0;
+		}
+		if (!fitsDevice || pyramidLevels > 0) {
+			std::cout << (fitsDevice ? "Rotating in tiles" : "Image too large for the device, rotating in tiles") << std::endl;
+			tiled::RotateOptions options;
+			const cl_ulong maxSize = std::numeric_limits<size_t>::max();
+			options.deviceMemoryBudget = (size_t)std::min(globalMem / 2, maxSize);
+			options.maxBufferBytes = (size_t)std::min(maxAlloc, maxSize);
+			options.pyramidLevels = pyramidLevels;
+			options.localX = localX;
+			options.localY = localY;
+			return rotateTiled([&](const tiled::TiledImage& src, tiled::TiledImage& dst, std::vector<tiled::TiledImage> * pyramid) {
+				tiled::RotateTiled(context, queue, program, src, dst, sinTheta, cosTheta, options, pyramid);
+			}, image, tiledInput, imageOutput, rle);
+		}
+
+		// point operations given on the command line are fused with the rotation into one kernel
+		// -gray, -swap, -gamma <g>, -bc <brightness> <contrast>
+		pipeline::ImagePipeline fused;
+		fused.rotate(sinTheta, cosTheta);
+		bool useFused = false;
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg == "-gray") {
+				fused.grayscale();
+			}
+			else if (arg == "-swap") {
+				fused.swapRedBlue();
+			}
+			else if (arg == "-gamma" && i + 1 < argc) {
+				fused.gamma((float)atof(argv[++i]));
+			}
+			else if (arg == "-bc" && i + 2 < argc) {
+				float brightness = (float)atof(argv[++i]);
+				fused.brightnessContrast(brightness, (float)atof(argv[++i]));
+			}
+			else {
+				continue;
+			}
+			useFused = true;
+		}
+		if (useFused) {
+			std::cout << "Rotating image (fused pipeline)" << std::endl;
+			fused.run(context, queue, device, image, imageOutput);
+			saveOutput(imageOutput, "output.tga", rle);
+			std::cout << "Image exported";
+			return 0;
+		}
+
+		// --hetero shares row bands dynamically between the devices and host threads
+		bool hetero = false;
+		for (int i = 1; i < argc; ++i) {
+			hetero = hetero || std::string(argv[i]) == "--hetero";
+		}
+		if (hetero) {
+			std::cout << "Rotating image on " << devices.size() << " devices and the host" << std::endl;
+			rotation::RotateHeterogeneous(context, devices, program, image, imageOutput, sinTheta, cosTheta, localX, localY);
+			saveOutput(imageOutput, "output.tga", rle);
+			std::cout << "Image exported";
+			return 0;
+		}
+
+		// several devices in the context share the rotation in row bands
+		if (devices.size() > 1) {
+			std::cout << "Rotating image on " << devices.size() << " devices" << std::endl;
+			rotation::RotateMultiDevice(context, devices, hpc::DeviceWeights(devices, hpc::WORKLOAD_COMPUTE), program,
+				image, imageOutput, sinTheta, cosTheta, localX, localY);
+			saveOutput(imageOutput, "output.tga", rle);
+			std::cout << "Image exported";
+			return 0;
+		}
 
 		// input buffers
 		cl::Buffer bufferA = cl::Buffer(context, CL_MEM_READ_ONLY, image.imageData.size() * sizeof(unsigned char));
@@ -93,21 +535,21 @@ int main(int argc, char **argv) {
 			&image.imageData[0]); // pointer to input
 		queue.enqueueWriteBuffer(bufferB, CL_TRUE, 0, image.imageData.size() * sizeof(unsigned char), &imageOutput.imageData[0]);
 
-		float sinTheta = (float)sin(degrees * CL_M_PI / 180.0f);
-		float cosTheta = (float)cos(degrees * CL_M_PI / 180.0f);
-
 		cl::Kernel addKernel(program, "image_rotate", &err);
 		addKernel.setArg(0, bufferA);
 		addKernel.setArg(1, bufferB);
 		addKernel.setArg(2, sinTheta);
 		addKernel.setArg(3, cosTheta);
+		addKernel.setArg(4, (cl_int)image.width);
+		addKernel.setArg(5, (cl_int)image.height);
+		addKernel.setArg(6, (cl_int)(image.bpp / 8));
 
 		// launch add kernel
 		// Run the kernel on specific ND range
-		cl::NDRange global(image.width, image.height);
-		cl::NDRange local(1, 1); //make sure local range is divisible by global range
+		// global range rounded up to the work-group shape, the kernel skips the padding
+		cl::NDRange global((image.width + localX - 1) / localX * localX, (image.height + localY - 1) / localY * localY);
+		cl::NDRange local(localX, localY);
 		cl::NDRange offset(0);
-		cl::NDRange global_work_size(image.width, image.height);
 		std::cout << "Rotating image" << std::endl;
 		queue.enqueueNDRangeKernel(addKernel, offset, global, local);
 
@@ -116,7 +558,7 @@ int main(int argc, char **argv) {
 			imageOutput.imageData.size() * sizeof(unsigned char), &imageOutput.imageData[0]);
 		std::cout << "Reading result" << std::endl;
 
-		tga::saveTGA(imageOutput, "output.tga");
+		saveOutput(imageOutput, "output.tga", rle);
 
 		std::cout << "Image exported";
 	}
@@ -124,9 +566,9 @@ int main(int argc, char **argv) {
 		// error handling
 		// if the kernel has failed to compile, print the error log
 		std::string s;
-		program.getBuildInfo(devices[0], CL_PROGRAM_BUILD_LOG, &s);
+		program.getBuildInfo(device, CL_PROGRAM_BUILD_LOG, &s);
 		std::cout << s << std::endl;
-		program.getBuildInfo(devices[0], CL_PROGRAM_BUILD_OPTIONS, &s);
+		program.getBuildInfo(device, CL_PROGRAM_BUILD_OPTIONS, &s);
 		std::cout << s << std::endl;
 
 		std::cerr
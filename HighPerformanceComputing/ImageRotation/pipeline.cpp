@@ -0,0 +1,204 @@
+#include "pipeline.h"
+#include "../HighPerformanceComputing/program_cache.h"
+#include <map>
+#include <mutex>
+#include <sstream>
+
+namespace {
+
+	// built programs by context, device and pipeline signature, a program is only built for the
+	// device it runs on, so another device of the same context needs its own entry
+	typedef std::pair<std::pair<cl_context, cl_device_id>, std::string> ProgramKey;
+	std::map<ProgramKey, cl::Program> programCache;
+	std::mutex programCacheMutex;
+
+	const char * KERNEL_NAME = "fused_pipeline";
+
+}
+
+pipeline::ImagePipeline::ImagePipeline()
+	: warp(WARP_NONE), sinTheta(0.0f), cosTheta(1.0f)
+{
+}
+
+pipeline::ImagePipeline& pipeline::ImagePipeline::swapRedBlue()
+{
+	PointOp op = { OP_SWAP_RED_BLUE, 0.0f, 0.0f };
+	ops.push_back(op);
+	return *this;
+}
+
+pipeline::ImagePipeline& pipeline::ImagePipeline::brightnessContrast(float brightness, float contrast)
+{
+	PointOp op = { OP_BRIGHTNESS_CONTRAST, brightness, contrast };
+	ops.push_back(op);
+	return *this;
+}
+
+pipeline::ImagePipeline& pipeline::ImagePipeline::gamma(float gamma)
+{
+	PointOp op = { OP_GAMMA, 1.0f / gamma, 0.0f };
+	ops.push_back(op);
+	return *this;
+}
+
+pipeline::ImagePipeline& pipeline::ImagePipeline::grayscale()
+{
+	PointOp op = { OP_GRAYSCALE, 0.0f, 0.0f };
+	ops.push_back(op);
+	return *this;
+}
+
+pipeline::ImagePipeline& pipeline::ImagePipeline::rotate(float sinTheta, float cosTheta)
+{
+	warp = WARP_ROTATE;
+	this->sinTheta = sinTheta;
+	this->cosTheta = cosTheta;
+	return *this;
+}
+
+bool pipeline::ImagePipeline::empty() const
+{
+	return ops.empty() && warp == WARP_NONE;
+}
+
+std::string pipeline::ImagePipeline::signature(const tga::TGAImage& image) const
+{
+	std::ostringstream sig;
+	sig << image.bpp << (image.order == tga::ORDER_BGR ? "bgr" : "rgb");
+	sig << (warp == WARP_ROTATE ? "|rot" : "|id");
+	for (size_t i = 0; i < ops.size(); ++i)
+		sig << "|" << ops[i].type;
+	return sig.str();
+}
+
+std::string pipeline::ImagePipeline::generateSource(const tga::TGAImage& image) const
+{
+	const int bytesPerPixel = image.bpp / 8;
+	// channel order of c0..c2 is the order of imageData, grayscale and swap follow it
+	bool bgr = image.order == tga::ORDER_BGR;
+	std::ostringstream src;
+
+	src << "#pragma OPENCL FP_CONTRACT OFF\n\n";
+	src << "__kernel void " << KERNEL_NAME << "(\n";
+	src << "\t__global const uchar * src_data,\n";
+	src << "\t__global uchar * dest_data,\n";
+	src << "\tint W,\n";
+	src << "\tint H,\n";
+	src << "\tfloat sinTheta,\n";
+	src << "\tfloat cosTheta";
+	for (size_t i = 0; i < ops.size(); ++i)
+		src << ",\n\tfloat p" << i << "a,\n\tfloat p" << i << "b";
+	src << ")\n{\n";
+
+	src << "\tconst int ix = get_global_id(0);\n";
+	src << "\tconst int iy = get_global_id(1);\n";
+	src << "\tif (ix >= W || iy >= H)\n\t{\n\t\treturn;\n\t}\n";
+	src << "\tint dest = W * iy + ix;\n";
+
+	// warp
+	if (warp == WARP_ROTATE)
+	{
+		src << "\tint w2 = W / 2;\n";
+		src << "\tint h2 = H / 2;\n";
+		src << "\tint xpos = (int)floor((cosTheta * (ix - w2)) - (sinTheta * (iy - h2)) + w2);\n";
+		src << "\tint ypos = (int)floor((sinTheta * (ix - w2)) + (cosTheta * (iy - h2)) + h2);\n";
+		src << "\tif (xpos < 0 || xpos >= W || ypos < 0 || ypos >= H)\n\t{\n";
+		for (int c = 0; c < bytesPerPixel; ++c)
+			src << "\t\tdest_data[dest * " << bytesPerPixel << " + " << c << "] = 0;\n";
+		src << "\t\treturn;\n\t}\n";
+		src << "\tint pos = W * ypos + xpos;\n";
+	}
+	else
+	{
+		src << "\tint pos = dest;\n";
+	}
+
+	// the only global read
+	for (int c = 0; c < bytesPerPixel; ++c)
+		src << "\tfloat c" << c << " = src_data[pos * " << bytesPerPixel << " + " << c << "];\n";
+
+	// point operations, in registers
+	for (size_t i = 0; i < ops.size(); ++i)
+	{
+		src << "\t// op " << i << "\n";
+		switch (ops[i].type)
+		{
+		case OP_SWAP_RED_BLUE:
+			src << "\t{\n\t\tfloat t = c0;\n\t\tc0 = c2;\n\t\tc2 = t;\n\t}\n";
+			bgr = !bgr;
+			break;
+		case OP_BRIGHTNESS_CONTRAST:
+			for (int c = 0; c < 3; ++c)
+				src << "\tc" << c << " = (c" << c << " - 128.0f) * p" << i << "b + 128.0f + p" << i << "a;\n";
+			break;
+		case OP_GAMMA:
+			for (int c = 0; c < 3; ++c)
+				src << "\tc" << c << " = 255.0f * pow(clamp(c" << c << ", 0.0f, 255.0f) / 255.0f, p" << i << "a);\n";
+			break;
+		case OP_GRAYSCALE:
+			src << "\t{\n\t\tfloat luma = " << (bgr ? "0.114f * c0 + 0.587f * c1 + 0.299f * c2" : "0.299f * c0 + 0.587f * c1 + 0.114f * c2") << ";\n";
+			src << "\t\tc0 = luma;\n\t\tc1 = luma;\n\t\tc2 = luma;\n\t}\n";
+			break;
+		}
+	}
+
+	// the only global write
+	for (int c = 0; c < bytesPerPixel; ++c)
+		src << "\tdest_data[dest * " << bytesPerPixel << " + " << c << "] = convert_uchar_sat_rte(c" << c << ");\n";
+	src << "}\n";
+
+	return src.str();
+}
+
+void pipeline::ImagePipeline::run(const cl::Context& context, const cl::CommandQueue& queue, const cl::Device& device,
+	const tga::TGAImage& src, tga::TGAImage& dst) const
+{
+	dst.width = src.width;
+	dst.height = src.height;
+	dst.bpp = src.bpp;
+	dst.type = src.type;
+	dst.order = src.order;
+	dst.imageData.resize(src.imageData.size());
+	if (src.imageData.empty())
+		return;
+
+	// one program per pipeline signature, context and device
+	cl::Program program;
+	{
+		std::lock_guard<std::mutex> lock(programCacheMutex);
+		ProgramKey key(std::make_pair(context(), device()), signature(src));
+		std::map<ProgramKey, cl::Program>::iterator it = programCache.find(key);
+		if (it != programCache.end())
+		{
+			program = it->second;
+		}
+		else
+		{
+			std::string sourceCode = generateSource(src);
+			program = hpc::BuildProgram(context, std::vector<cl::Device>(1, device), sourceCode);
+			programCache[key] = program;
+		}
+	}
+
+	const size_t size = src.imageData.size();
+	cl::Buffer bufferSrc(context, CL_MEM_READ_ONLY, size);
+	cl::Buffer bufferDest(context, CL_MEM_WRITE_ONLY, size);
+	queue.enqueueWriteBuffer(bufferSrc, CL_FALSE, 0, size, &src.imageData[0]);
+
+	cl::Kernel kernel(program, KERNEL_NAME);
+	kernel.setArg(0, bufferSrc);
+	kernel.setArg(1, bufferDest);
+	kernel.setArg(2, (cl_int)src.width);
+	kernel.setArg(3, (cl_int)src.height);
+	kernel.setArg(4, sinTheta);
+	kernel.setArg(5, cosTheta);
+	for (size_t i = 0; i < ops.size(); ++i)
+	{
+		kernel.setArg((cl_uint)(6 + 2 * i), ops[i].a);
+		kernel.setArg((cl_uint)(7 + 2 * i), ops[i].b);
+	}
+
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(src.width, src.height));
+	queue.enqueueReadBuffer(bufferDest, CL_TRUE, 0, size, &dst.imageData[0]);
+}
@@ -0,0 +1,73 @@
+// fused image pipeline: an ordered list of point operations plus one warp are
+// generated into a single OpenCL kernel, so every pixel is read and written once
+
+#pragma once
+
+// NVidia only supports OpenCL 1.2
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include "tga.h"
+#include <string>
+#include <vector>
+
+namespace pipeline {
+
+	enum PointOpType
+	{
+		OP_SWAP_RED_BLUE,		// RGB <-> BGR
+		OP_BRIGHTNESS_CONTRAST,		// (c - 128) * contrast + 128 + brightness
+		OP_GAMMA,			// 255 * (c / 255) ^ (1 / gamma)
+		OP_GRAYSCALE			// rec. 601 luma
+	};
+
+	enum WarpType
+	{
+		WARP_NONE,
+		WARP_ROTATE			// same mapping as image_rotate
+	};
+
+	struct PointOp
+	{
+		PointOpType type;
+		float a;
+		float b;
+	};
+
+	class ImagePipeline
+	{
+	public:
+		ImagePipeline();
+
+		// point operations run in the order they are added
+		ImagePipeline& swapRedBlue();
+		ImagePipeline& brightnessContrast(float brightness, float contrast);
+		ImagePipeline& gamma(float gamma);
+		ImagePipeline& grayscale();
+		// the warp decides where each output pixel is read from
+		ImagePipeline& rotate(float sinTheta, float cosTheta);
+
+		bool empty() const;
+
+		// identifies the generated kernel, parameters are kernel arguments and not part of it
+		std::string signature(const tga::TGAImage& image) const;
+		std::string generateSource(const tga::TGAImage& image) const;
+
+		// dst gets the size and format of src
+		void run(const cl::Context& context, const cl::CommandQueue& queue, const cl::Device& device,
+			const tga::TGAImage& src, tga::TGAImage& dst) const;
+
+	private:
+		std::vector<PointOp> ops;
+		WarpType warp;
+		float sinTheta;
+		float cosTheta;
+	};
+
+}
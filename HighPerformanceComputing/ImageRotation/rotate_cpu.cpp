@@ -0,0 +1,160 @@
+#include "rotate_cpu.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// destination tile edge in pixels, 64x64x4 bytes stay well inside L1/L2
+const unsigned int TILE = 64;
+
+namespace {
+
+	// per column and per row products of the rotation, shared by all threads
+	// the kernel evaluates (cos*(ix-w2)) - (sin*(iy-h2)) + w2, looking the products up
+	// instead of multiplying keeps every rounding step identical
+	struct RotationTables
+	{
+		std::vector<float> colX;	// cos * (ix - w2)
+		std::vector<float> colY;	// sin * (ix - w2)
+		std::vector<float> rowX;	// sin * (iy - h2)
+		std::vector<float> rowY;	// cos * (iy - h2)
+		float w2;
+		float h2;
+	};
+
+	void BuildTables(RotationTables& t, int W, int H, float sinTheta, float cosTheta)
+	{
+		const int w2 = W / 2;
+		const int h2 = H / 2;
+		t.w2 = (float)w2;
+		t.h2 = (float)h2;
+		t.colX.resize(W);
+		t.colY.resize(W);
+		t.rowX.resize(H);
+		t.rowY.resize(H);
+		for (int ix = 0; ix < W; ++ix)
+		{
+			t.colX[ix] = cosTheta * (float)(ix - w2);
+			t.colY[ix] = sinTheta * (float)(ix - w2);
+		}
+		for (int iy = 0; iy < H; ++iy)
+		{
+			t.rowX[iy] = sinTheta * (float)(iy - h2);
+			t.rowY[iy] = cosTheta * (float)(iy - h2);
+		}
+	}
+
+	void RotateTile(const tga::TGAImage& src, tga::TGAImage& dst, const RotationTables& t,
+		int x0, int x1, int y0, int y1)
+	{
+		const int W = (int)src.width;
+		const int H = (int)src.height;
+		const int bytesPerPixel = (int)src.bpp / 8;
+		const unsigned char * in = &src.imageData[0];
+		unsigned char * out = &dst.imageData[0];
+
+		for (int iy = y0; iy < y1; ++iy)
+		{
+			const float rowX = t.rowX[iy];
+			const float rowY = t.rowY[iy];
+			int ix = x0;
+
+#if defined(__AVX2__)
+			if (bytesPerPixel == 4)
+			{
+				const __m256 vRowX = _mm256_set1_ps(rowX);
+				const __m256 vRowY = _mm256_set1_ps(rowY);
+				const __m256 vW2 = _mm256_set1_ps(t.w2);
+				const __m256 vH2 = _mm256_set1_ps(t.h2);
+				const __m256i vW = _mm256_set1_epi32(W);
+				const __m256i vH = _mm256_set1_epi32(H);
+				const __m256i vMinus1 = _mm256_set1_epi32(-1);
+				for (; ix + 8 <= x1; ix += 8)
+				{
+					__m256 fx = _mm256_add_ps(_mm256_sub_ps(_mm256_loadu_ps(&t.colX[ix]), vRowX), vW2);
+					__m256 fy = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(&t.colY[ix]), vRowY), vH2);
+					__m256i xpos = _mm256_cvttps_epi32(_mm256_floor_ps(fx));
+					__m256i ypos = _mm256_cvttps_epi32(_mm256_floor_ps(fy));
+
+					// 0 <= pos < W and 0 <= pos < H
+					__m256i mask = _mm256_and_si256(
+						_mm256_and_si256(_mm256_cmpgt_epi32(xpos, vMinus1), _mm256_cmpgt_epi32(vW, xpos)),
+						_mm256_and_si256(_mm256_cmpgt_epi32(ypos, vMinus1), _mm256_cmpgt_epi32(vH, ypos)));
+					__m256i pos = _mm256_add_epi32(_mm256_mullo_epi32(ypos, vW), xpos);
+
+					// lanes that map outside keep the current destination pixel
+					int * d = (int *)(out + ((size_t)iy * W + ix) * 4);
+					__m256i current = _mm256_loadu_si256((const __m256i *)d);
+					__m256i pixels = _mm256_mask_i32gather_epi32(current, (const int *)in, pos, mask, 4);
+					_mm256_storeu_si256((__m256i *)d, pixels);
+				}
+			}
+#endif
+
+			for (; ix < x1; ++ix)
+			{
+				int xpos = (int)floorf(t.colX[ix] - rowX + t.w2);
+				int ypos = (int)floorf(t.colY[ix] + rowY + t.h2);
+				if (xpos >= 0 && xpos < W && ypos >= 0 && ypos < H)
+				{
+					memcpy(out + ((size_t)iy * W + ix) * bytesPerPixel,
+						in + ((size_t)ypos * W + xpos) * bytesPerPixel, bytesPerPixel);
+				}
+			}
+		}
+	}
+
+}
+
+void rotation::RotateRowsCPU(const tga::TGAImage& src, tga::TGAImage& dst, float sinTheta, float cosTheta,
+	unsigned int firstRow, unsigned int lastRow, unsigned int threads)
+{
+	const int W = (int)src.width;
+	const int H = (int)src.height;
+	if (dst.imageData.size() != src.imageData.size())
+		dst.imageData.resize(src.imageData.size());
+	lastRow = std::min(lastRow, src.height);
+	if (W == 0 || firstRow >= lastRow)
+		return;
+
+	RotationTables tables;
+	BuildTables(tables, W, H, sinTheta, cosTheta);
+
+	const unsigned int tilesX = (W + TILE - 1) / TILE;
+	const unsigned int tilesY = (lastRow - firstRow + TILE - 1) / TILE;
+	const unsigned int tileCount = tilesX * tilesY;
+
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, tileCount);
+
+	// threads pull destination tiles from a shared counter
+	std::atomic<unsigned int> nextTile(0);
+	auto worker = [&]()
+	{
+		for (unsigned int tile = nextTile++; tile < tileCount; tile = nextTile++)
+		{
+			int x0 = (int)((tile % tilesX) * TILE);
+			int y0 = (int)(firstRow + (tile / tilesX) * TILE);
+			RotateTile(src, dst, tables, x0, std::min(x0 + (int)TILE, W), y0, std::min(y0 + (int)TILE, (int)lastRow));
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threads; ++i)
+		workers.push_back(std::thread(worker));
+	worker();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+void rotation::RotateCPU(const tga::TGAImage& src, tga::TGAImage& dst, float sinTheta, float cosTheta, unsigned int threads)
+{
+	RotateRowsCPU(src, dst, sinTheta, cosTheta, 0, src.height, threads);
+}
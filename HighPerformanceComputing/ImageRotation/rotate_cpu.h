@@ -0,0 +1,19 @@
+// multithreaded host implementation of the image_rotate kernel
+// produces the same pixels as the OpenCL nearest neighbour path
+
+#pragma once
+
+#include "tga.h"
+
+namespace rotation {
+
+	// rotate src into dst (same size as src, pixels that map outside stay untouched)
+	// sinTheta/cosTheta must be the values passed to image_rotate for identical results
+	// threads = 0 uses one thread per core
+	void RotateCPU(const tga::TGAImage& src, tga::TGAImage& dst, float sinTheta, float cosTheta, unsigned int threads = 0);
+
+	// rotate only the destination rows [firstRow, lastRow), used to split work with devices
+	void RotateRowsCPU(const tga::TGAImage& src, tga::TGAImage& dst, float sinTheta, float cosTheta,
+		unsigned int firstRow, unsigned int lastRow, unsigned int threads = 0);
+
+}
@@ -0,0 +1,272 @@
+#include "rotate_exact.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// destination tile edge in pixels, source and destination tile stay in cache together
+const unsigned int EXACT_TILE = 64;
+// work-group edge of image_rotate_quarter, shrunk to the kernel's limit
+const size_t QUARTER_GROUP = 16;
+
+namespace {
+
+	// one pixel, a constant size lets the compiler turn the copy into a single move
+	// BYTES = 0 is the fallback for pixel sizes without their own instance
+	template <size_t BYTES>
+	inline void CopyPixel(unsigned char * d, const unsigned char * s, size_t bytes)
+	{
+		memcpy(d, s, BYTES ? BYTES : bytes);
+	}
+
+	// dst rows y0 to y1 for the transforms that keep rows together (identity, flips, 180 degrees)
+	// dst(x, y) = src(REVERSE_X ? W - 1 - x : x, REVERSE_Y ? H - 1 - y : y)
+	template <size_t BYTES, bool REVERSE_X, bool REVERSE_Y>
+	void CopyRows(const unsigned char * in, unsigned char * out, unsigned int W, unsigned int H, size_t bytes,
+		unsigned int y0, unsigned int y1)
+	{
+		const size_t pixel = BYTES ? BYTES : bytes;
+		const size_t rowBytes = (size_t)W * pixel;
+		for (unsigned int y = y0; y < y1; ++y)
+		{
+			const unsigned char * s = in + (REVERSE_Y ? H - 1 - y : y) * rowBytes;
+			unsigned char * d = out + y * rowBytes;
+			if (!REVERSE_X)
+			{
+				memcpy(d, s, rowBytes);
+				continue;
+			}
+			s += rowBytes;
+			for (unsigned int x = 0; x < W; ++x, d += pixel)
+			{
+				s -= pixel;
+				CopyPixel<BYTES>(d, s, bytes);
+			}
+		}
+	}
+
+	// one dst tile for the transforms that turn source columns into rows, dst is H x W
+	// dst(x, y) = src(REVERSE_X ? W - 1 - y : y, REVERSE_Y ? H - 1 - x : x)
+	template <size_t BYTES, bool REVERSE_X, bool REVERSE_Y>
+	void CopyTransposedTile(const unsigned char * in, unsigned char * out, unsigned int W, unsigned int H, size_t bytes,
+		unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+	{
+		const size_t pixel = BYTES ? BYTES : bytes;
+		const ptrdiff_t step = REVERSE_Y ? -(ptrdiff_t)(W * pixel) : (ptrdiff_t)(W * pixel);
+		for (unsigned int y = y0; y < y1; ++y)
+		{
+			const unsigned int sx = REVERSE_X ? W - 1 - y : y;
+			const unsigned int sy = REVERSE_Y ? H - 1 - x0 : x0;
+			const unsigned char * s = in + ((size_t)sy * W + sx) * pixel;
+			unsigned char * d = out + ((size_t)y * H + x0) * pixel;
+			for (unsigned int x = x0; x < x1; ++x, d += pixel, s += step)
+				CopyPixel<BYTES>(d, s, bytes);
+		}
+	}
+
+	// threads pull work from a shared counter, a band of EXACT_TILE rows or a destination tile
+	// that reads one tile of the source
+	template <size_t BYTES, bool TRANSPOSE, bool REVERSE_X, bool REVERSE_Y>
+	void RunTransform(const unsigned char * in, unsigned char * out, unsigned int W, unsigned int H, size_t bytes, unsigned int threads)
+	{
+		const unsigned int dstW = TRANSPOSE ? H : W;
+		const unsigned int dstH = TRANSPOSE ? W : H;
+		const unsigned int tilesX = TRANSPOSE ? (dstW + EXACT_TILE - 1) / EXACT_TILE : 1;
+		const unsigned int tilesY = (dstH + EXACT_TILE - 1) / EXACT_TILE;
+		const unsigned int tileCount = tilesX * tilesY;
+
+		if (threads == 0)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		threads = std::min(threads, tileCount);
+
+		std::atomic<unsigned int> nextTile(0);
+		auto worker = [&]()
+		{
+			for (unsigned int tile = nextTile++; tile < tileCount; tile = nextTile++)
+			{
+				unsigned int x0 = (tile % tilesX) * EXACT_TILE;
+				unsigned int y0 = (tile / tilesX) * EXACT_TILE;
+				unsigned int y1 = std::min(y0 + EXACT_TILE, dstH);
+				if (TRANSPOSE)
+					CopyTransposedTile<BYTES, REVERSE_X, REVERSE_Y>(in, out, W, H, bytes, x0, y0, std::min(x0 + EXACT_TILE, dstW), y1);
+				else
+					CopyRows<BYTES, REVERSE_X, REVERSE_Y>(in, out, W, H, bytes, y0, y1);
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (unsigned int i = 1; i < threads; ++i)
+			workers.push_back(std::thread(worker));
+		worker();
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+
+	// the only switch over the transform, everything below it is specialised
+	template <size_t BYTES>
+	void Transform(const unsigned char * in, unsigned char * out, unsigned int W, unsigned int H, size_t bytes,
+		rotation::ExactTransform transform, unsigned int threads)
+	{
+		switch (transform)
+		{
+		case rotation::TRANSFORM_ROTATE_90:
+			RunTransform<BYTES, true, true, false>(in, out, W, H, bytes, threads);
+			break;
+		case rotation::TRANSFORM_ROTATE_180:
+			RunTransform<BYTES, false, true, true>(in, out, W, H, bytes, threads);
+			break;
+		case rotation::TRANSFORM_ROTATE_270:
+			RunTransform<BYTES, true, false, true>(in, out, W, H, bytes, threads);
+			break;
+		case rotation::TRANSFORM_FLIP_HORIZONTAL:
+			RunTransform<BYTES, false, true, false>(in, out, W, H, bytes, threads);
+			break;
+		case rotation::TRANSFORM_FLIP_VERTICAL:
+			RunTransform<BYTES, false, false, true>(in, out, W, H, bytes, threads);
+			break;
+		case rotation::TRANSFORM_TRANSPOSE:
+			RunTransform<BYTES, true, false, false>(in, out, W, H, bytes, threads);
+			break;
+		case rotation::TRANSFORM_ANTI_TRANSPOSE:
+			RunTransform<BYTES, true, true, true>(in, out, W, H, bytes, threads);
+			break;
+		default:
+			RunTransform<BYTES, false, false, false>(in, out, W, H, bytes, threads);
+			break;
+		}
+	}
+
+	// quarter turns and transposes read source columns, the others keep rows
+	bool Transposes(rotation::ExactTransform transform)
+	{
+		return transform == rotation::TRANSFORM_ROTATE_90 || transform == rotation::TRANSFORM_ROTATE_270
+			|| transform == rotation::TRANSFORM_TRANSPOSE || transform == rotation::TRANSFORM_ANTI_TRANSPOSE;
+	}
+
+	void PrepareDestination(const tga::TGAImage& src, tga::TGAImage& dst, rotation::ExactTransform transform)
+	{
+		rotation::TransformedSize(src, transform, dst.width, dst.height);
+		dst.bpp = src.bpp;
+		dst.type = src.type;
+		dst.order = src.order;
+		dst.imageData.resize(src.imageData.size());
+	}
+
+}
+
+bool rotation::RightAngleTransform(float degrees, ExactTransform& transform)
+{
+	float turns = degrees / 90.0f;
+	if (turns != floorf(turns))
+		return false;
+	const ExactTransform TURNS[] = { TRANSFORM_IDENTITY, TRANSFORM_ROTATE_90, TRANSFORM_ROTATE_180, TRANSFORM_ROTATE_270 };
+	transform = TURNS[(((int)fmodf(turns, 4.0f)) + 4) % 4];
+	return true;
+}
+
+rotation::ExactTransform rotation::ComposeTransform(ExactTransform turn, ExactTransform flip)
+{
+	if (flip != TRANSFORM_FLIP_HORIZONTAL && flip != TRANSFORM_FLIP_VERTICAL)
+		return turn;
+	const bool horizontal = flip == TRANSFORM_FLIP_HORIZONTAL;
+	switch (turn)
+	{
+	case TRANSFORM_ROTATE_90:
+		return horizontal ? TRANSFORM_ANTI_TRANSPOSE : TRANSFORM_TRANSPOSE;
+	case TRANSFORM_ROTATE_180:
+		return horizontal ? TRANSFORM_FLIP_VERTICAL : TRANSFORM_FLIP_HORIZONTAL;
+	case TRANSFORM_ROTATE_270:
+		return horizontal ? TRANSFORM_TRANSPOSE : TRANSFORM_ANTI_TRANSPOSE;
+	default:
+		return flip;
+	}
+}
+
+void rotation::TransformedSize(const tga::TGAImage& src, ExactTransform transform, unsigned int& width, unsigned int& height)
+{
+	bool swap = Transposes(transform);
+	width = swap ? src.height : src.width;
+	height = swap ? src.width : src.height;
+}
+
+void rotation::TransformCPU(const tga::TGAImage& src, tga::TGAImage& dst, ExactTransform transform, unsigned int threads)
+{
+	PrepareDestination(src, dst, transform);
+	const unsigned int W = src.width;
+	const unsigned int H = src.height;
+	if (W == 0 || H == 0)
+		return;
+
+	const size_t bytesPerPixel = src.bpp / 8;
+	const unsigned char * in = &src.imageData[0];
+	unsigned char * out = &dst.imageData[0];
+	switch (bytesPerPixel)
+	{
+	case 1:
+		Transform<1>(in, out, W, H, bytesPerPixel, transform, threads);
+		break;
+	case 2:
+		Transform<2>(in, out, W, H, bytesPerPixel, transform, threads);
+		break;
+	case 3:
+		Transform<3>(in, out, W, H, bytesPerPixel, transform, threads);
+		break;
+	case 4:
+		Transform<4>(in, out, W, H, bytesPerPixel, transform, threads);
+		break;
+	default:
+		Transform<0>(in, out, W, H, bytesPerPixel, transform, threads);
+		break;
+	}
+}
+
+void rotation::TransformDevice(const cl::Context& context, const cl::CommandQueue& queue, const cl::Device& device, const cl::Program& program,
+	const tga::TGAImage& src, tga::TGAImage& dst, ExactTransform transform)
+{
+	PrepareDestination(src, dst, transform);
+	if (src.imageData.empty())
+		return;
+
+	const size_t size = src.imageData.size();
+	const int bytesPerPixel = (int)(src.bpp / 8);
+	cl::Buffer bufferSrc(context, CL_MEM_READ_ONLY, size);
+	cl::Buffer bufferDest(context, CL_MEM_WRITE_ONLY, size);
+	queue.enqueueWriteBuffer(bufferSrc, CL_FALSE, 0, size, &src.imageData[0]);
+
+	if (Transposes(transform))
+	{
+		cl::Kernel kernel(program, "image_rotate_quarter");
+		size_t group = QUARTER_GROUP;
+		while (group * group > kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device))
+			group /= 2;
+
+		kernel.setArg(0, bufferSrc);
+		kernel.setArg(1, bufferDest);
+		kernel.setArg(2, (cl_int)src.width);
+		kernel.setArg(3, (cl_int)src.height);
+		kernel.setArg(4, (cl_int)(transform == TRANSFORM_ROTATE_90 || transform == TRANSFORM_ANTI_TRANSPOSE));
+		kernel.setArg(5, (cl_int)(transform == TRANSFORM_ROTATE_270 || transform == TRANSFORM_ANTI_TRANSPOSE));
+		kernel.setArg(6, cl::LocalSpaceArg(cl::Local(group * (group + 1) * bytesPerPixel)));
+		kernel.setArg(7, (cl_int)bytesPerPixel);
+
+		cl::NDRange global((dst.width + group - 1) / group * group, (dst.height + group - 1) / group * group);
+		queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NDRange(group, group));
+	}
+	else
+	{
+		cl::Kernel kernel(program, "image_flip");
+		kernel.setArg(0, bufferSrc);
+		kernel.setArg(1, bufferDest);
+		kernel.setArg(2, (cl_int)src.width);
+		kernel.setArg(3, (cl_int)src.height);
+		kernel.setArg(4, (cl_int)(transform == TRANSFORM_ROTATE_180 || transform == TRANSFORM_FLIP_HORIZONTAL));
+		kernel.setArg(5, (cl_int)(transform == TRANSFORM_ROTATE_180 || transform == TRANSFORM_FLIP_VERTICAL));
+		kernel.setArg(6, (cl_int)bytesPerPixel);
+		queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(src.width, src.height), cl::NullRange);
+	}
+
+	queue.enqueueReadBuffer(bufferDest, CL_TRUE, 0, size, &dst.imageData[0]);
+}
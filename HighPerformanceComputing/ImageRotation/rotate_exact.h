@@ -0,0 +1,52 @@
+// lossless rotation by multiples of 90 degrees and mirroring
+// pure data movement, quarter turns swap width and height instead of cropping like image_rotate
+
+#pragma once
+
+// NVidia only supports OpenCL 1.2
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include "tga.h"
+
+namespace rotation {
+
+	// rotations turn in the same direction as image_rotate with the same angle
+	// transpose mirrors along the main diagonal, anti-transpose along the other one
+	enum ExactTransform
+	{
+		TRANSFORM_IDENTITY,
+		TRANSFORM_ROTATE_90,
+		TRANSFORM_ROTATE_180,
+		TRANSFORM_ROTATE_270,
+		TRANSFORM_FLIP_HORIZONTAL,
+		TRANSFORM_FLIP_VERTICAL,
+		TRANSFORM_TRANSPOSE,
+		TRANSFORM_ANTI_TRANSPOSE
+	};
+
+	// true if degrees is a whole multiple of 90, transform receives the matching rotation
+	bool RightAngleTransform(float degrees, ExactTransform& transform);
+
+	// the single transform for turn followed by a horizontal or vertical flip
+	ExactTransform ComposeTransform(ExactTransform turn, ExactTransform flip);
+
+	// width and height of the result, swapped for quarter turns
+	void TransformedSize(const tga::TGAImage& src, ExactTransform transform, unsigned int& width, unsigned int& height);
+
+	// dst is resized and gets the header of src with the transformed size
+	// host version copies whole rows when rows stay rows and 64x64 pixel tiles otherwise,
+	// specialised per transform and pixel size, threads = 0 uses one thread per core
+	void TransformCPU(const tga::TGAImage& src, tga::TGAImage& dst, ExactTransform transform, unsigned int threads = 0);
+
+	// program must contain image_rotate_quarter and image_flip (kernel.cl)
+	void TransformDevice(const cl::Context& context, const cl::CommandQueue& queue, const cl::Device& device, const cl::Program& program,
+		const tga::TGAImage& src, tga::TGAImage& dst, ExactTransform transform);
+
+}
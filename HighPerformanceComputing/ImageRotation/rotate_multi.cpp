@@ -0,0 +1,150 @@
+#include "rotate_multi.h"
+#include "rotate_cpu.h"
+#include "../HighPerformanceComputing/device_select.h"
+#include "../HighPerformanceComputing/work_queue.h"
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+	// queue, kernel and buffers of one device, the source is uploaded once
+	// the destination keeps the kernel's indexing, only the bands are initialised and read back
+	class BandRotator
+	{
+	public:
+		BandRotator(const cl::Context& context, const cl::Device& device, const cl::Program& program,
+			const tga::TGAImage& src, float sinTheta, float cosTheta, size_t localX, size_t localY)
+			: queue(context, device), kernel(program, "image_rotate"), width(src.width),
+			rowBytes(src.width * (src.bpp / 8)), localX(localX), localY(localY)
+		{
+			const size_t maxGroup = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+			while (this->localX * this->localY > maxGroup)
+			{
+				if (this->localY > 1)
+					this->localY /= 2;
+				else
+					this->localX /= 2;
+			}
+
+			bufferSrc = cl::Buffer(context, CL_MEM_READ_ONLY, src.imageData.size());
+			bufferDest = cl::Buffer(context, CL_MEM_READ_WRITE, src.imageData.size());
+			queue.enqueueWriteBuffer(bufferSrc, CL_FALSE, 0, src.imageData.size(), &src.imageData[0]);
+
+			kernel.setArg(0, bufferSrc);
+			kernel.setArg(1, bufferDest);
+			kernel.setArg(2, sinTheta);
+			kernel.setArg(3, cosTheta);
+			kernel.setArg(4, (cl_int)src.width);
+			kernel.setArg(5, (cl_int)src.height);
+			kernel.setArg(6, (cl_int)(src.bpp / 8));
+		}
+
+		// destination rows [firstRow, lastRow), blocks until they are in dst
+		void rotate(tga::TGAImage& dst, size_t firstRow, size_t lastRow)
+		{
+			const size_t bandOffset = firstRow * rowBytes;
+			const size_t bandBytes = (lastRow - firstRow) * rowBytes;
+			queue.enqueueWriteBuffer(bufferDest, CL_FALSE, bandOffset, bandBytes, &dst.imageData[bandOffset]);
+
+			// rows past the band only land in this device's copy of the destination
+			cl::NDRange offset(0, firstRow);
+			cl::NDRange global((width + localX - 1) / localX * localX,
+				(lastRow - firstRow + localY - 1) / localY * localY);
+			queue.enqueueNDRangeKernel(kernel, offset, global, cl::NDRange(localX, localY));
+			queue.enqueueReadBuffer(bufferDest, CL_TRUE, bandOffset, bandBytes, &dst.imageData[bandOffset]);
+		}
+
+	private:
+		cl::CommandQueue queue;
+		cl::Kernel kernel;
+		cl::Buffer bufferSrc, bufferDest;
+		size_t width, rowBytes, localX, localY;
+	};
+
+}
+
+void rotation::RotateMultiDevice(const cl::Context& context, const std::vector<cl::Device>& devices,
+	const std::vector<double>& weights, const cl::Program& program,
+	const tga::TGAImage& src, tga::TGAImage& dst, float sinTheta, float cosTheta,
+	size_t localX, size_t localY)
+{
+	dst.imageData.resize(src.imageData.size());
+	std::vector<size_t> bounds = hpc::SplitRange(src.height, weights, localY);
+
+	std::exception_ptr error;
+	std::mutex errorMutex;
+	std::vector<std::thread> workers;
+	for (size_t d = 0; d < devices.size(); ++d)
+	{
+		if (bounds[d] == bounds[d + 1])
+			continue;
+		workers.push_back(std::thread([&, d]()
+		{
+			try
+			{
+				BandRotator rotator(context, devices[d], program, src, sinTheta, cosTheta, localX, localY);
+				rotator.rotate(dst, bounds[d], bounds[d + 1]);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error)
+					error = std::current_exception();
+			}
+		}));
+	}
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void rotation::RotateHeterogeneous(const cl::Context& context, const std::vector<cl::Device>& devices,
+	const cl::Program& program, const tga::TGAImage& src, tga::TGAImage& dst,
+	float sinTheta, float cosTheta, size_t localX, size_t localY, unsigned int hostThreads)
+{
+	dst.imageData.resize(src.imageData.size());
+	if (hostThreads == 0)
+	{
+		hostThreads = std::thread::hardware_concurrency();
+		hostThreads = hostThreads > devices.size() ? hostThreads - (unsigned int)devices.size() : 1;
+	}
+
+	// devices upload the source on their first chunk, in their own thread
+	std::vector<std::unique_ptr<BandRotator> > rotators(devices.size());
+	std::vector<hpc::Worker> workers;
+	for (size_t d = 0; d < devices.size(); ++d)
+	{
+		hpc::Worker worker;
+		worker.name = devices[d].getInfo<CL_DEVICE_NAME>();
+		worker.process = [&, d](size_t firstRow, size_t lastRow)
+		{
+			if (!rotators[d])
+				rotators[d].reset(new BandRotator(context, devices[d], program, src, sinTheta, cosTheta, localX, localY));
+			rotators[d]->rotate(dst, firstRow, lastRow);
+		};
+		workers.push_back(worker);
+	}
+	for (unsigned int t = 0; t < hostThreads; ++t)
+	{
+		hpc::Worker worker;
+		worker.name = "host thread " + std::to_string(t);
+		worker.process = [&](size_t firstRow, size_t lastRow)
+		{
+			RotateRowsCPU(src, dst, sinTheta, cosTheta, (unsigned int)firstRow, (unsigned int)lastRow, 1);
+		};
+		workers.push_back(worker);
+	}
+
+	// about 64K pixels per chunk at least, less is dominated by the launch
+	const size_t minRows = std::max<size_t>(localY, (64 * 1024 + src.width - 1) / std::max<size_t>(src.width, 1));
+	std::vector<hpc::WorkerStats> stats = hpc::RunWorkers(src.height, workers, minRows, std::max<size_t>(localY, 1));
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		std::cout << "  " << stats[i].name << ": " << stats[i].items << " rows in "
+			<< stats[i].chunks << " chunks" << std::endl;
+	}
+}
@@ -0,0 +1,37 @@
+// image_rotate split across every device of a context
+// each device rotates bands of destination rows, either one band per device sized by
+// the measured throughput (hpc::DeviceWeights) or bands pulled from a shared queue
+
+#pragma once
+
+// NVidia only supports OpenCL 1.2
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include "tga.h"
+#include <vector>
+
+namespace rotation {
+
+	// rotate src into dst (same size as src, pixels that map outside stay untouched)
+	// program must be built for all devices, localX/localY is shrunk per device if needed
+	// the first device error is rethrown after all devices finished
+	void RotateMultiDevice(const cl::Context& context, const std::vector<cl::Device>& devices,
+		const std::vector<double>& weights, const cl::Program& program,
+		const tga::TGAImage& src, tga::TGAImage& dst, float sinTheta, float cosTheta,
+		size_t localX, size_t localY);
+
+	// rows are handed out dynamically (hpc::RunWorkers) to every device and to hostThreads
+	// host threads running RotateRowsCPU, which produces the same pixels as image_rotate
+	// hostThreads = 0 uses the cores left over by the devices
+	void RotateHeterogeneous(const cl::Context& context, const std::vector<cl::Device>& devices,
+		const cl::Program& program, const tga::TGAImage& src, tga::TGAImage& dst,
+		float sinTheta, float cosTheta, size_t localX, size_t localY, unsigned int hostThreads = 0);
+
+}
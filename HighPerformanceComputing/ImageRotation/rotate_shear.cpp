@@ -0,0 +1,257 @@
+#include "rotate_shear.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+	// a rotation by more than 90 degrees is a 180 degree turn plus a smaller one,
+	// the shear factors stay below 1 that way
+	struct ShearPlan
+	{
+		bool halfTurn;
+		float shearX;		// -tan(theta / 2), first and third pass
+		float shearY;		// sin(theta), second pass
+	};
+
+	ShearPlan MakePlan(float degrees)
+	{
+		ShearPlan plan;
+		degrees = fmodf(degrees, 360.0f);
+		if (degrees > 180.0f)
+			degrees -= 360.0f;
+		else if (degrees <= -180.0f)
+			degrees += 360.0f;
+		plan.halfTurn = degrees > 90.0f || degrees < -90.0f;
+		if (plan.halfTurn)
+			degrees += degrees > 0.0f ? -180.0f : 180.0f;
+
+		const double theta = degrees * 3.14159265358979323846 / 180.0;
+		plan.shearX = (float)-tan(theta / 2.0);
+		plan.shearY = (float)sin(theta);
+		return plan;
+	}
+
+	// integer shift of row / column i, the kernels round the same way
+	inline int ShearOffset(float shear, int i, int center)
+	{
+		return (int)floorf(shear * (float)(i - center) + 0.5f);
+	}
+
+	// 180 degrees in place is reversing the pixel order
+	void ReversePixels(tga::TGAImage& image)
+	{
+		const size_t bytesPerPixel = image.bpp / 8;
+		const size_t pixels = (size_t)image.width * image.height;
+		unsigned char * data = &image.imageData[0];
+		unsigned char tmp[16];
+		for (size_t i = 0, j = pixels - 1; i < j; ++i, --j)
+		{
+			memcpy(tmp, data + i * bytesPerPixel, bytesPerPixel);
+			memcpy(data + i * bytesPerPixel, data + j * bytesPerPixel, bytesPerPixel);
+			memcpy(data + j * bytesPerPixel, tmp, bytesPerPixel);
+		}
+	}
+
+	// lines [0, count) pulled from a shared counter, every thread with its own scratch line
+	template <typename Pass>
+	void RunLines(unsigned int count, unsigned int threads, size_t scratchBytes, Pass pass)
+	{
+		threads = std::min(threads, count);
+		std::atomic<unsigned int> next(0);
+		auto worker = [&]()
+		{
+			std::vector<unsigned char> scratch(std::max<size_t>(scratchBytes, 1));
+			for (unsigned int i = next++; i < count; i = next++)
+				pass(i, &scratch[0]);
+		};
+		std::vector<std::thread> workers;
+		for (unsigned int i = 1; i < threads; ++i)
+			workers.push_back(std::thread(worker));
+		worker();
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+
+	// columns of the canvas on each side of the image, wide enough for the largest row offset
+	// so the first shear pushes nothing out that the later ones would bring back
+	// (the column shear only needs rows [0, H), rows it moves out of the frame stay outside)
+	int CanvasPad(const ShearPlan& plan, int H)
+	{
+		return (int)ceilf(fabsf(plan.shearX) * (float)(H / 2 + 1)) + 1;
+	}
+
+	// dst(x, y) = src(x + offset(y), y) in place in rows of W pixels
+	// columns [srcFirst, srcFirst + srcCount) hold the source, columns [dstFirst, dstFirst + dstCount) are written,
+	// pixels without a source become 0; a shifted row is a single memmove
+	void ShearRows(unsigned char * data, int W, int H, int srcFirst, int srcCount, int dstFirst, int dstCount,
+		float shear, size_t bytesPerPixel, unsigned int threads)
+	{
+		RunLines(H, threads, 0, [&](unsigned int y, unsigned char *)
+		{
+			const int shift = ShearOffset(shear, (int)y, H / 2);
+			unsigned char * row = data + (size_t)y * W * bytesPerPixel;
+			// destination columns whose source column i + shift lies inside the source window
+			const int dstLast = dstFirst + dstCount;
+			const int first = std::min(dstLast, std::max(dstFirst, srcFirst - shift));
+			const int last = std::max(first, std::min(dstLast, srcFirst + srcCount - shift));
+			if (first < last)
+				memmove(row + first * bytesPerPixel, row + (first + shift) * bytesPerPixel, (last - first) * bytesPerPixel);
+			memset(row + dstFirst * bytesPerPixel, 0, (first - dstFirst) * bytesPerPixel);
+			memset(row + last * bytesPerPixel, 0, (dstLast - last) * bytesPerPixel);
+		});
+	}
+
+	// rows of W pixels become rows of newW pixels starting at column origin of the old row, in place
+	// widening moves the rows from the last one, narrowing from the first one, so nothing is overwritten
+	void Restride(std::vector<unsigned char>& data, int W, int newW, int origin, int H, size_t bytesPerPixel)
+	{
+		const size_t rowBytes = std::min(W, newW) * bytesPerPixel;
+		if (newW > W)
+		{
+			data.reserve((size_t)newW * H * bytesPerPixel);
+			data.resize((size_t)newW * H * bytesPerPixel);
+			for (int y = H - 1; y >= 0; --y)
+				memmove(&data[((size_t)y * newW + origin) * bytesPerPixel], &data[(size_t)y * W * bytesPerPixel], rowBytes);
+		}
+		else
+		{
+			for (int y = 0; y < H; ++y)
+				memmove(&data[(size_t)y * newW * bytesPerPixel], &data[((size_t)y * W + origin) * bytesPerPixel], rowBytes);
+			data.resize((size_t)newW * H * bytesPerPixel);
+		}
+	}
+
+	// out(x, y) = in(x, y + offset(x)) in place, center is the buffer column of image column W / 2
+	void ShearColumns(unsigned char * data, int W, int H, int center, float shear, size_t bytesPerPixel, unsigned int threads)
+	{
+		const size_t rowBytes = W * bytesPerPixel;
+		RunLines(W, threads, H * bytesPerPixel, [&](unsigned int x, unsigned char * scratch)
+		{
+			const int offset = ShearOffset(shear, (int)x, center);
+			if (offset == 0)
+				return;
+			unsigned char * column = data + x * bytesPerPixel;
+			for (int y = 0; y < H; ++y)
+				memcpy(scratch + y * bytesPerPixel, column + y * rowBytes, bytesPerPixel);
+			for (int y = 0; y < H; ++y)
+			{
+				const int sy = y + offset;
+				if (sy >= 0 && sy < H)
+					memcpy(column + y * rowBytes, scratch + sy * bytesPerPixel, bytesPerPixel);
+				else
+					memset(column + y * rowBytes, 0, bytesPerPixel);
+			}
+		});
+	}
+
+	void RunShearKernel(const cl::CommandQueue& queue, cl::Kernel& kernel, const cl::Device& device, size_t groups)
+	{
+		const size_t local = std::min<size_t>(256, kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+		queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(groups * local), cl::NDRange(local));
+	}
+
+	void SetRowArgs(cl::Kernel& kernel, const cl::Buffer& data, const cl::Buffer& scratch, int W, int H,
+		int srcFirst, int srcCount, int dstFirst, int dstCount, float shear, int bytesPerPixel)
+	{
+		kernel.setArg(0, data);
+		kernel.setArg(1, scratch);
+		kernel.setArg(2, (cl_int)W);
+		kernel.setArg(3, (cl_int)H);
+		kernel.setArg(4, (cl_int)srcFirst);
+		kernel.setArg(5, (cl_int)srcCount);
+		kernel.setArg(6, (cl_int)dstFirst);
+		kernel.setArg(7, (cl_int)dstCount);
+		kernel.setArg(8, shear);
+		kernel.setArg(9, (cl_int)bytesPerPixel);
+	}
+
+}
+
+size_t rotation::ShearCanvasBytes(const tga::TGAImage& image, float degrees)
+{
+	const int pad = CanvasPad(MakePlan(degrees), (int)image.height);
+	return ((size_t)image.width + 2 * pad) * image.height * (image.bpp / 8);
+}
+
+void rotation::RotateShearCPU(tga::TGAImage& image, float degrees, unsigned int threads)
+{
+	if (image.width == 0 || image.height == 0)
+		return;
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	ShearPlan plan = MakePlan(degrees);
+	if (plan.halfTurn)
+		ReversePixels(image);
+
+	const int W = (int)image.width;
+	const int H = (int)image.height;
+	const size_t bytesPerPixel = image.bpp / 8;
+	const int pad = CanvasPad(plan, H);
+	const int canvasW = W + 2 * pad;
+
+	// the image buffer itself is widened to the canvas and narrowed back at the end
+	Restride(image.imageData, W, canvasW, pad, H, bytesPerPixel);
+	unsigned char * canvas = &image.imageData[0];
+	ShearRows(canvas, canvasW, H, pad, W, 0, canvasW, plan.shearX, bytesPerPixel, threads);
+	ShearColumns(canvas, canvasW, H, pad + W / 2, plan.shearY, bytesPerPixel, threads);
+	ShearRows(canvas, canvasW, H, 0, canvasW, pad, W, plan.shearX, bytesPerPixel, threads);
+	Restride(image.imageData, canvasW, W, pad, H, bytesPerPixel);
+}
+
+void rotation::RotateShearDevice(const cl::Context& context, const cl::CommandQueue& queue, const cl::Device& device,
+	const cl::Program& program, tga::TGAImage& image, float degrees)
+{
+	if (image.width == 0 || image.height == 0)
+		return;
+
+	ShearPlan plan = MakePlan(degrees);
+	if (plan.halfTurn)
+		ReversePixels(image);
+
+	const int W = (int)image.width;
+	const int H = (int)image.height;
+	const int bytesPerPixel = (int)(image.bpp / 8);
+	const int pad = CanvasPad(plan, H);
+	const int canvasW = W + 2 * pad;
+	const size_t canvasRow = (size_t)canvasW * bytesPerPixel;
+	const size_t imageRow = (size_t)W * bytesPerPixel;
+
+	// a few groups per compute unit, every group loops over its rows / columns with one line of scratch
+	const size_t groups = std::min<size_t>(std::max(canvasW, H), (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4);
+	cl::Buffer bufferCanvas(context, CL_MEM_READ_WRITE, canvasRow * H);
+	cl::Buffer bufferScratch(context, CL_MEM_READ_WRITE, groups * std::max(canvasW, H) * bytesPerPixel);
+
+	// the image goes into the middle of the canvas, the first shear only reads those columns
+	cl::size_t<3> bufferOrigin, hostOrigin, region;
+	bufferOrigin[0] = pad * bytesPerPixel;
+	region[0] = imageRow;
+	region[1] = H;
+	region[2] = 1;
+	queue.enqueueWriteBufferRect(bufferCanvas, CL_FALSE, bufferOrigin, hostOrigin, region,
+		canvasRow, 0, imageRow, 0, &image.imageData[0]);
+
+	cl::Kernel rowsIn(program, "shear_rows");
+	cl::Kernel columns(program, "shear_columns");
+	cl::Kernel rowsOut(program, "shear_rows");
+	SetRowArgs(rowsIn, bufferCanvas, bufferScratch, canvasW, H, pad, W, 0, canvasW, plan.shearX, bytesPerPixel);
+	columns.setArg(0, bufferCanvas);
+	columns.setArg(1, bufferScratch);
+	columns.setArg(2, (cl_int)canvasW);
+	columns.setArg(3, (cl_int)H);
+	columns.setArg(4, (cl_int)(pad + W / 2));
+	columns.setArg(5, plan.shearY);
+	columns.setArg(6, (cl_int)bytesPerPixel);
+	SetRowArgs(rowsOut, bufferCanvas, bufferScratch, canvasW, H, 0, canvasW, pad, W, plan.shearX, bytesPerPixel);
+
+	RunShearKernel(queue, rowsIn, device, std::min<size_t>(groups, H));
+	RunShearKernel(queue, columns, device, std::min<size_t>(groups, canvasW));
+	RunShearKernel(queue, rowsOut, device, std::min<size_t>(groups, H));
+
+	queue.enqueueReadBufferRect(bufferCanvas, CL_TRUE, bufferOrigin, hostOrigin, region,
+		canvasRow, 0, imageRow, 0, &image.imageData[0]);
+}
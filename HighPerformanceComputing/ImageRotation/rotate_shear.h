@@ -0,0 +1,36 @@
+// rotation by three shears (Paeth): shear x, shear y, shear x
+// every shear moves whole rows or columns by an integer offset; the first shear widens the rows,
+// so the image is widened to a canvas with room for the largest offset on both sides and the last
+// shear leaves the result in its middle, nothing is clipped between the passes
+// nearest neighbour like image_rotate, but the rounding differs so pixels are not identical to it
+
+#pragma once
+
+// NVidia only supports OpenCL 1.2
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include "tga.h"
+
+namespace rotation {
+
+	// bytes of the canvas the image is widened to, the image plus the widest row offset on both sides
+	// this is all the memory the rotation needs apart from one line of scratch per thread / work-group
+	size_t ShearCanvasBytes(const tga::TGAImage& image, float degrees);
+
+	// rotate image around its center in its own buffer, widened to the canvas stride in place while it runs,
+	// same direction as image_rotate, pixels shifted in from outside become 0, threads = 0 uses one thread per core
+	void RotateShearCPU(tga::TGAImage& image, float degrees, unsigned int threads = 0);
+
+	// same passes with shear_rows / shear_columns (kernel.cl), in place on the device: only the canvas plus
+	// one line of scratch per work-group, the image is copied in and out of its middle with rect copies
+	void RotateShearDevice(const cl::Context& context, const cl::CommandQueue& queue, const cl::Device& device,
+		const cl::Program& program, tga::TGAImage& image, float degrees);
+
+}
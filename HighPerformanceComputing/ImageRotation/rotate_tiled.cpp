@@ -0,0 +1,265 @@
+#include "rotate_tiled.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+	// one block of destination tiles and the source region it reads from
+	struct Step
+	{
+		int64_t destX, destY;
+		uint64_t destW, destH;
+		int64_t srcX, srcY;
+		uint64_t srcW, srcH;
+	};
+
+	// source pixel for a destination pixel, same expression as the kernels
+	inline void SourcePixel(int64_t ix, int64_t iy, int64_t W, int64_t H, float sinTheta, float cosTheta, int64_t * xpos, int64_t * ypos)
+	{
+		const int64_t w2 = W / 2;
+		const int64_t h2 = H / 2;
+		*xpos = (int64_t)floorf((cosTheta * (float)(ix - w2)) - (sinTheta * (float)(iy - h2)) + (float)w2);
+		*ypos = (int64_t)floorf((sinTheta * (float)(ix - w2)) + (cosTheta * (float)(iy - h2)) + (float)h2);
+	}
+
+	std::vector<Step> PlanSteps(const tiled::TiledImage& src, uint64_t blockSize, float sinTheta, float cosTheta)
+	{
+		const int64_t W = (int64_t)src.width;
+		const int64_t H = (int64_t)src.height;
+		std::vector<Step> steps;
+
+		for (uint64_t y = 0; y < src.height; y += blockSize)
+		{
+			for (uint64_t x = 0; x < src.width; x += blockSize)
+			{
+				Step s;
+				s.destX = (int64_t)x;
+				s.destY = (int64_t)y;
+				s.destW = std::min(blockSize, src.width - x);
+				s.destH = std::min(blockSize, src.height - y);
+
+				// the mapping is affine, so the corners bound the source region
+				int64_t minX = INT64_MAX, minY = INT64_MAX, maxX = INT64_MIN, maxY = INT64_MIN;
+				const int64_t cx[2] = { s.destX, s.destX + (int64_t)s.destW - 1 };
+				const int64_t cy[2] = { s.destY, s.destY + (int64_t)s.destH - 1 };
+				for (int i = 0; i < 4; ++i)
+				{
+					int64_t xpos, ypos;
+					SourcePixel(cx[i & 1], cy[i >> 1], W, H, sinTheta, cosTheta, &xpos, &ypos);
+					minX = std::min(minX, xpos);
+					maxX = std::max(maxX, xpos);
+					minY = std::min(minY, ypos);
+					maxY = std::max(maxY, ypos);
+				}
+
+				// one pixel of overlap against rounding, clipped to the image
+				minX = std::max<int64_t>(minX - 1, 0);
+				minY = std::max<int64_t>(minY - 1, 0);
+				maxX = std::min<int64_t>(maxX + 1, W - 1);
+				maxY = std::min<int64_t>(maxY + 1, H - 1);
+
+				s.srcX = minX;
+				s.srcY = minY;
+				s.srcW = maxX >= minX ? (uint64_t)(maxX - minX + 1) : 0;
+				s.srcH = maxY >= minY ? (uint64_t)(maxY - minY + 1) : 0;
+				steps.push_back(s);
+			}
+		}
+		return steps;
+	}
+
+	// largest source and destination block of a plan in bytes
+	void PlanFootprint(const std::vector<Step>& steps, unsigned int bytesPerPixel, size_t * srcBytes, size_t * destBytes)
+	{
+		*srcBytes = 0;
+		*destBytes = 0;
+		for (size_t i = 0; i < steps.size(); ++i)
+		{
+			*srcBytes = std::max(*srcBytes, (size_t)(steps[i].srcW * steps[i].srcH * bytesPerPixel));
+			*destBytes = std::max(*destBytes, (size_t)(steps[i].destW * steps[i].destH * bytesPerPixel));
+		}
+	}
+
+	// biggest block (multiple of the tile size and of 2^levels) whose plan fits the budget
+	// and whose source and destination buffers each stay within maxBufferBytes
+	std::vector<Step> PlanWithinBudget(const tiled::TiledImage& src, const tiled::RotateOptions& options,
+		unsigned int buffers, float sinTheta, float cosTheta)
+	{
+		const uint64_t align = std::max<uint64_t>(src.tileSize, 1ull << options.pyramidLevels);
+		const uint64_t pixels = std::min(options.deviceMemoryBudget / buffers, options.maxBufferBytes) / src.bytesPerPixel;
+		// a rotated block reads at most about twice its area, plus the block itself
+		uint64_t blockSize = (uint64_t)sqrt((double)pixels / 3.0);
+		blockSize = std::max(align, blockSize - blockSize % align);
+
+		for (;;)
+		{
+			std::vector<Step> steps = PlanSteps(src, blockSize, sinTheta, cosTheta);
+			size_t srcBytes, destBytes;
+			PlanFootprint(steps, src.bytesPerPixel, &srcBytes, &destBytes);
+			bool fits = buffers * (srcBytes + destBytes) <= options.deviceMemoryBudget
+				&& srcBytes <= options.maxBufferBytes && destBytes <= options.maxBufferBytes;
+			if (fits || blockSize == align)
+				return steps;
+			blockSize = std::max(align, (blockSize / 2) - (blockSize / 2) % align);
+		}
+	}
+
+	void InitPyramid(const tiled::TiledImage& dst, unsigned int levels, std::vector<tiled::TiledImage> * pyramid)
+	{
+		if (pyramid == NULL)
+			return;
+		pyramid->clear();
+		uint64_t w = dst.width, h = dst.height;
+		for (unsigned int l = 0; l < levels; ++l)
+		{
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+			pyramid->push_back(tiled::TiledImage(w, h, dst.bytesPerPixel, dst.tileSize));
+		}
+	}
+
+	// store a finished block and fold it into the pyramid while it is still hot
+	void FinishStep(const Step& s, const unsigned char * data, tiled::TiledImage& dst, std::vector<tiled::TiledImage> * pyramid)
+	{
+		dst.writeRegion(s.destX, s.destY, s.destW, s.destH, data);
+		if (pyramid == NULL || pyramid->empty())
+			return;
+
+		std::vector<unsigned char> levels[2];
+		const unsigned char * current = data;
+		uint64_t w = s.destW, h = s.destH;
+		for (size_t l = 0; l < pyramid->size(); ++l)
+		{
+			std::vector<unsigned char>& next = levels[l % 2];
+			tiled::Downsample(current, w, h, dst.bytesPerPixel, next);
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+			(*pyramid)[l].writeRegion(s.destX >> (l + 1), s.destY >> (l + 1), w, h, &next[0]);
+			current = &next[0];
+		}
+	}
+
+}
+
+void tiled::RotateTiled(const cl::Context& context, const cl::CommandQueue& queue, const cl::Program& program,
+	const TiledImage& src, TiledImage& dst, float sinTheta, float cosTheta,
+	const RotateOptions& options, std::vector<TiledImage> * pyramid)
+{
+	dst = TiledImage(src.width, src.height, src.bytesPerPixel, src.tileSize);
+	InitPyramid(dst, options.pyramidLevels, pyramid);
+	if (src.width == 0 || src.height == 0)
+		return;
+
+	// two sets of buffers, the host stages block i+1 while the device works on block i
+	std::vector<Step> steps = PlanWithinBudget(src, options, 2, sinTheta, cosTheta);
+	size_t srcBytes, destBytes;
+	PlanFootprint(steps, src.bytesPerPixel, &srcBytes, &destBytes);
+
+	cl::Buffer srcBuffer[2], destBuffer[2];
+	std::vector<unsigned char> srcHost[2], destHost[2];
+	cl::Event done[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		srcBuffer[i] = cl::Buffer(context, CL_MEM_READ_ONLY, std::max<size_t>(srcBytes, 1));
+		destBuffer[i] = cl::Buffer(context, CL_MEM_WRITE_ONLY, destBytes);
+		srcHost[i].resize(std::max<size_t>(srcBytes, 1));
+		destHost[i].resize(destBytes);
+	}
+
+	cl::Kernel kernel(program, "image_rotate_tile");
+	kernel.setArg(2, sinTheta);
+	kernel.setArg(3, cosTheta);
+	kernel.setArg(4, (cl_int)src.width);
+	kernel.setArg(5, (cl_int)src.height);
+	kernel.setArg(14, (cl_int)src.bytesPerPixel);
+
+	for (size_t i = 0; i < steps.size(); ++i)
+	{
+		const Step& s = steps[i];
+		const int slot = i % 2;
+
+		src.readRegion(s.srcX, s.srcY, s.srcW, s.srcH, &srcHost[slot][0]);
+		if (s.srcW * s.srcH > 0)
+			queue.enqueueWriteBuffer(srcBuffer[slot], CL_FALSE, 0, (size_t)(s.srcW * s.srcH * src.bytesPerPixel), &srcHost[slot][0]);
+
+		kernel.setArg(0, srcBuffer[slot]);
+		kernel.setArg(1, destBuffer[slot]);
+		kernel.setArg(6, (cl_int)s.srcX);
+		kernel.setArg(7, (cl_int)s.srcY);
+		kernel.setArg(8, (cl_int)s.srcW);
+		kernel.setArg(9, (cl_int)s.srcH);
+		kernel.setArg(10, (cl_int)s.destX);
+		kernel.setArg(11, (cl_int)s.destY);
+		kernel.setArg(12, (cl_int)s.destW);
+		kernel.setArg(13, (cl_int)s.destH);
+		if (options.localX > 0 && options.localY > 0)
+		{
+			// the kernel skips the padding items
+			size_t globalX = ((size_t)s.destW + options.localX - 1) / options.localX * options.localX;
+			size_t globalY = ((size_t)s.destH + options.localY - 1) / options.localY * options.localY;
+			queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(globalX, globalY), cl::NDRange(options.localX, options.localY));
+		}
+		else
+		{
+			queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((size_t)s.destW, (size_t)s.destH));
+		}
+		queue.enqueueReadBuffer(destBuffer[slot], CL_FALSE, 0, (size_t)(s.destW * s.destH * src.bytesPerPixel),
+			&destHost[slot][0], NULL, &done[slot]);
+		queue.flush();
+
+		// retire the previous block while this one runs
+		if (i > 0)
+		{
+			done[1 - slot].wait();
+			FinishStep(steps[i - 1], &destHost[1 - slot][0], dst, pyramid);
+		}
+	}
+
+	const int last = (steps.size() - 1) % 2;
+	done[last].wait();
+	FinishStep(steps.back(), &destHost[last][0], dst, pyramid);
+}
+
+void tiled::RotateTiledCPU(const TiledImage& src, TiledImage& dst, float sinTheta, float cosTheta,
+	const RotateOptions& options, std::vector<TiledImage> * pyramid)
+{
+	dst = TiledImage(src.width, src.height, src.bytesPerPixel, src.tileSize);
+	InitPyramid(dst, options.pyramidLevels, pyramid);
+	if (src.width == 0 || src.height == 0)
+		return;
+
+	const int64_t W = (int64_t)src.width;
+	const int64_t H = (int64_t)src.height;
+	const unsigned int bytesPerPixel = src.bytesPerPixel;
+	std::vector<Step> steps = PlanWithinBudget(src, options, 1, sinTheta, cosTheta);
+	std::vector<unsigned char> region, block;
+
+	for (size_t i = 0; i < steps.size(); ++i)
+	{
+		const Step& s = steps[i];
+		region.resize(std::max<size_t>((size_t)(s.srcW * s.srcH * bytesPerPixel), 1));
+		block.assign((size_t)(s.destW * s.destH * bytesPerPixel), 0);
+		src.readRegion(s.srcX, s.srcY, s.srcW, s.srcH, &region[0]);
+
+		for (uint64_t ty = 0; ty < s.destH; ++ty)
+		{
+			for (uint64_t tx = 0; tx < s.destW; ++tx)
+			{
+				int64_t xpos, ypos;
+				SourcePixel(s.destX + (int64_t)tx, s.destY + (int64_t)ty, W, H, sinTheta, cosTheta, &xpos, &ypos);
+				int64_t sx = xpos - s.srcX;
+				int64_t sy = ypos - s.srcY;
+				if (xpos >= 0 && xpos < W && ypos >= 0 && ypos < H
+					&& sx >= 0 && sx < (int64_t)s.srcW && sy >= 0 && sy < (int64_t)s.srcH)
+				{
+					memcpy(&block[(size_t)((ty * s.destW + tx) * bytesPerPixel)],
+						&region[(size_t)(((uint64_t)sy * s.srcW + (uint64_t)sx) * bytesPerPixel)], bytesPerPixel);
+				}
+			}
+		}
+
+		FinishStep(s, &block[0], dst, pyramid);
+	}
+}
@@ -0,0 +1,41 @@
+// tile streaming rotation for images that don't fit on the device at once
+// the destination is produced in blocks of tiles, each block only needs the
+// (overlapping) bounding box of its source pixels on the device
+
+#pragma once
+
+// NVidia only supports OpenCL 1.2
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include "tiled_image.h"
+
+namespace tiled {
+
+	struct RotateOptions
+	{
+		size_t deviceMemoryBudget;		// bytes of device memory the pipeline may allocate
+		size_t maxBufferBytes;			// largest single buffer, CL_DEVICE_MAX_MEM_ALLOC_SIZE
+		unsigned int pyramidLevels;		// downsampled levels produced in the same pass
+		size_t localX, localY;			// work-group shape of image_rotate_tile, 0 lets the driver choose
+
+		RotateOptions() : deviceMemoryBudget(256 << 20), maxBufferBytes(128 << 20), pyramidLevels(0), localX(0), localY(0) {}
+	};
+
+	// rotate src into dst around the image center (same math as image_rotate)
+	// pyramid (may be NULL) receives levels 1..pyramidLevels, each half the size of the one before
+	void RotateTiled(const cl::Context& context, const cl::CommandQueue& queue, const cl::Program& program,
+		const TiledImage& src, TiledImage& dst, float sinTheta, float cosTheta,
+		const RotateOptions& options, std::vector<TiledImage> * pyramid);
+
+	// same block walk on the host for nodes without OpenCL
+	void RotateTiledCPU(const TiledImage& src, TiledImage& dst, float sinTheta, float cosTheta,
+		const RotateOptions& options, std::vector<TiledImage> * pyramid);
+
+}
@@ -4,67 +4,525 @@
 #include <stdlib.h>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define TGA_HAVE_SSSE3
+#endif
 
 // Uncompressed TGA Header
 const unsigned char uTGAcompare[12] = { 0,0, 2,0,0,0,0,0,0,0,0,0 };
 // Compressed TGA Header
 const unsigned char cTGAcompare[12] = { 0,0,10,0,0,0,0,0,0,0,0,0 };
 
+// Size Of The Staging Buffer Used To Swizzle Pixels While Writing
+const size_t WRITE_CHUNK = 64 * 1024;
+
+void tga::SwapRedBlue(unsigned char * dst, const unsigned char * src, size_t pixelCount, unsigned int bytesPerPixel)
+{
+	const size_t size = pixelCount * bytesPerPixel;
+	size_t i = 0;
+
+	if (bytesPerPixel == 4)
+	{
+#if defined(__AVX2__)
+		const __m256i mask32 = _mm256_setr_epi8(
+			2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+			2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+		for (; i + 32 <= size; i += 32)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+			_mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(v, mask32));
+		}
+#endif
+#if defined(TGA_HAVE_SSSE3)
+		const __m128i mask16 = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+			_mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, mask16));
+		}
+#endif
+	}
+	else if (bytesPerPixel == 3)
+	{
+#if defined(TGA_HAVE_SSSE3)
+		// 5 pixels per step, the 16th byte is stored unchanged and rewritten by the next step
+		const __m128i mask15 = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+		for (; i + 16 <= size; i += 15)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+			_mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, mask15));
+		}
+#endif
+	}
+
+	// scalar tail
+	for (; i < size; i += bytesPerPixel)
+	{
+		unsigned char r = src[i];
+		dst[i] = src[i + 2];
+		dst[i + 1] = src[i + 1];
+		dst[i + 2] = r;
+		if (bytesPerPixel == 4)
+			dst[i + 3] = src[i + 3];
+	}
+}
+
+bool tga::MapFile(tga::MappedFile * file, const char * filename)
+{
+	file->data = NULL;
+	file->size = 0;
+	file->handle = NULL;
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(hFile);				// The Mapping Keeps Its Own Reference
+	if (hMapping == NULL)
+		return false;
+
+	void * data = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL)
+	{
+		CloseHandle(hMapping);
+		return false;
+	}
+
+	file->data = (const unsigned char *)data;
+	file->size = (size_t)size.QuadPart;
+	file->handle = hMapping;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void * data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);					// The Mapping Stays Valid After Closing
+	if (data == MAP_FAILED)
+		return false;
+	madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	file->data = (const unsigned char *)data;
+	file->size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void tga::UnmapFile(tga::MappedFile * file)
+{
+	if (file->data == NULL)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(file->data);
+	CloseHandle((HANDLE)file->handle);
+#else
+	munmap((void *)file->data, file->size);
+#endif
+	file->data = NULL;
+	file->size = 0;
+	file->handle = NULL;
+}
+
+// Parse The 18 Byte Header Of A Mapped TGA, Returns The Offset Of The Pixel Data Or 0
+static size_t ParseMappedHeader(const tga::MappedFile& file, bool * compressed, unsigned int * width, unsigned int * height, unsigned int * bpp)
+{
+	if (file.size < sizeof(tga::TGAHeader) + 6)
+		return 0;
+
+	if (memcmp(uTGAcompare, file.data, sizeof(tga::TGAHeader)) == 0)
+		*compressed = false;
+	else if (memcmp(cTGAcompare, file.data, sizeof(tga::TGAHeader)) == 0)
+		*compressed = true;
+	else
+		return 0;
+
+	const unsigned char * header = file.data + sizeof(tga::TGAHeader);
+	*width = header[1] * 256 + header[0];
+	*height = header[3] * 256 + header[2];
+	*bpp = header[4];
+
+	if ((*width <= 0) || (*height <= 0) || ((*bpp != 24) && (*bpp != 32)))
+		return 0;
+
+	return sizeof(tga::TGAHeader) + 6;
+}
+
+bool tga::MapTGA(tga::TGAView * view, const char * filename)
+{
+	if (!MapFile(&view->file, filename))
+	{
+		std::cout << "mapTGA: error mapping file " << filename << std::endl;
+		return false;
+	}
+
+	bool compressed = false;
+	size_t offset = ParseMappedHeader(view->file, &compressed, &view->width, &view->height, &view->bpp);
+	size_t imageSize = (size_t)view->width * view->height * (view->bpp / 8);
+	// compressed files are valid, they just can't be viewed, callers fall back to LoadTGA
+	if (offset == 0 || compressed || view->file.size < offset + imageSize)
+	{
+		if (!compressed)
+			std::cout << "mapTGA: error: not a valid uncompressed tga\n";
+		UnmapFile(&view->file);
+		return false;
+	}
+
+	view->pixels = view->file.data + offset;
+	return true;
+}
+
+void tga::UnmapTGA(tga::TGAView * view)
+{
+	UnmapFile(&view->file);
+	view->pixels = NULL;
+}
+
+// Fill count pixels with the same color using block stores of a repeated pattern
+static void FillPixels(unsigned char * dst, const unsigned char * pixel, unsigned int count, unsigned int bytesPerPixel)
+{
+	// 48 bytes hold a whole number of 3 and 4 byte pixels
+	const size_t PATTERN = 48;
+	unsigned char pattern[PATTERN];
+	for (size_t i = 0; i < PATTERN; i += bytesPerPixel)
+		memcpy(pattern + i, pixel, bytesPerPixel);
+
+	size_t size = (size_t)count * bytesPerPixel;
+	for (; size >= PATTERN; size -= PATTERN, dst += PATTERN)
+		memcpy(dst, pattern, PATTERN);
+	memcpy(dst, pattern, size);
+}
+
+// Expand The RLE Packets Of A Compressed TGA That Is Already In Memory
+static bool DecodeRLE(tga::TGAImage * image, const unsigned char * data, size_t size)
+{
+	const unsigned int bytesPerPixel = image->bpp / 8;
+	const size_t pixelcount = (size_t)image->width * image->height;
+	const bool swap = image->order != tga::ORDER_BGR;
+
+	image->imageData.resize(pixelcount * bytesPerPixel);
+	unsigned char * out = &image->imageData[0];
+	const unsigned char * end = data + size;
+
+	size_t currentpixel = 0;
+	while (currentpixel < pixelcount)
+	{
+		if (data >= end)
+		{
+			std::cout << "loadTGA: error reading chunk header \n";
+			return false;
+		}
+
+		unsigned char chunkheader = *data++;
+		unsigned int count = (chunkheader & 127) + 1;
+		if (currentpixel + count > pixelcount)
+		{
+			std::cout << "loadTGA: error: too many pixels in chunk\n";
+			return false;
+		}
+
+		if (chunkheader < 128)				// 'RAW' Chunk, Copy All Pixels At Once
+		{
+			size_t bytes = (size_t)count * bytesPerPixel;
+			if ((size_t)(end - data) < bytes)
+			{
+				std::cout << "loadTGA: error reading a single pixel\n";
+				return false;
+			}
+			if (swap)
+				tga::SwapRedBlue(out, data, count, bytesPerPixel);
+			else
+				memcpy(out, data, bytes);
+			data += bytes;
+		}
+		else						// RLE Chunk, Replicate One Pixel
+		{
+			if ((size_t)(end - data) < bytesPerPixel)
+			{
+				std::cout << "loadTGA: error reading a single pixel\n";
+				return false;
+			}
+			unsigned char pixel[4];
+			if (swap)
+				tga::SwapRedBlue(pixel, data, 1, bytesPerPixel);
+			else
+				memcpy(pixel, data, bytesPerPixel);
+			FillPixels(out, pixel, count, bytesPerPixel);
+			data += bytesPerPixel;
+		}
+
+		out += (size_t)count * bytesPerPixel;
+		currentpixel += count;
+	}
+
+	return true;
+}
+
+// Encode Scanlines [first, last) As RLE Packets, Packets Never Cross A Scanline
+static void EncodeRLE(const tga::TGAImage& image, unsigned int first, unsigned int last, std::vector<unsigned char>& out)
+{
+	const unsigned int bytesPerPixel = image.bpp / 8;
+	const bool swap = image.order != tga::ORDER_BGR;
+	unsigned char pixel[4];
+
+	for (unsigned int y = first; y < last; ++y)
+	{
+		const unsigned char * line = &image.imageData[(size_t)y * image.width * bytesPerPixel];
+		unsigned int x = 0;
+		while (x < image.width)
+		{
+			// length of the run of equal pixels starting at x
+			unsigned int run = 1;
+			while (x + run < image.width && run < 128
+				&& memcmp(line + (x + run) * bytesPerPixel, line + x * bytesPerPixel, bytesPerPixel) == 0)
+			{
+				++run;
+			}
+
+			if (run > 1)
+			{
+				out.push_back((unsigned char)(128 | (run - 1)));
+				if (swap)
+					tga::SwapRedBlue(pixel, line + x * bytesPerPixel, 1, bytesPerPixel);
+				else
+					memcpy(pixel, line + x * bytesPerPixel, bytesPerPixel);
+				out.insert(out.end(), pixel, pixel + bytesPerPixel);
+				x += run;
+				continue;
+			}
+
+			// raw packet up to the next run of two equal pixels
+			unsigned int raw = 1;
+			while (x + raw < image.width && raw < 128
+				&& !(x + raw + 1 < image.width
+					&& memcmp(line + (x + raw) * bytesPerPixel, line + (x + raw + 1) * bytesPerPixel, bytesPerPixel) == 0))
+			{
+				++raw;
+			}
+
+			out.push_back((unsigned char)(raw - 1));
+			size_t offset = out.size();
+			out.resize(offset + (size_t)raw * bytesPerPixel);
+			if (swap)
+				tga::SwapRedBlue(&out[offset], line + x * bytesPerPixel, raw, bytesPerPixel);
+			else
+				memcpy(&out[offset], line + x * bytesPerPixel, (size_t)raw * bytesPerPixel);
+			x += raw;
+		}
+	}
+}
+
+// Fill The 18 Byte File Header
+static void BuildHeader(const tga::TGAImage& image, const unsigned char compare[12], unsigned char header[18])
+{
+	memcpy(header, compare, 12);
+	header[12] = image.width % 256;
+	header[13] = image.width / 256;
+	header[14] = image.height % 256;
+	header[15] = image.height / 256;
+	header[16] = image.bpp;
+	header[17] = image.bpp == 32 ? 8 : 0; //flag alpha depth and other flags
+}
+
 bool tga::saveTGA(const TGAImage& image, const char * filename)
 {
 	const unsigned int bytesPerPixel = image.bpp / 8;
+	const size_t pixelCount = (size_t)image.width * image.height;
+
+	FILE * fTGA = fopen(filename, "wb");
+	if (fTGA == NULL)
+	{
+		std::cout << "saveTGA: error writing file " << filename << std::endl;
+		return false;
+	}
 
-	std::ofstream myfile;
-	myfile.open(filename, std::ios::out | std::ios::trunc | std::ios::binary);
 	//create the tga header
-	unsigned char header[6];
-	// 1x1 image
-	header[0] = image.width % 256;
-	header[1] = image.width / 256;
-	header[2] = image.height % 256;
-	header[3] = image.height / 256;
-	header[4] = image.bpp;
-	header[5] = image.bpp == 32 ? 8 : 0; //flag alpha depth and other flags
-
-										 //add the headers
-	for (int i = 0; i < 12; ++i)
-	{
-		myfile << uTGAcompare[i];
+	unsigned char header[18];
+	BuildHeader(image, uTGAcompare, header);
+
+	bool ok = fwrite(header, 1, sizeof(header), fTGA) == sizeof(header);
+
+	if (image.order == ORDER_BGR)
+	{
+		// already in file order, write straight from the image
+		ok = ok && fwrite(&image.imageData[0], 1, pixelCount * bytesPerPixel, fTGA) == pixelCount * bytesPerPixel;
 	}
-	for (int i = 0; i < 6; ++i)
+	else
 	{
-		myfile << header[i];
+		// swap from RGB to BGR through a small staging buffer instead of copying the image
+		std::vector<unsigned char> chunk(WRITE_CHUNK - WRITE_CHUNK % bytesPerPixel);
+		const size_t chunkPixels = chunk.size() / bytesPerPixel;
+		for (size_t pixel = 0; ok && pixel < pixelCount; pixel += chunkPixels)
+		{
+			size_t count = pixelCount - pixel < chunkPixels ? pixelCount - pixel : chunkPixels;
+			SwapRedBlue(&chunk[0], &image.imageData[pixel * bytesPerPixel], count, bytesPerPixel);
+			ok = fwrite(&chunk[0], 1, count * bytesPerPixel, fTGA) == count * bytesPerPixel;
+		}
 	}
-	//myfile << header;
-	//add the image data
-	std::vector<unsigned char> imageData(image.imageData);
 
-	//swap from RGB to BGR
-	// Start The Loop
-	for (unsigned int cswap = 0; cswap < imageData.size(); cswap += bytesPerPixel)
+	fclose(fTGA);
+	if (!ok)
+		std::cout << "saveTGA: error writing image data\n";
+
+	return ok;
+}
+
+bool tga::saveCompressedTGA(const TGAImage& image, const char * filename, unsigned int threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, std::max(1u, image.height));
+
+	// every thread encodes its own band of scanlines, the calling thread takes the last one
+	// an exception of a band is kept until all threads are joined and rethrown then
+	std::vector<std::vector<unsigned char> > bands(threads);
+	std::vector<std::exception_ptr> errors(threads);
+	auto encode = [&](unsigned int t)
 	{
-		// 1st Byte XOR 3rd Byte XOR 1st Byte XOR 3rd Byte
-		imageData[cswap] ^= imageData[cswap + 2] ^=
-			imageData[cswap] ^= imageData[cswap + 2];
+		try
+		{
+			unsigned int first = (unsigned int)((unsigned long long)image.height * t / threads);
+			unsigned int last = (unsigned int)((unsigned long long)image.height * (t + 1) / threads);
+			bands[t].reserve((size_t)(last - first) * image.width * (image.bpp / 8) / 2);
+			EncodeRLE(image, first, last, bands[t]);
+		}
+		catch (...)
+		{
+			errors[t] = std::current_exception();
+		}
+	};
+	// a band whose thread can't be started is encoded here instead
+	std::vector<std::thread> workers;
+	workers.reserve(threads);
+	for (unsigned int t = 0; t + 1 < threads; ++t)
+	{
+		try
+		{
+			workers.push_back(std::thread(encode, t));
+		}
+		catch (const std::system_error&)
+		{
+			encode(t);
+		}
+	}
+	encode(threads - 1);
+	for (size_t t = 0; t < workers.size(); ++t)
+		workers[t].join();
+	for (unsigned int t = 0; t < threads; ++t)
+	{
+		if (errors[t])
+			std::rethrow_exception(errors[t]);
 	}
 
-	for (unsigned int i = 0; i < imageData.size(); ++i)
+	FILE * fTGA = fopen(filename, "wb");
+	if (fTGA == NULL)
 	{
-		unsigned char x = imageData[i];
-		myfile << imageData[i];
+		std::cout << "saveTGA: error writing file " << filename << std::endl;
+		return false;
 	}
 
-	myfile.close();
+	unsigned char header[18];
+	BuildHeader(image, cTGAcompare, header);
+	bool ok = fwrite(header, 1, sizeof(header), fTGA) == sizeof(header);
+	for (unsigned int t = 0; ok && t < threads; ++t)
+	{
+		if (!bands[t].empty())
+			ok = fwrite(&bands[t][0], 1, bands[t].size(), fTGA) == bands[t].size();
+	}
+
+	fclose(fTGA);
+	if (!ok)
+		std::cout << "saveTGA: error writing image data\n";
+
+	return ok;
+}
+
+// Load An Uncompressed TGA Straight From A Mapping
+static bool LoadMappedUncompressedTGA(tga::TGAImage * image, const tga::MappedFile& file, size_t offset)
+{
+	const unsigned int bytesPerPixel = image->bpp / 8;
+	const size_t pixelCount = (size_t)image->width * image->height;
+	const size_t imageSize = pixelCount * bytesPerPixel;
+
+	if (file.size < offset + imageSize)
+	{
+		std::cout << "loadTGA: error reading image data\n";
+		return false;
+	}
+
+	// one pass from the page cache into the image, swizzling on the way if needed
+	image->imageData.resize(imageSize);
+	if (image->order == tga::ORDER_BGR)
+		memcpy(&image->imageData[0], file.data + offset, imageSize);
+	else
+		tga::SwapRedBlue(&image->imageData[0], file.data + offset, pixelCount, bytesPerPixel);
 
 	return true;
 }
 
 // Load A TGA File!
-bool tga::LoadTGA(TGAImage * image, const char * filename)
+bool tga::LoadTGA(TGAImage * image, const char * filename, bool keepBGR)
 {
 	tga::TGAHeader tgaheader;				// Used To Store Our File Header
 	tga::TGA tga_;					// Used To Store File Information
 
+	image->order = keepBGR ? ORDER_BGR : ORDER_RGB;
+
+	// Map The File Instead Of Reading It
+	MappedFile mapped;
+	if (MapFile(&mapped, filename))
+	{
+		bool compressed = false;
+		size_t offset = ParseMappedHeader(mapped, &compressed, &image->width, &image->height, &image->bpp);
+		if (offset != 0)
+		{
+			image->type = image->bpp == 24 ? 0 : 1;
+			bool loaded = compressed
+				? DecodeRLE(image, mapped.data + offset, mapped.size - offset)
+				: LoadMappedUncompressedTGA(image, mapped, offset);
+			UnmapFile(&mapped);
+			return loaded;
+		}
+		UnmapFile(&mapped);
+	}
+
 	FILE * fTGA;					// Declare File Pointer
 	fTGA = fopen(filename, "rb");			// Open File For Reading
 
@@ -86,21 +544,20 @@ bool tga::LoadTGA(TGAImage * image, const char * filename)
 	if (memcmp(uTGAcompare, &tgaheader, sizeof(tgaheader)) == 0)
 	{
 		// Load An Uncompressed TGA
-		LoadUncompressedTGA(image, filename, fTGA, tgaheader, tga_);
+		return LoadUncompressedTGA(image, filename, fTGA, tgaheader, tga_);
 	}
 	// If The File Header Matches The Compressed Header
 	else if (memcmp(cTGAcompare, &tgaheader, sizeof(tgaheader)) == 0)
 	{
 		// Load A Compressed TGA
-		LoadCompressedTGA(image, filename, fTGA, tgaheader, tga_);
+		return LoadCompressedTGA(image, filename, fTGA, tgaheader, tga_);
 	}
 	else						// If It Doesn't Match Either One
 	{
 		std::cout << "loadTGA: error: tga file header does not match\n";
+		fclose(fTGA);
 		return false;				// Return False
 	}
-
-	return true;
 }
 
 // Load An Uncompressed TGA
@@ -152,13 +609,8 @@ bool tga::LoadUncompressedTGA(tga::TGAImage * image, const char * filename, FILE
 	}
 
 	//swap from BGR to RGB
-	// Start The Loop
-	for (unsigned int cswap = 0; cswap < tga_.imageSize; cswap += tga_.bytesPerPixel)
-	{
-		// 1st Byte XOR 3rd Byte XOR 1st Byte XOR 3rd Byte
-		image->imageData[cswap] ^= image->imageData[cswap + 2] ^=
-			image->imageData[cswap] ^= image->imageData[cswap + 2];
-	}
+	if (image->order != ORDER_BGR)
+		SwapRedBlue(&image->imageData[0], &image->imageData[0], tga_.Width * tga_.Height, tga_.bytesPerPixel);
 
 	fclose(fTGA);					// Close The File
 	return true;					// Return Success
@@ -197,84 +649,23 @@ bool tga::LoadCompressedTGA(tga::TGAImage * image, const char * filename, FILE *
 											// Calculate Memory Needed To Store Image
 	tga.imageSize = (tga.bytesPerPixel * tga.Width * tga.Height);
 
-	// Allocate Memory To Store Image Data
-	image->imageData = std::vector<unsigned char>(tga.imageSize);
-
-	unsigned int pixelcount = tga.Height * tga.Width;	// Number Of Pixels In The Image
-	unsigned int currentpixel = 0;			// Current Pixel We Are Reading From Data
-	unsigned int currentbyte = 0;			// Current Byte We Are Writing Into Imagedata
-											// Storage For 1 Pixel
-	unsigned char * colorbuffer = (unsigned char *)malloc(tga.bytesPerPixel);
-
-	do						// Start Loop
+	// Read The Remaining File In One Go Instead Of One fread Per Chunk
+	std::vector<unsigned char> packets;
+	long start = ftell(fTGA);
+	if (start >= 0 && fseek(fTGA, 0, SEEK_END) == 0)
 	{
-		unsigned char chunkheader = 0;			// Variable To Store The Value Of The Id Chunk
-		if (fread(&chunkheader, sizeof(unsigned char), 1, fTGA) == 0)	// Attempt To Read The Chunk's Header
-		{
-			std::cout << "loadTGA: error reading chunk header \n";
-			free(colorbuffer);
-			return false;				// If It Fails, Return False
-		}
-
-		if (chunkheader < 128)				// If The Chunk Is A 'RAW' Chunk
-		{
-			chunkheader++;				// Add 1 To The Value To Get Total Number Of Raw Pixels
-
-										// Start Pixel Reading Loop
-			for (short counter = 0; counter < chunkheader; counter++)
-			{
-				// Try To Read 1 Pixel
-				if (fread(colorbuffer, 1, tga.bytesPerPixel, fTGA) != tga.bytesPerPixel)
-				{
-					std::cout << "loadTGA: error reading a single pixel\n";
-					free(colorbuffer);
-					return false;			// If It Fails, Return False
-				}
-				image->imageData[currentbyte] = colorbuffer[2];		// Write The 'R' Byte
-				image->imageData[currentbyte + 1] = colorbuffer[1];	// Write The 'G' Byte
-				image->imageData[currentbyte + 2] = colorbuffer[0];	// Write The 'B' Byte
-				if (tga.bytesPerPixel == 4)					// If It's A 32bpp Image...
-				{
-					image->imageData[currentbyte + 3] = colorbuffer[3];	// Write The 'A' Byte
-				}
-				// Increment The Byte Counter By The Number Of Bytes In A Pixel
-				currentbyte += tga.bytesPerPixel;
-				currentpixel++;					// Increment The Number Of Pixels By 1
-			}
-		}
-		else						// If It's An RLE Header
-		{
-			chunkheader -= 127;			// Subtract 127 To Get Rid Of The ID Bit
-										// Read The Next Pixel
-			if (fread(colorbuffer, 1, tga.bytesPerPixel, fTGA) != tga.bytesPerPixel)
-			{
-				std::cout << "loadTGA: error reading a single pixel\n";
-				free(colorbuffer);
-				return false;				// If It Fails, Return False
-			}
-			// Start The Loop
-			for (short counter = 0; counter < chunkheader; counter++)
-			{
-				// Copy The 'R' Byte
-				image->imageData[currentbyte] = colorbuffer[2];
-				// Copy The 'G' Byte
-				image->imageData[currentbyte + 1] = colorbuffer[1];
-				// Copy The 'B' Byte
-				image->imageData[currentbyte + 2] = colorbuffer[0];
-				if (tga.bytesPerPixel == 4)		// If It's A 32bpp Image
-				{
-					// Copy The 'A' Byte
-					image->imageData[currentbyte + 3] = colorbuffer[3];
-				}
-				currentbyte += tga.bytesPerPixel;	// Increment The Byte Counter
-				currentpixel++;				// Increment The Pixel Counter
-			}
-		}
-
-	} while (currentpixel < pixelcount);
-
+		long end = ftell(fTGA);
+		fseek(fTGA, start, SEEK_SET);
+		if (end > start)
+			packets.resize((size_t)(end - start));
+	}
+	if (packets.empty() || fread(&packets[0], 1, packets.size(), fTGA) != packets.size())
+	{
+		std::cout << "loadTGA: error reading compressed image data\n";
+		fclose(fTGA);
+		return false;
+	}
 	fclose(fTGA);
-	free(colorbuffer);
-	return true;
 
+	return DecodeRLE(image, &packets[0], packets.size());
 }
@@ -9,10 +9,19 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <stdio.h>				// Standard Header For File I/O
+#include <stddef.h>
 #include <vector>
 
 namespace tga {
 
+	// Channel order of TGAImage::imageData. TGA files store BGR(A), so an image
+	// kept in ORDER_BGR is loaded and saved without any swizzle at all.
+	enum ChannelOrder
+	{
+		ORDER_RGB = 0,
+		ORDER_BGR = 1
+	};
+
 	typedef struct
 	{
 		std::vector<unsigned char> imageData;			// Hold All The Color Values For The Image.
@@ -20,6 +29,7 @@ namespace tga {
 		unsigned int width;				// The Width Of The Entire Image.
 		unsigned int height;				// The Height Of The Entire Image.
 		unsigned int type;			 	// Data Stored In * ImageData (GL_RGB Or GL_RGBA)
+		unsigned int order = ORDER_RGB;			// Channel Order Of ImageData (ChannelOrder)
 	} TGAImage;
 
 	typedef struct
@@ -38,9 +48,39 @@ namespace tga {
 		unsigned int Bpp;				// Number Of BITS Per Pixel (24 Or 32)
 	} TGA;
 
+	// read-only view of a file mapped into memory
+	typedef struct
+	{
+		const unsigned char * data;			// First Byte Of The Mapping
+		size_t size;					// Size Of The Mapping In Bytes
+		void * handle;					// Platform Specific Mapping Handle
+	} MappedFile;
+
+	// zero-copy view of an uncompressed tga, pixels point into the mapping (BGR(A))
+	typedef struct
+	{
+		MappedFile file;
+		const unsigned char * pixels;
+		unsigned int bpp;
+		unsigned int width;
+		unsigned int height;
+	} TGAView;
+
+	bool MapFile(MappedFile * file, const char * filename);
+	void UnmapFile(MappedFile * file);
+
+	bool MapTGA(TGAView * view, const char * filename);	// only uncompressed files can be viewed, compressed ones fail quietly
+	void UnmapTGA(TGAView * view);
+
+	// swap the 1st and 3rd byte of every pixel (RGB <-> BGR), dst may equal src
+	void SwapRedBlue(unsigned char * dst, const unsigned char * src, size_t pixelCount, unsigned int bytesPerPixel);
+
 	bool saveTGA(const TGAImage& image, const char * filename); //save as uncompressed tga
+	// save as rle compressed tga, scanlines are encoded in parallel (0 threads = one per core)
+	bool saveCompressedTGA(const TGAImage& image, const char * filename, unsigned int threads = 0);
 
-	bool LoadTGA(TGAImage* image, const char * filename);
+	// keepBGR leaves the pixels in file order (ORDER_BGR) instead of swizzling them to RGB
+	bool LoadTGA(TGAImage* image, const char * filename, bool keepBGR = false);
 	// Load An Uncompressed File
 	bool LoadUncompressedTGA(TGAImage *, const char *, FILE *, tga::TGAHeader&, tga::TGA&);
 	// Load A Compressed File
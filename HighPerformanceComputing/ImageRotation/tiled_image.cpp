@@ -0,0 +1,145 @@
+#include "tiled_image.h"
+#include <string.h>
+#include <algorithm>
+
+tiled::TiledImage::TiledImage()
+	: width(0), height(0), bytesPerPixel(0), tileSize(0), tilesX(0), tilesY(0)
+{
+}
+
+tiled::TiledImage::TiledImage(uint64_t width, uint64_t height, unsigned int bytesPerPixel, unsigned int tileSize)
+	: width(width), height(height), bytesPerPixel(bytesPerPixel), tileSize(tileSize),
+	tilesX((width + tileSize - 1) / tileSize), tilesY((height + tileSize - 1) / tileSize)
+{
+	tiles.resize((size_t)(tilesX * tilesY));
+}
+
+const unsigned char * tiled::TiledImage::tile(uint64_t tx, uint64_t ty) const
+{
+	const std::vector<unsigned char>& t = tiles[(size_t)(ty * tilesX + tx)];
+	return t.empty() ? NULL : &t[0];
+}
+
+unsigned char * tiled::TiledImage::tile(uint64_t tx, uint64_t ty)
+{
+	std::vector<unsigned char>& t = tiles[(size_t)(ty * tilesX + tx)];
+	if (t.empty())
+		t.resize((size_t)tileSize * tileSize * bytesPerPixel);
+	return &t[0];
+}
+
+void tiled::TiledImage::readRegion(int64_t x, int64_t y, uint64_t w, uint64_t h, unsigned char * dst) const
+{
+	const size_t rowBytes = (size_t)w * bytesPerPixel;
+	memset(dst, 0, rowBytes * (size_t)h);
+
+	// clip against the image
+	int64_t x0 = std::max<int64_t>(x, 0);
+	int64_t y0 = std::max<int64_t>(y, 0);
+	int64_t x1 = std::min<int64_t>(x + (int64_t)w, (int64_t)width);
+	int64_t y1 = std::min<int64_t>(y + (int64_t)h, (int64_t)height);
+
+	for (int64_t row = y0; row < y1; ++row)
+	{
+		uint64_t ty = (uint64_t)row / tileSize;
+		uint64_t tileRow = (uint64_t)row % tileSize;
+		for (int64_t col = x0; col < x1;)
+		{
+			uint64_t tx = (uint64_t)col / tileSize;
+			uint64_t tileCol = (uint64_t)col % tileSize;
+			int64_t span = std::min<int64_t>(x1 - col, (int64_t)(tileSize - tileCol));
+			const unsigned char * t = tile(tx, ty);
+			if (t != NULL)
+			{
+				memcpy(dst + (size_t)(row - y) * rowBytes + (size_t)(col - x) * bytesPerPixel,
+					t + ((size_t)tileRow * tileSize + tileCol) * bytesPerPixel, (size_t)span * bytesPerPixel);
+			}
+			col += span;
+		}
+	}
+}
+
+void tiled::TiledImage::writeRegion(int64_t x, int64_t y, uint64_t w, uint64_t h, const unsigned char * src)
+{
+	const size_t rowBytes = (size_t)w * bytesPerPixel;
+
+	int64_t x0 = std::max<int64_t>(x, 0);
+	int64_t y0 = std::max<int64_t>(y, 0);
+	int64_t x1 = std::min<int64_t>(x + (int64_t)w, (int64_t)width);
+	int64_t y1 = std::min<int64_t>(y + (int64_t)h, (int64_t)height);
+
+	for (int64_t row = y0; row < y1; ++row)
+	{
+		uint64_t ty = (uint64_t)row / tileSize;
+		uint64_t tileRow = (uint64_t)row % tileSize;
+		for (int64_t col = x0; col < x1;)
+		{
+			uint64_t tx = (uint64_t)col / tileSize;
+			uint64_t tileCol = (uint64_t)col % tileSize;
+			int64_t span = std::min<int64_t>(x1 - col, (int64_t)(tileSize - tileCol));
+			memcpy(tile(tx, ty) + ((size_t)tileRow * tileSize + tileCol) * bytesPerPixel,
+				src + (size_t)(row - y) * rowBytes + (size_t)(col - x) * bytesPerPixel, (size_t)span * bytesPerPixel);
+			col += span;
+		}
+	}
+}
+
+tiled::TiledImage tiled::TiledImage::FromTGA(const tga::TGAImage& image, unsigned int tileSize)
+{
+	TiledImage result(image.width, image.height, image.bpp / 8, tileSize);
+	if (!image.imageData.empty())
+		result.writeRegion(0, 0, image.width, image.height, &image.imageData[0]);
+	return result;
+}
+
+tiled::TiledImage tiled::TiledImage::FromView(const tga::TGAView& view, unsigned int tileSize)
+{
+	TiledImage result(view.width, view.height, view.bpp / 8, tileSize);
+	if (view.pixels != NULL)
+		result.writeRegion(0, 0, view.width, view.height, view.pixels);
+	return result;
+}
+
+bool tiled::TiledImage::ToTGA(tga::TGAImage * image) const
+{
+	if (width > 65535 || height > 65535 || (bytesPerPixel != 3 && bytesPerPixel != 4))
+		return false;
+
+	image->width = (unsigned int)width;
+	image->height = (unsigned int)height;
+	image->bpp = bytesPerPixel * 8;
+	image->type = bytesPerPixel == 3 ? 0 : 1;
+	image->imageData.resize((size_t)width * height * bytesPerPixel);
+	readRegion(0, 0, width, height, &image->imageData[0]);
+	return true;
+}
+
+void tiled::Downsample(const unsigned char * src, uint64_t w, uint64_t h, unsigned int bytesPerPixel, std::vector<unsigned char>& dst)
+{
+	const uint64_t dw = (w + 1) / 2;
+	const uint64_t dh = (h + 1) / 2;
+	dst.resize((size_t)(dw * dh * bytesPerPixel));
+
+	for (uint64_t y = 0; y < dh; ++y)
+	{
+		const uint64_t y0 = 2 * y;
+		const uint64_t y1 = std::min(y0 + 1, h - 1);
+		for (uint64_t x = 0; x < dw; ++x)
+		{
+			const uint64_t x0 = 2 * x;
+			const uint64_t x1 = std::min(x0 + 1, w - 1);
+			const unsigned int n = (unsigned int)((x1 - x0 + 1) * (y1 - y0 + 1));
+			for (unsigned int c = 0; c < bytesPerPixel; ++c)
+			{
+				unsigned int sum = src[(y0 * w + x0) * bytesPerPixel + c];
+				if (x1 != x0)
+					sum += src[(y0 * w + x1) * bytesPerPixel + c];
+				if (y1 != y0)
+					sum += src[(y1 * w + x0) * bytesPerPixel + c];
+				if (x1 != x0 && y1 != y0)
+					sum += src[(y1 * w + x1) * bytesPerPixel + c];
+				dst[(size_t)((y * dw + x) * bytesPerPixel + c)] = (unsigned char)((sum + n / 2) / n);
+			}
+		}
+	}
+}
@@ -0,0 +1,48 @@
+// tiled image container for images beyond the 16 bit tga dimensions
+// tiles are allocated on first write, unwritten tiles read as black
+
+#pragma once
+
+#include "tga.h"
+#include <stdint.h>
+#include <vector>
+
+namespace tiled {
+
+	class TiledImage
+	{
+	public:
+		TiledImage();
+		TiledImage(uint64_t width, uint64_t height, unsigned int bytesPerPixel, unsigned int tileSize = 512);
+
+		uint64_t width;
+		uint64_t height;
+		unsigned int bytesPerPixel;
+		unsigned int tileSize;			// edge length of a square tile in pixels
+		uint64_t tilesX;
+		uint64_t tilesY;
+
+		// NULL for tiles that were never written
+		const unsigned char * tile(uint64_t tx, uint64_t ty) const;
+		// allocates the tile on first access
+		unsigned char * tile(uint64_t tx, uint64_t ty);
+
+		// copy a w x h pixel region to / from a tightly packed buffer
+		// pixels outside the image read as 0 and are ignored on write
+		void readRegion(int64_t x, int64_t y, uint64_t w, uint64_t h, unsigned char * dst) const;
+		void writeRegion(int64_t x, int64_t y, uint64_t w, uint64_t h, const unsigned char * src);
+
+		static TiledImage FromTGA(const tga::TGAImage& image, unsigned int tileSize = 512);
+		// straight from a mapped file, the pixels stay in file order (BGR(A))
+		static TiledImage FromView(const tga::TGAView& view, unsigned int tileSize = 512);
+		// fails for images that don't fit into a tga (65535 x 65535)
+		bool ToTGA(tga::TGAImage * image) const;
+
+	private:
+		std::vector<std::vector<unsigned char> > tiles;
+	};
+
+	// 2x2 box filter of a packed w x h region, odd edges average the pixels that exist
+	void Downsample(const unsigned char * src, uint64_t w, uint64_t h, unsigned int bytesPerPixel, std::vector<unsigned char>& dst);
+
+}
@@ -1,47 +1,49 @@
+// tuning constants, the host passes the actual values as -D build options
+#ifndef WARP_SHIFT
 #define WARP_SHIFT 4
+#endif
+#ifndef GRP_SHIFT
 #define GRP_SHIFT 8
-#define BANK_OFFSET(n) (((n) >> WARP_SHIFT) + ((n) >> GRP_SHIFT))
+#endif
+#ifndef SIZE_BLOCK
+#define SIZE_BLOCK 32
+#endif
+#ifndef ITEMS_PER_THREAD
+#define ITEMS_PER_THREAD 1
+#endif
+#ifndef ELEM_TYPE
+#define ELEM_TYPE int
+#endif
+
+// 0: greater, 1: smaller, 2: equals
+#ifndef PREDICATE_MODE
+#define PREDICATE_MODE 0
+#endif
+
+#if PREDICATE_MODE == 1
+#define PREDICATE(x, t) ((x) < (t))
+#elif PREDICATE_MODE == 2
+#define PREDICATE(x, t) ((x) == (t))
+#else
+#define PREDICATE(x, t) ((x) > (t))
+#endif
 
-__kernel void predicateKernel_greater(
-	__global const int* input, 
-	__global int* output, 
-	const int thresh)
-{
-	const int offset = get_group_id(0) * get_local_size(0);
-	const int lid = get_local_id(0);
-	output[lid + offset] = input[lid + offset] > thresh ? 1 : 0;
-}
-
-__kernel void predicateKernel_smaller(
-	__global const int* input,
-	__global int* output,
-	const int thresh)
-{
-	const int offset = get_group_id(0) * get_local_size(0);
-	const int lid = get_local_id(0);
-	output[lid + offset] = input[lid + offset] < thresh ? 1 : 0;
-}
-
-__kernel void predicateKernel_equals(
-	__global const int* input,
-	__global int* output,
-	const int thresh)
-{
-	const int offset = get_group_id(0) * get_local_size(0);
-	const int lid = get_local_id(0);
-	output[lid + offset] = input[lid + offset] == thresh ? 1 : 0;
-}
+#define BANK_OFFSET(n) (((n) >> WARP_SHIFT) + ((n) >> GRP_SHIFT))
 
 __kernel void ApplyGroupSums(
 	__global const int* input,
 	__global const int* sums,
-	__global int* output
+	__global int* output,
+	const int n
 )
 {
 	int gid = get_global_id(0);
 	int binId = get_group_id(0);
 
-	output[gid] = input[gid] + sums[binId];
+	if (gid < n)
+	{
+		output[gid] = input[gid] + sums[binId];
+	}
 }
 
 __kernel void blelloch(
@@ -130,28 +132,28 @@ __kernel void blelloch(
 
 // blellock without BC avoidance... somehow messes up my arrays
 // better it works slower then not at all...
+// one element per work item, elements past n scan as 0
 __kernel void blelloch_simple(
 	__global const int* input,
 	__global int* output,
 	__global int* groupSums,
 	__local int* temp,
-	uint bin_size
+	uint bin_size,
+	const int n
 )
 {
 	int gid = get_group_id(0);
 	int lid = get_local_id(0);
 
-	// sizes & offset
-	int size_local = get_local_size(0);
-	int size_global = get_global_size(0);
+	// sizes & offset, the local size is always SIZE_BLOCK so the sweeps unroll
+	const int size_local = SIZE_BLOCK;
 	int group_offset = gid * size_local;
 
-	// again... not sure why but everyone does it
-	temp[lid] = input[lid + group_offset];
-	temp[lid + 1] = input[lid + group_offset + 1];
+	temp[lid] = lid + group_offset < n ? input[lid + group_offset] : 0;
 
 	//upsweep
 	int offset = 1;
+	#pragma unroll
 	for (int d = size_local >> 1; d > 0; d >>= 1)
 	{
 		barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
@@ -174,6 +176,7 @@ __kernel void blelloch_simple(
 	}
 
 	//downsweep
+	#pragma unroll
 	for (int d = 1; d < size_local; d <<= 1)
 	{
 		offset >>= 1;
@@ -192,24 +195,524 @@ __kernel void blelloch_simple(
 
 	barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
 
-	// same as up there but with writing out
-	output[group_offset + lid] = temp[lid];
-	output[group_offset + lid + 1] = temp[lid + 1];
+	if (lid + group_offset < n)
+	{
+		output[group_offset + lid] = temp[lid];
+	}
+}
+
+// bitmask path, one bit per element packed into 32 bit words
+#define WORD_BITS 32
+
+// every group tests ITEMS_PER_THREAD * local size elements and ors the flags into local words,
+// each word is written with its popcount so the scan only runs over the word counts
+// the local size times ITEMS_PER_THREAD has to be a multiple of WORD_BITS
+__kernel void predicate_bits(
+	__global const ELEM_TYPE* input,
+	__global uint* bits,
+	__global int* counts,
+	__local uint* words,
+	const ELEM_TYPE thresh,
+	const int n)
+{
+	const int lid = get_local_id(0);
+	const int size = get_local_size(0);
+	const int groupWords = size * ITEMS_PER_THREAD / WORD_BITS;
+	const int first = get_group_id(0) * size * ITEMS_PER_THREAD;
+
+	for (int w = lid; w < groupWords; w += size)
+	{
+		words[w] = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	#pragma unroll
+	for (int k = 0; k < ITEMS_PER_THREAD; ++k)
+	{
+		const int j = k * size + lid;
+		if (first + j < n && PREDICATE(input[first + j], thresh))
+		{
+			atomic_or(&words[j / WORD_BITS], 1u << (j % WORD_BITS));
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	const int numWords = (n + WORD_BITS - 1) / WORD_BITS;
+	for (int w = lid; w < groupWords; w += size)
+	{
+		const int word = first / WORD_BITS + w;
+		if (word < numWords)
+		{
+			bits[word] = words[w];
+			counts[word] = popcount(words[w]);
+		}
+	}
+}
+
+// the address of a selected element is the offset of its word plus the set bits below it
+__kernel void scatter_bits(
+	__global const ELEM_TYPE* restrict input,
+	__global const uint* restrict bits,
+	__global const int* restrict wordOffsets,
+	__global ELEM_TYPE* output,
+	const int n)
+{
+	const int gid = get_global_id(0);
+	const int stride = get_global_size(0);
+	#pragma unroll
+	for (int k = 0; k < ITEMS_PER_THREAD; ++k)
+	{
+		const int i = gid + k * stride;
+		if (i < n)
+		{
+			const uint word = bits[i / WORD_BITS];
+			const uint bit = i % WORD_BITS;
+			if ((word >> bit) & 1)
+			{
+				output[wordOffsets[i / WORD_BITS] + popcount(word & ((1u << bit) - 1))] = input[i];
+			}
+		}
+	}
+}
+
+// histogram of [minValue, maxValue) in numBins equal bins, bin = (x - minValue) * scale
+// the difference is taken in float, in the int type it overflows for ranges wider than INT_MAX
+// every group counts into its own bins in local memory and merges them with one global atomic per bin
+__kernel void histogram(
+	__global const ELEM_TYPE* input,
+	__global uint* bins,
+	__local uint* localBins,
+	const ELEM_TYPE minValue,
+	const ELEM_TYPE maxValue,
+	const float scale,
+	const int numBins,
+	const int n)
+{
+	const int lid = get_local_id(0);
+	const int size = get_local_size(0);
+
+	for (int b = lid; b < numBins; b += size)
+	{
+		localBins[b] = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = get_global_id(0); i < n; i += get_global_size(0))
+	{
+		const ELEM_TYPE x = input[i];
+		if (x >= minValue && x < maxValue)
+		{
+			atomic_inc(&localBins[min((int)(((float)x - (float)minValue) * scale), numBins - 1)]);
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int b = lid; b < numBins; b += size)
+	{
+		if (localBins[b] != 0)
+		{
+			atomic_add(&bins[b], localBins[b]);
+		}
+	}
 }
 
-__kernel void scatter(
-	__global const int* restrict input,
+// run-length primitives, runs are maximal sequences of equal adjacent elements
+// flags the first element of every run, the exclusive scan of the flags is the run index
+__kernel void run_heads(
+	__global const ELEM_TYPE* input,
+	__global int* flags,
+	const int n)
+{
+	const int gid = get_global_id(0);
+	const int stride = get_global_size(0);
+	#pragma unroll
+	for (int k = 0; k < ITEMS_PER_THREAD; ++k)
+	{
+		const int i = gid + k * stride;
+		if (i < n)
+		{
+			flags[i] = i == 0 || input[i] != input[i - 1] ? 1 : 0;
+		}
+	}
+}
+
+// value and first index of every run
+__kernel void scatter_runs(
+	__global const ELEM_TYPE* restrict input,
+	__global const int* restrict flags,
 	__global const int* restrict addr,
-	__global const int* restrict mask,
-	__global int* output
-)
+	__global ELEM_TYPE* values,
+	__global int* starts,
+	const int n)
+{
+	const int gid = get_global_id(0);
+	const int stride = get_global_size(0);
+	#pragma unroll
+	for (int k = 0; k < ITEMS_PER_THREAD; ++k)
+	{
+		const int i = gid + k * stride;
+		if (i < n && flags[i] == 1)
+		{
+			values[addr[i]] = input[i];
+			starts[addr[i]] = i;
+		}
+	}
+}
+
+// length of every run from the start of the next one
+__kernel void run_lengths(
+	__global const int* starts,
+	__global int* lengths,
+	const int runs,
+	const int n)
+{
+	const int r = get_global_id(0);
+	if (r < runs)
+	{
+		lengths[r] = (r + 1 < runs ? starts[r + 1] : n) - starts[r];
+	}
+}
+
+// sum of the values of every run from the exclusive scan of the values
+__kernel void run_sums(
+	__global const int* starts,
+	__global const int* scan,
+	__global const int* values,
+	__global int* sums,
+	const int runs,
+	const int n)
+{
+	const int r = get_global_id(0);
+	if (r < runs)
+	{
+		const int end = r + 1 < runs ? scan[starts[r + 1]] : scan[n - 1] + values[n - 1];
+		sums[r] = end - scan[starts[r]];
+	}
+}
+
+// rle decode, every output element finds its run in the exclusive scan of the lengths
+__kernel void expand_runs(
+	__global const ELEM_TYPE* values,
+	__global const int* offsets,
+	__global ELEM_TYPE* output,
+	const int runs,
+	const int total)
+{
+	const int i = get_global_id(0);
+	if (i >= total)
+	{
+		return;
+	}
+	// last run starting at or before i
+	int lo = 0;
+	int hi = runs - 1;
+	while (lo < hi)
+	{
+		const int mid = (lo + hi + 1) >> 1;
+		if (offsets[mid] <= i)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+	output[i] = values[lo];
+}
+
+// batched compaction of many small arrays packed back to back, array a is [offsets[a], offsets[a + 1])
+// one work-group per array, every array is compacted to the front of its own range
+// chunks of local size elements are scanned in local memory, scan holds local size ints
+__kernel void compact_batch(
+	__global const ELEM_TYPE* input,
+	__global const int* offsets,
+	__global ELEM_TYPE* output,
+	__global int* counts,
+	__local int* scan,
+	const ELEM_TYPE thresh,
+	const int arrays)
 {
-	const int offset = get_group_id(0) * get_local_size(0);
 	const int lid = get_local_id(0);
+	const int size = get_local_size(0);
 
-	if (mask[lid + offset] == 1)
+	for (int a = get_group_id(0); a < arrays; a += get_num_groups(0))
 	{
-		output[addr[lid + offset]] = input[lid + offset];
+		const int begin = offsets[a];
+		const int end = offsets[a + 1];
+		int written = 0;
+		for (int base = begin; base < end; base += size)
+		{
+			const int i = base + lid;
+			const int flag = i < end && PREDICATE(input[i], thresh) ? 1 : 0;
+
+			// inclusive scan of the flags of this chunk
+			scan[lid] = flag;
+			barrier(CLK_LOCAL_MEM_FENCE);
+			for (int d = 1; d < size; d <<= 1)
+			{
+				const int t = lid >= d ? scan[lid - d] : 0;
+				barrier(CLK_LOCAL_MEM_FENCE);
+				scan[lid] += t;
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+			if (flag)
+			{
+				output[begin + written + scan[lid] - 1] = input[i];
+			}
+			written += scan[size - 1];
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+		if (lid == 0)
+		{
+			counts[a] = written;
+		}
+	}
+}
+
+// moves every compacted array from the front of its range to its packed output offset
+__kernel void pack_batch(
+	__global const ELEM_TYPE* compacted,
+	__global const int* offsets,
+	__global const int* outOffsets,
+	__global const int* counts,
+	__global ELEM_TYPE* output,
+	const int arrays)
+{
+	for (int a = get_group_id(0); a < arrays; a += get_num_groups(0))
+	{
+		const int from = offsets[a];
+		const int to = outOffsets[a];
+		for (int j = get_local_id(0); j < counts[a]; j += get_local_size(0))
+		{
+			output[to + j] = compacted[from + j];
+		}
 	}
 }
 
+// radix select, int keys are compared through their digits with the sign bit flipped
+// so the unsigned digit order is the signed key order, most significant digit first
+#define RADIX_BITS 8
+#define RADIX_BINS (1 << RADIX_BITS)
+
+inline uint radix_digit(const int key, const int shift)
+{
+	return (((uint)key ^ 0x80000000u) >> shift) & (RADIX_BINS - 1);
+}
+
+// histogram of one digit of the candidates, privatized per work-group like histogram
+__kernel void radix_histogram(
+	__global const int* keys,
+	__global uint* bins,
+	const int shift,
+	const int n)
+{
+	__local uint localBins[RADIX_BINS];
+	const int lid = get_local_id(0);
+	const int size = get_local_size(0);
+
+	for (int b = lid; b < RADIX_BINS; b += size)
+	{
+		localBins[b] = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = get_global_id(0); i < n; i += get_global_size(0))
+	{
+		atomic_inc(&localBins[radix_digit(keys[i], shift)]);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int b = lid; b < RADIX_BINS; b += size)
+	{
+		if (localBins[b] != 0)
+		{
+			atomic_add(&bins[b], localBins[b]);
+		}
+	}
+}
+
+// mode 0: digit > target (certainly in the result), mode 1: digit == target (still a candidate)
+__kernel void radix_flags(
+	__global const int* keys,
+	__global int* flags,
+	const int shift,
+	const uint target,
+	const int mode,
+	const int n)
+{
+	const int gid = get_global_id(0);
+	const int stride = get_global_size(0);
+	#pragma unroll
+	for (int k = 0; k < ITEMS_PER_THREAD; ++k)
+	{
+		const int i = gid + k * stride;
+		if (i < n)
+		{
+			const uint digit = radix_digit(keys[i], shift);
+			flags[i] = (mode == 0 ? digit > target : digit == target) ? 1 : 0;
+		}
+	}
+}
+
+// scatter of the flagged keys and their original positions behind the first base outputs
+// without indices the position is the element's own index
+__kernel void scatter_pairs(
+	__global const int* restrict keys,
+	__global const int* restrict indices,
+	__global const int* restrict addr,
+	__global const int* restrict flags,
+	__global int* outKeys,
+	__global int* outIndices,
+	const int base,
+	const int hasIndices,
+	const int n)
+{
+	const int gid = get_global_id(0);
+	const int stride = get_global_size(0);
+	#pragma unroll
+	for (int k = 0; k < ITEMS_PER_THREAD; ++k)
+	{
+		const int i = gid + k * stride;
+		if (i < n && flags[i] == 1)
+		{
+			outKeys[base + addr[i]] = keys[i];
+			outIndices[base + addr[i]] = hasIndices ? indices[i] : i;
+		}
+	}
+}
+
+// index mode of the bitmask path, writes the positions of the selected elements instead of their values
+__kernel void scatter_bits_indices(
+	__global const uint* restrict bits,
+	__global const int* restrict wordOffsets,
+	__global int* indices,
+	const int n)
+{
+	const int gid = get_global_id(0);
+	const int stride = get_global_size(0);
+	#pragma unroll
+	for (int k = 0; k < ITEMS_PER_THREAD; ++k)
+	{
+		const int i = gid + k * stride;
+		if (i < n)
+		{
+			const uint word = bits[i / WORD_BITS];
+			const uint bit = i % WORD_BITS;
+			if ((word >> bit) & 1)
+			{
+				indices[wordOffsets[i / WORD_BITS] + popcount(word & ((1u << bit) - 1))] = i;
+			}
+		}
+	}
+}
+
+// selected rows of every column in one launch, the index is loaded once per row
+// columns are stored one after the other, rows apart in table and count apart in output
+__kernel void gather_columns(
+	__global const ELEM_TYPE* restrict table,
+	__global const int* restrict indices,
+	__global ELEM_TYPE* output,
+	const int rows,
+	const int columns,
+	const int count)
+{
+	const int j = get_global_id(0);
+	if (j >= count)
+	{
+		return;
+	}
+	const int row = indices[j];
+	for (int c = 0; c < columns; ++c)
+	{
+		output[(size_t)c * count + j] = table[(size_t)c * rows + row];
+	}
+}
+
+// frame-of-reference packed input (hpc::PackedInts), every value is stored as value - base in width bits
+// value i of a block of PACK_LANES words is in word i % PACK_LANES at bit (i / PACK_LANES) * width
+#define PACK_LANES 4
+
+int unpack_value(__global const uint* packed, const int i, const int base, const int width)
+{
+	const int perBlock = PACK_LANES * (32 / width);
+	const int r = i % perBlock;
+	const uint word = packed[i / perBlock * PACK_LANES + r % PACK_LANES];
+	const uint mask = width == 32 ? 0xffffffffu : (1u << width) - 1;
+	return (int)(((word >> (r / PACK_LANES * width)) & mask) + (uint)base);
+}
+
+// predicate_bits reading the packed input, the values are unpacked in registers and never stored
+__kernel void predicate_packed(
+	__global const uint* packed,
+	__global uint* bits,
+	__global int* counts,
+	__local uint* words,
+	const int base,
+	const int width,
+	const int thresh,
+	const int n)
+{
+	const int lid = get_local_id(0);
+	const int size = get_local_size(0);
+	const int groupWords = size * ITEMS_PER_THREAD / WORD_BITS;
+	const int first = get_group_id(0) * size * ITEMS_PER_THREAD;
+
+	for (int w = lid; w < groupWords; w += size)
+	{
+		words[w] = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	#pragma unroll
+	for (int k = 0; k < ITEMS_PER_THREAD; ++k)
+	{
+		const int j = k * size + lid;
+		if (first + j < n && PREDICATE(unpack_value(packed, first + j, base, width), thresh))
+		{
+			atomic_or(&words[j / WORD_BITS], 1u << (j % WORD_BITS));
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	const int numWords = (n + WORD_BITS - 1) / WORD_BITS;
+	for (int w = lid; w < groupWords; w += size)
+	{
+		const int word = first / WORD_BITS + w;
+		if (word < numWords)
+		{
+			bits[word] = words[w];
+			counts[word] = popcount(words[w]);
+		}
+	}
+}
+
+// scatter_bits reading the packed input, only the selected values are unpacked
+__kernel void scatter_packed(
+	__global const uint* restrict packed,
+	const int base,
+	const int width,
+	__global const uint* restrict bits,
+	__global const int* restrict wordOffsets,
+	__global int* output,
+	const int n)
+{
+	const int gid = get_global_id(0);
+	const int stride = get_global_size(0);
+	#pragma unroll
+	for (int k = 0; k < ITEMS_PER_THREAD; ++k)
+	{
+		const int i = gid + k * stride;
+		if (i < n)
+		{
+			const uint word = bits[i / WORD_BITS];
+			const uint bit = i % WORD_BITS;
+			if ((word >> bit) & 1)
+			{
+				output[wordOffsets[i / WORD_BITS] + popcount(word & ((1u << bit) - 1))] = unpack_value(packed, i, base, width);
+			}
+		}
+	}
+}
+
+
@@ -20,36 +20,89 @@
 #include <math.h>
 #include <chrono>
 #include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "../HighPerformanceComputing/device_select.h"
+#include "../HighPerformanceComputing/program_cache.h"
+#include "../HighPerformanceComputing/tuning.h"
+#include "../HighPerformanceComputing/work_queue.h"
+#include "../HighPerformanceComputing/span.h"
+#include "../HighPerformanceComputing/compute_service.h"
+#include "../HighPerformanceComputing/bit_pack.h"
+#include "main.h"
+#include <sstream>
+#include "kernel_cl.h"
 
 
 // CONST
-const std::string KERNEL_FILE = "kernel.cl";
-const int SIZE_BLOCK = 32;
-const int SIZE_WG = 1024;
+// digit width of the radix select, RADIX_BITS in kernel.cl
+const int RADIX_BITS = 8;
+// baked into the kernels as -D build options
+const int WARP_SHIFT = 4;
+const int GRP_SHIFT = 8;
+const std::string ELEM_TYPE = "int";
+// bits per predicate mask word, WORD_BITS in kernel.cl
+const int MASK_WORD_BITS = 32;
+// smallest chunk of the heterogeneous scheduler, below this a launch costs more than it saves
+const int MIN_CHUNK = 4096;
+
+// kernel configuration, also baked in as -D build options
+// the defaults are replaced by the per-device tuning file (--autotune)
+struct KernelConfig
+{
+	int sizeBlock;			// scan work-group size, power of two
+	int sizeWG;			// predicate and scatter work-group size
+	int itemsPerThread;		// elements per work item in the bitmask predicate and scatter
+};
 
 // GLOBAL VARS
 cl_int err = CL_SUCCESS;
+KernelConfig config = { 32, 256, 4 };
 
-std::vector<cl::Platform> all_platforms;
 std::vector<cl::Device> devices;
 cl::Device default_device;
 cl::Platform platform;
 cl::Context context;
 cl::Program program;
+hpc::ProgramVariants programVariants(KERNEL_SOURCE);
+std::vector<double> deviceWeights;
 
 // FUNCTION HEADER
-struct PrefixSumResult
-{
-	std::vector<int> result;
-	std::vector<int> groupSums;
-};
-std::vector<int> stream_compaction_GPU(std::vector<int> input, int threshold);
-std::vector<int> stream_compaction_SEQ(std::vector<int> input, int threshold);
-std::vector<int> strComGPU_Step1_Filter(std::vector<int> input, const int threshold, const std::string predicateKernel);
-std::vector<int> strComGPU_Step2_PrefixSum(std::vector<int> input);
-std::vector<int> strComGPU_Step3_Scatter(std::vector<int> input, std::vector<int> addr, std::vector<int> mask);
-PrefixSumResult CalcPrefixSum(std::vector<int> input);
-std::vector<int> ApplyGroupSums(std::vector<int> input, std::vector<int> groupSums);
+// the host APIs are declared in main.h
+// device steps, they enqueue on the caller's queue and keep every intermediate on the device
+void strComGPU_Step2_PrefixSum(cl::CommandQueue& queue, const cl::Buffer& input, const cl::Buffer& output, size_t n);
+void strComGPU_Step1_FilterBits(cl::CommandQueue& queue, const cl::Buffer& input, const cl::Buffer& bits, const cl::Buffer& counts, size_t n, const int threshold, const PredicateMode predicate);
+void strComGPU_Step3_ScatterBits(cl::CommandQueue& queue, const cl::Buffer& input, const cl::Buffer& bits, const cl::Buffer& wordOffsets, const cl::Buffer& output, size_t n);
+void strComGPU_Step1_FilterPacked(cl::CommandQueue& queue, const cl::Buffer& packed, int base, int width, const cl::Buffer& bits, const cl::Buffer& counts, size_t n, const int threshold, const PredicateMode predicate);
+void strComGPU_Step3_ScatterPacked(cl::CommandQueue& queue, const cl::Buffer& packed, int base, int width, const cl::Buffer& bits, const cl::Buffer& wordOffsets, const cl::Buffer& output, size_t n);
+void CalcPrefixSum(cl::CommandQueue& queue, const cl::Buffer& input, const cl::Buffer& output, const cl::Buffer& groupSums, size_t n);
+void ApplyGroupSums(cl::CommandQueue& queue, const cl::Buffer& data, const cl::Buffer& groupOffsets, size_t n);
+// histogram of [minValue, maxValue) with bins.size() equal bins, values outside are not counted
+void histogram_GPU(hpc::Span<const int> input, hpc::Span<unsigned int> bins, int minValue, int maxValue, const cl::Device& device);
+void histogram_CPU(hpc::Span<const int> input, hpc::Span<unsigned int> bins, int minValue, int maxValue);
+int ThresholdForSelectivity(hpc::Span<const unsigned int> bins, int minValue, int maxValue, double selectivity);
+// many small arrays packed back to back, array a is input[offsets[a], offsets[a + 1])
+// every array is compacted on its own, outOffsets and counts receive one entry per array,
+// output needs room for input.size() elements, returns the total number of elements written
+size_t stream_compaction_BATCH(hpc::Span<const int> input, hpc::Span<const int> offsets, hpc::Span<int> output,
+	hpc::Span<int> outOffsets, hpc::Span<int> counts, int threshold, const cl::Device& device);
+// the host APIs without the error handling, cl::Error reaches callers that can recover from it
+size_t strComGPU_Compact(hpc::Span<const int> input, hpc::Span<int> output, int threshold, const cl::Device& device, TransferEncoding encoding = TRANSFER_PLAIN);
+size_t strComGPU_CompactBatch(hpc::Span<const int> input, hpc::Span<const int> offsets, hpc::Span<int> output,
+	hpc::Span<int> outOffsets, hpc::Span<int> counts, int threshold, const cl::Device& device);
+void strComGPU_Scan(hpc::Span<const int> input, hpc::Span<int> output, const cl::Device& device);
+// k largest values of the input in no particular order, indices (empty or k entries) receives
+// their positions, returns min(k, input.size()) or 0 if the device failed
+size_t top_k_GPU(hpc::Span<const int> input, size_t k, hpc::Span<int> values, hpc::Span<int> indices, const cl::Device& device);
+// k-th largest value of the input into kth, 1 <= k <= input.size(), false if the device failed
+bool select_kth_GPU(hpc::Span<const int> input, size_t k, int * kth, const cl::Device& device);
+int strComGPU_RadixSelect(cl::CommandQueue& queue, const cl::Device& device, const cl::Buffer& keys, size_t n, size_t k, const cl::Buffer& resultKeys, const cl::Buffer& resultIndices);
+size_t strComGPU_FindRuns(cl::CommandQueue& queue, const cl::Buffer& keys, const cl::Buffer& runKeys, const cl::Buffer& runStarts, size_t n);
+cl::Program ProgramVariant(const PredicateMode predicate);
+int Autotune(hpc::Tuning& tuning);
+int Serve(const std::string& socketPath);
 
 
 
@@ -70,6 +123,11 @@ void Errorhandling(cl::Error err)
 		<< std::endl;
 }
 
+size_t RoundUp(size_t n, size_t multiple)
+{
+	return (n + multiple - 1) / multiple * multiple;
+}
+
 std::vector<int> generateRandomInput(int size)
 {
 	srand(time(NULL));
@@ -81,24 +139,20 @@ std::vector<int> generateRandomInput(int size)
 	return result;
 }
 
-int main(int argc, const char** argv)
+bool InitOpenCL(hpc::Tuning& tuning)
 {
-
-	// OPENCL INIT
-	cl::Platform::get(&all_platforms);
-	if (all_platforms.size() == 0)
-	{
-		std::cout << " No platforms found. Check OpenCL installation!\n";
-		return err;
-	}
-	else if (all_platforms.size() == 1)
+	// compaction is bandwidth bound, pick the device with the best memory throughput
+	hpc::DeviceScore selected;
+	try
 	{
-		platform = all_platforms[0];
+		selected = hpc::SelectDevice(hpc::WORKLOAD_MEMORY);
 	}
-	else
+	catch (cl::Error)
 	{
-		platform = all_platforms[1];
+		std::cout << " No platforms found. Check OpenCL installation!\n";
+		return false;
 	}
+	platform = selected.platform;
 
 	cl_context_properties properties[] =
 	{ CL_CONTEXT_PLATFORM, (cl_context_properties)(platform)(), 0 };
@@ -106,23 +160,56 @@ int main(int argc, const char** argv)
 
 	devices = context.getInfo<CL_CONTEXT_DEVICES>();
 
-	default_device = devices[0];
+	default_device = selected.device;
+
+	// share of every device when the work is split, by measured bandwidth
+	deviceWeights = hpc::DeviceWeights(devices, hpc::WORKLOAD_MEMORY);
+
+	// tuned configuration of this device, clamped in case the file is from other drivers
+	// and to the smallest device since the same programs run everywhere
+	tuning = hpc::Tuning::Load(default_device);
+	int maxWG = (int)default_device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+	for (size_t i = 0; i < devices.size(); ++i)
+	{
+		maxWG = std::min(maxWG, (int)devices[i].getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+	}
+	config.sizeBlock = std::min(tuning.get("compaction.size_block", config.sizeBlock), maxWG);
+	config.sizeWG = std::min(tuning.get("compaction.wg_size", config.sizeWG), maxWG);
+	config.itemsPerThread = std::max(tuning.get("compaction.items_per_thread", config.itemsPerThread), 1);
+
+	try
+	{
+		// build the embedded kernel, the scan and scatter kernels are the same in every variant
+		program = ProgramVariant(PREDICATE_GREATER);
+	}
+	catch (cl::Error err)
+	{
+		Errorhandling(err);
+		return false;
+	}
+	return true;
+}
+
+#ifndef STREAM_COMPACTION_NO_MAIN
+int main(int argc, const char** argv)
+{
+	// OPENCL INIT
+	hpc::Tuning tuning;
+	if (!InitOpenCL(tuning))
+		return 1;
 
 	try
 	{
-		// load and build the kernel
-		std::ifstream sourceFile(KERNEL_FILE);
-		if (!sourceFile)
+		if (argc > 1 && std::string(argv[1]) == "--autotune")
+		{
+			return Autotune(tuning);
+		}
+
+		// --serve [socket] keeps the context and programs warm and takes jobs until shut down
+		if (argc > 1 && std::string(argv[1]) == "--serve")
 		{
-			std::cout << "kernel source file " << KERNEL_FILE << " not found!" << std::endl;
-			return 1;
+			return Serve(argc > 2 ? argv[2] : hpc::DefaultSocketPath("compaction"));
 		}
-		std::string sourceCode(
-			std::istreambuf_iterator<char>(sourceFile),
-			(std::istreambuf_iterator<char>()));
-		cl::Program::Sources source(1, std::make_pair(sourceCode.c_str(), sourceCode.length() + 1));
-		program = cl::Program(context, source);
-		program.build(devices);
 
 
 		int testSize = 1024;
@@ -131,12 +218,21 @@ int main(int argc, const char** argv)
 		std::cout << "Generating testinput size = " << testSize << std::endl << std::endl;
 		std::vector<int> input = generateRandomInput(testSize);
 
+		// pick the threshold from the value distribution, keeping about half of the input
+		std::vector<unsigned int> bins(10);
+		histogram_GPU(input, bins, 0, 10, default_device);
+		std::cout << "Histogram:";
+		for (size_t b = 0; b < bins.size(); ++b)
+			std::cout << " " << bins[b];
+		int threshold = ThresholdForSelectivity(bins, 0, 10, 0.5);
+		std::cout << std::endl << "Threshold for 50% selectivity = " << threshold << std::endl << std::endl;
+
 		std::cout << "Starting sequential algorithm..." << std::endl;
 		
 		auto timer_start = std::chrono::high_resolution_clock::now();
 
 		// SEQUENTIAL
-		auto output_SEQ = stream_compaction_GPU(input, 5);
+		auto output_SEQ = stream_compaction_GPU(input, threshold, default_device);
 
 		auto timer_end = std::chrono::high_resolution_clock::now();
 		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(timer_end - timer_start).count();
@@ -145,14 +241,113 @@ int main(int argc, const char** argv)
 		std::cout << "Starting OpenGL algorithm..." << std::endl;
 		timer_start = std::chrono::high_resolution_clock::now();
 
-		// GPU
-		auto output_GPU = stream_compaction_GPU(input, 5);
+		// GPU, split across every device of the context if there are several
+		// --hetero shares the work dynamically between the devices and host threads
+		bool hetero = argc > 1 && std::string(argv[1]) == "--hetero";
+		std::vector<int> output_GPU(input.size());
+		size_t count = hetero ? stream_compaction_HETERO(input, output_GPU, threshold)
+			: devices.size() > 1 ? stream_compaction_MULTI(input, output_GPU, threshold) : stream_compaction_GPU(input, output_GPU, threshold, default_device);
+		output_GPU.resize(count);
 
 		timer_end = std::chrono::high_resolution_clock::now();
 		elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(timer_end - timer_start).count();
 		
 		std::cout << "OpenGL algorithm finished! (include overhead) Time(ms) = " << elapsed << std::endl << std::endl;
 
+		// the same compaction with the input bit-packed for the upload
+		int packedBase;
+		const int packedWidth = hpc::PackedWidth(input, &packedBase);
+		std::vector<int> output_PACKED(input.size());
+		output_PACKED.resize(stream_compaction_GPU(input, output_PACKED, threshold, default_device, TRANSFER_PACKED));
+		std::cout << "Packed transfer: " << packedWidth << " bits per value, "
+			<< sizeof(cl_uint) * hpc::PackedWords(input.size(), packedWidth) << " of " << sizeof(cl_int) * input.size() << " bytes, "
+			<< (output_PACKED == output_GPU ? "matches" : "differs") << std::endl;
+
+		// a table of the input, its positions and its negation filtered by the input column
+		const size_t COLUMNS = 3;
+		std::vector<int> table(input.size() * COLUMNS), filtered(input.size() * COLUMNS);
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			table[i] = input[i];
+			table[input.size() + i] = (int)i;
+			table[2 * input.size() + i] = -input[i];
+		}
+		size_t rows = filter_table_GPU(input, table, COLUMNS, filtered, threshold, default_device);
+		bool tableValid = rows == output_GPU.size();
+		for (size_t j = 0; tableValid && j < rows; ++j)
+		{
+			int row = filtered[rows + j];
+			tableValid = filtered[j] == output_GPU[j] && input[row] == filtered[j] && filtered[2 * rows + j] == -input[row];
+		}
+		std::cout << "Table: " << rows << " of " << input.size() << " rows, " << (tableValid ? "matches" : "differs") << std::endl;
+
+		// positions of the selected elements against the sequential index list
+		std::vector<int> expectedIndices, selectedIndices(input.size());
+		for (int i = 0; i < testSize; ++i)
+		{
+			if (input[i] > threshold)
+				expectedIndices.push_back(i);
+		}
+		selectedIndices.resize(stream_compaction_INDICES(input, selectedIndices, threshold, default_device));
+		std::cout << "Indices: " << selectedIndices.size() << ", " << (selectedIndices == expectedIndices ? "matches" : "differs") << std::endl;
+
+		// the input as a batch of small arrays, checked against the sequential compaction of every array
+		const int BATCH_ARRAY = 100;
+		std::vector<int> batchOffsets;
+		for (int i = 0; i < testSize; i += BATCH_ARRAY)
+			batchOffsets.push_back(i);
+		batchOffsets.push_back(testSize);
+		const size_t arrays = batchOffsets.size() - 1;
+		std::vector<int> batchOutput(input.size()), batchOutOffsets(arrays), batchCounts(arrays);
+		stream_compaction_BATCH(input, batchOffsets, batchOutput, batchOutOffsets, batchCounts, threshold, default_device);
+		bool batchValid = true;
+		for (size_t a = 0; a < arrays; ++a)
+		{
+			std::vector<int> expected = stream_compaction_SEQ(hpc::Span<const int>(&input[batchOffsets[a]], batchOffsets[a + 1] - batchOffsets[a]), threshold);
+			batchValid = batchValid && expected.size() == (size_t)batchCounts[a]
+				&& std::equal(expected.begin(), expected.end(), batchOutput.begin() + batchOutOffsets[a]);
+		}
+		std::cout << "Batch: " << arrays << " arrays, " << (batchValid ? "matches" : "differs") << std::endl;
+
+		// largest values without sorting, and the threshold that keeps the top 10%
+		const size_t TOP_K = 5;
+		std::vector<int> topValues(TOP_K), topIndices(TOP_K);
+		size_t found = top_k_GPU(input, TOP_K, topValues, topIndices, default_device);
+		std::cout << "Top " << found << ":";
+		for (size_t i = 0; i < found; ++i)
+			std::cout << " " << topValues[i] << "@" << topIndices[i];
+		int topThreshold;
+		if (select_kth_GPU(input, (input.size() + 9) / 10, &topThreshold, default_device))
+			std::cout << std::endl << "Top 10% threshold = " << topThreshold << std::endl;
+		else
+			std::cout << std::endl << "Top 10% threshold failed" << std::endl;
+
+		// run-length round trip of the input
+		std::vector<int> runValues(input.size()), runLengths(input.size()), decoded(input.size());
+		size_t runs = rle_encode_GPU(input, runValues, runLengths, default_device);
+		size_t decodedSize = rle_decode_GPU(hpc::Span<const int>(&runValues[0], runs), hpc::Span<const int>(&runLengths[0], runs), decoded, default_device);
+		std::cout << "RLE: " << runs << " runs, decode " << (decodedSize == input.size() && decoded == input ? "matches" : "differs") << std::endl;
+
+		// unique and reduce by key over the input as keys, checked against a sequential pass over the runs
+		std::vector<int> keyValues(input.size()), expectedKeys, expectedSums;
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			keyValues[i] = (int)(i % 7) - 3;
+			if (i == 0 || input[i] != input[i - 1])
+			{
+				expectedKeys.push_back(input[i]);
+				expectedSums.push_back(0);
+			}
+			expectedSums.back() += keyValues[i];
+		}
+		std::vector<int> uniqueKeys(input.size()), runKeys(input.size()), runSums(input.size());
+		uniqueKeys.resize(unique_GPU(input, uniqueKeys, default_device));
+		size_t keyRuns = reduce_by_key_GPU(input, keyValues, runKeys, runSums, default_device);
+		runKeys.resize(keyRuns);
+		runSums.resize(keyRuns);
+		std::cout << "Unique: " << uniqueKeys.size() << " keys, " << (uniqueKeys == expectedKeys ? "matches" : "differs") << std::endl;
+		std::cout << "Reduce by key: " << keyRuns << " runs, " << (runKeys == expectedKeys && runSums == expectedSums ? "matches" : "differs") << std::endl << std::endl;
+
 		std::cin.get();
 	}
 	catch (cl::Error err)
@@ -160,239 +355,1167 @@ int main(int argc, const char** argv)
 		Errorhandling(err);
 	}
 }
+#endif
 
-std::vector<int> stream_compaction_SEQ(std::vector<int> input, int threshold)
+// one program per predicate and kernel configuration
+cl::Program ProgramVariant(const PredicateMode predicate)
 {
-	std::vector<int> result;
-	for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it)
+	std::ostringstream options;
+	options << "-DSIZE_BLOCK=" << config.sizeBlock
+		<< " -DITEMS_PER_THREAD=" << config.itemsPerThread
+		<< " -DWARP_SHIFT=" << WARP_SHIFT
+		<< " -DGRP_SHIFT=" << GRP_SHIFT
+		<< " -DELEM_TYPE=" << ELEM_TYPE
+		<< " -DPREDICATE_MODE=" << predicate;
+	return programVariants.get(context, devices, options.str());
+}
+
+// sweep the kernel configuration on the current device and keep the fastest in the tuning file
+// every configuration is checked against the sequential result before it is timed
+// the sizes are baked into the program, so it is rebuilt (or taken from the cache) on every change
+int Autotune(hpc::Tuning& tuning)
+{
+	const int REPEAT = 3;
+	const int maxWG = (int)default_device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+	std::vector<int> input = generateRandomInput(1 << 20);
+	std::vector<int> expected = stream_compaction_SEQ(input, 5);
+
+	std::cout << "Autotuning " << default_device.getInfo<CL_DEVICE_NAME>() << std::endl;
+
+	// scan block size, timed on the predicate mask the compaction scans
+	std::vector<int> mask(input.size());
+	std::vector<int> expectedScan(input.size());
+	for (size_t i = 0, sum = 0; i < input.size(); ++i)
+	{
+		mask[i] = input[i] > 5 ? 1 : 0;
+		expectedScan[i] = (int)sum;
+		sum += mask[i];
+	}
+	std::vector<int> scan(input.size());
+	KernelConfig best = config;
+	double bestMs = -1.0;
+	for (int block = 32; block <= std::min(1024, maxWG); block *= 2)
+	{
+		config.sizeBlock = block;
+		program = ProgramVariant(PREDICATE_GREATER);
+		strComGPU_PrefixSum(mask, scan, default_device);
+		bool valid = scan == expectedScan;
+		double ms = valid ? hpc::TimeBestOf([&]() { strComGPU_PrefixSum(mask, scan, default_device); }, REPEAT) : -1.0;
+		std::cout << "  scan block " << block << ": " << (ms < 0.0 ? std::string("invalid") : std::to_string(ms) + " ms") << std::endl;
+		if (ms >= 0.0 && (bestMs < 0.0 || ms < bestMs))
+		{
+			bestMs = ms;
+			best.sizeBlock = block;
+		}
+	}
+	config.sizeBlock = best.sizeBlock;
+
+	// predicate and scatter shape, timed on the whole compaction
+	std::vector<int> output(input.size());
+	const int ITEMS[] = { 1, 2, 4, 8 };
+	bestMs = -1.0;
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int wg = 64; wg <= std::min(1024, maxWG); wg *= 2)
+		{
+			config.itemsPerThread = ITEMS[i];
+			config.sizeWG = wg;
+			program = ProgramVariant(PREDICATE_GREATER);
+			size_t count = stream_compaction_GPU(input, output, 5, default_device);
+			bool valid = count == expected.size() && std::equal(expected.begin(), expected.end(), output.begin());
+			double ms = valid ? hpc::TimeBestOf([&]() { stream_compaction_GPU(input, output, 5, default_device); }, REPEAT) : -1.0;
+			std::cout << "  compaction wg " << wg << " x " << ITEMS[i] << " items: "
+				<< (ms < 0.0 ? std::string("invalid") : std::to_string(ms) + " ms") << std::endl;
+			if (ms >= 0.0 && (bestMs < 0.0 || ms < bestMs))
+			{
+				bestMs = ms;
+				best.sizeWG = wg;
+				best.itemsPerThread = ITEMS[i];
+			}
+		}
+	}
+	config = best;
+	program = ProgramVariant(PREDICATE_GREATER);
+
+	tuning.set("compaction.size_block", config.sizeBlock);
+	tuning.set("compaction.wg_size", config.sizeWG);
+	tuning.set("compaction.items_per_thread", config.itemsPerThread);
+	if (!tuning.save())
+	{
+		std::cout << "Could not write " << tuning.file() << std::endl;
+		return 1;
+	}
+	std::cout << "Scan block " << config.sizeBlock << ", compaction wg " << config.sizeWG << " x "
+		<< config.itemsPerThread << " items written to " << tuning.file() << std::endl;
+	return 0;
+}
+
+// daemon mode, jobs that arrive together are packed into one batched launch
+// the handlers use the throwing variants, a device error fails the batch with status -3
+// "compaction": int input, params[0] threshold, output receives the selected elements, values[0] their count
+// "scan": int input, output receives the exclusive prefix sum
+int Serve(const std::string& socketPath)
+{
+	hpc::ComputeService service;
+	service.handle("compaction", [](std::vector<hpc::Job*>& batch)
+	{
+		// one batched compaction per threshold
+		std::map<int, std::vector<hpc::Job*> > byThreshold;
+		for (size_t i = 0; i < batch.size(); ++i)
+			byThreshold[batch[i]->params[0]].push_back(batch[i]);
+
+		for (std::map<int, std::vector<hpc::Job*> >::iterator it = byThreshold.begin(); it != byThreshold.end(); ++it)
+		{
+			std::vector<hpc::Job*>& jobs = it->second;
+			std::vector<int> packed, offsets(1, 0);
+			for (size_t j = 0; j < jobs.size(); ++j)
+			{
+				const int* in = (const int*)jobs[j]->input;
+				packed.insert(packed.end(), in, in + jobs[j]->inputBytes / sizeof(int));
+				offsets.push_back((int)packed.size());
+			}
+			std::vector<int> output(packed.size()), outOffsets(jobs.size()), counts(jobs.size());
+			strComGPU_CompactBatch(packed, offsets, output, outOffsets, counts, it->first, default_device);
+
+			for (size_t j = 0; j < jobs.size(); ++j)
+			{
+				size_t bytes = std::min(jobs[j]->outputBytes, sizeof(int) * counts[j]);
+				if (bytes > 0)
+					memcpy(jobs[j]->output, &output[outOffsets[j]], bytes);
+				jobs[j]->reply.values[0] = counts[j];
+			}
+		}
+	});
+	service.handle("scan", [](std::vector<hpc::Job*>& batch)
+	{
+		// one scan over all inputs, every job's part is shifted back to start at 0
+		std::vector<int> packed;
+		std::vector<size_t> starts;
+		for (size_t j = 0; j < batch.size(); ++j)
+		{
+			const int* in = (const int*)batch[j]->input;
+			starts.push_back(packed.size());
+			packed.insert(packed.end(), in, in + batch[j]->inputBytes / sizeof(int));
+		}
+		std::vector<int> scan(packed.size());
+		strComGPU_Scan(packed, scan, default_device);
+
+		for (size_t j = 0; j < batch.size(); ++j)
+		{
+			size_t n = std::min(batch[j]->inputBytes, batch[j]->outputBytes) / sizeof(int);
+			int* out = (int*)batch[j]->output;
+			for (size_t i = 0; i < n; ++i)
+				out[i] = (int)((unsigned int)scan[starts[j] + i] - (unsigned int)scan[starts[j]]);
+		}
+	});
+	return service.serve(socketPath);
+}
+
+// every device compacts its own range of the input into the same range of the output,
+// the gaps between the parts are closed in order afterwards
+size_t stream_compaction_MULTI(hpc::Span<const int> input, hpc::Span<int> output, int threshold)
+{
+	assert(output.size() >= input.size());
+	std::vector<size_t> bounds = hpc::SplitRange(input.size(), deviceWeights, config.sizeBlock);
+	std::vector<size_t> counts(devices.size(), 0);
+	std::vector<std::thread> workers;
+	for (size_t d = 0; d < devices.size(); ++d)
+	{
+		if (bounds[d] == bounds[d + 1])
+			continue;
+		workers.push_back(std::thread([&, d]()
+		{
+			size_t length = bounds[d + 1] - bounds[d];
+			counts[d] = stream_compaction_GPU(input.subspan(bounds[d], length), output.subspan(bounds[d], length), threshold, devices[d]);
+		}));
+	}
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	size_t count = 0;
+	for (size_t d = 0; d < counts.size(); ++d)
+	{
+		if (counts[d] > 0 && bounds[d] != count)
+			std::memmove(output.data() + count, output.data() + bounds[d], sizeof(int) * counts[d]);
+		count += counts[d];
+	}
+	return count;
+}
+
+// exclusive prefix sum with every device scanning its own range
+void strComGPU_PrefixSum_MULTI(hpc::Span<const int> input, hpc::Span<int> output)
+{
+	assert(output.size() >= input.size());
+	std::vector<size_t> bounds = hpc::SplitRange(input.size(), deviceWeights, config.sizeBlock);
+	std::vector<std::thread> workers;
+	for (size_t d = 0; d < devices.size(); ++d)
+	{
+		if (bounds[d] == bounds[d + 1])
+			continue;
+		workers.push_back(std::thread([&, d]()
+		{
+			size_t length = bounds[d + 1] - bounds[d];
+			strComGPU_PrefixSum(input.subspan(bounds[d], length), output.subspan(bounds[d], length), devices[d]);
+		}));
+	}
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	// every range was scanned from 0, shift it by the total of the ranges before it
+	int offset = 0;
+	for (size_t d = 0; d + 1 < bounds.size(); ++d)
+	{
+		if (bounds[d] == bounds[d + 1])
+			continue;
+		int total = output[bounds[d + 1] - 1] + input[bounds[d + 1] - 1];
+		for (size_t i = bounds[d]; i < bounds[d + 1]; ++i)
+			output[i] += offset;
+		offset += total;
+	}
+}
+
+// every device and the remaining host threads pull chunks from a shared queue,
+// a chunk is compacted into its own range of the output and the gaps are closed in input order
+size_t stream_compaction_HETERO(hpc::Span<const int> input, hpc::Span<int> output, int threshold)
+{
+	assert(output.size() >= input.size());
+	std::mutex countsMutex;
+	std::map<size_t, size_t> counts;
+	std::vector<hpc::Worker> workers;
+	for (size_t d = 0; d < devices.size(); ++d)
+	{
+		hpc::Worker worker;
+		worker.name = devices[d].getInfo<CL_DEVICE_NAME>();
+		worker.process = [&, d](size_t begin, size_t end)
+		{
+			// throws on device errors, the chunk goes back to the queue for the other workers
+			size_t count = strComGPU_Compact(input.subspan(begin, end - begin), output.subspan(begin, end - begin), threshold, devices[d]);
+			std::lock_guard<std::mutex> lock(countsMutex);
+			counts[begin] = count;
+		};
+		workers.push_back(worker);
+	}
+	unsigned int hostThreads = std::thread::hardware_concurrency();
+	hostThreads = hostThreads > devices.size() ? hostThreads - (unsigned int)devices.size() : 1;
+	for (unsigned int t = 0; t < hostThreads; ++t)
+	{
+		hpc::Worker worker;
+		worker.name = "host thread " + std::to_string(t);
+		worker.process = [&](size_t begin, size_t end)
+		{
+			size_t count = stream_compaction_SEQ(input.subspan(begin, end - begin), output.subspan(begin, end - begin), threshold);
+			std::lock_guard<std::mutex> lock(countsMutex);
+			counts[begin] = count;
+		};
+		workers.push_back(worker);
+	}
+
+	std::vector<hpc::WorkerStats> stats = hpc::RunWorkers(input.size(), workers, MIN_CHUNK, config.sizeBlock);
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		std::cout << "  " << stats[i].name << ": " << stats[i].items << " elements in "
+			<< stats[i].chunks << " chunks" << std::endl;
+	}
+
+	size_t count = 0;
+	for (std::map<size_t, size_t>::iterator it = counts.begin(); it != counts.end(); ++it)
+	{
+		if (it->second > 0 && it->first != count)
+			std::memmove(output.data() + count, output.data() + it->first, sizeof(int) * it->second);
+		count += it->second;
+	}
+	return count;
+}
+
+size_t stream_compaction_SEQ(hpc::Span<const int> input, hpc::Span<int> output, int threshold)
+{
+	size_t count = 0;
+	for (const int* it = input.begin(); it != input.end(); ++it)
 	{
 		if (*it > threshold)
-			result.push_back(*it);
+			output[count++] = *it;
 	}
+	return count;
+}
+
+std::vector<int> stream_compaction_SEQ(hpc::Span<const int> input, int threshold)
+{
+	std::vector<int> result(input.size());
+	result.resize(stream_compaction_SEQ(input, result, threshold));
 	return result;
 }
 
-std::vector<int> stream_compaction_GPU(std::vector<int> input, int threshold)
+size_t stream_compaction_GPU(hpc::Span<const int> input, hpc::Span<int> output, int threshold, const cl::Device& device, TransferEncoding encoding)
+{
+	try
+	{
+		return strComGPU_Compact(input, output, threshold, device, encoding);
+	}
+	catch (cl::Error err)
+	{
+		Errorhandling(err);
+		return 0;
+	}
+}
+
+size_t strComGPU_Compact(hpc::Span<const int> input, hpc::Span<int> output, int threshold, const cl::Device& device, TransferEncoding encoding)
 {
 	// !! ask prof !!
 	// since handling everything inside one kernel doesn't work... split it
 	// probably slower but i can't figure out why this won't work otherwise
 	// !! ask prof !!
 
-	//Filter - gets condition vector
-	std::vector<int> filterResult = strComGPU_Step1_Filter(input, threshold, "predicateKernel_greater");
+	assert(output.size() >= input.size());
+	if (input.empty())
+		return 0;
+
+	const size_t n = input.size();
+	const size_t words = (n + MASK_WORD_BITS - 1) / MASK_WORD_BITS;
+	cl::CommandQueue queue(context, device, 0, &err);
+	// create buffers on device (allocate space on GPU), only the input goes up and the selected elements come back
+	// the mask is one bit per element, the scan runs over the popcount of every mask word
+	// a packed input goes up in width bits per value, a full-width one isn't worth unpacking
+	hpc::PackedInts packed;
+	if (encoding == TRANSFER_PACKED)
+	{
+		int base;
+		const int width = hpc::PackedWidth(input, &base);
+		if (width == 32)
+			encoding = TRANSFER_PLAIN;
+		else
+			hpc::Pack(input, width, base, packed);
+	}
+	const bool isPacked = encoding == TRANSFER_PACKED;
+	const size_t inputBytes = isPacked ? sizeof(cl_uint) * packed.words.size() : sizeof(cl_int) * n;
+	cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, inputBytes);
+	cl::Buffer buffer_BITS(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * words);
+	cl::Buffer buffer_COUNTS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * words);
+	cl::Buffer buffer_OFFSETS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * words);
+	cl::Buffer buffer_OUTPUT(context, CL_MEM_WRITE_ONLY, sizeof(cl_int) * n);
+
+	queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, inputBytes, isPacked ? (const void *)&packed.words[0] : (const void *)input.data());
+
+	//Filter - gets condition bitmask and the count of every word
+	if (isPacked)
+		strComGPU_Step1_FilterPacked(queue, buffer_INPUT, packed.base, packed.width, buffer_BITS, buffer_COUNTS, n, threshold, PREDICATE_GREATER);
+	else
+		strComGPU_Step1_FilterBits(queue, buffer_INPUT, buffer_BITS, buffer_COUNTS, n, threshold, PREDICATE_GREATER);
 
-	//Scan - build prefix sum for condition vector
-	std::vector<int> filterAddresses = strComGPU_Step2_PrefixSum(filterResult);
+	//Scan - build prefix sum over the word counts
+	strComGPU_Step2_PrefixSum(queue, buffer_COUNTS, buffer_OFFSETS, words);
 
 	//Scatter
-	std::vector<int> scatterResult = strComGPU_Step3_Scatter(input, filterAddresses, filterResult);
+	if (isPacked)
+		strComGPU_Step3_ScatterPacked(queue, buffer_INPUT, packed.base, packed.width, buffer_BITS, buffer_OFFSETS, buffer_OUTPUT, n);
+	else
+		strComGPU_Step3_ScatterBits(queue, buffer_INPUT, buffer_BITS, buffer_OFFSETS, buffer_OUTPUT, n);
 
-	return scatterResult;
+	// count = last word offset + last word count, only the first count elements were written
+	cl_int last[2];
+	queue.enqueueReadBuffer(buffer_OFFSETS, CL_FALSE, sizeof(cl_int) * (words - 1), sizeof(cl_int), &last[0]);
+	queue.enqueueReadBuffer(buffer_COUNTS, CL_TRUE, sizeof(cl_int) * (words - 1), sizeof(cl_int), &last[1]);
+	const size_t count = (size_t)(last[0] + last[1]);
+	if (count > 0)
+		queue.enqueueReadBuffer(buffer_OUTPUT, CL_TRUE, 0, sizeof(cl_int) * count, output.data());
 
+	return count;
 }
 
-std::vector<int> strComGPU_Step1_Filter(std::vector<int> input, const int threshold, const std::string predicateKernel)
+std::vector<int> stream_compaction_GPU(hpc::Span<const int> input, int threshold, const cl::Device& device)
 {
-
 	std::vector<int> result(input.size());
+	result.resize(stream_compaction_GPU(input, result, threshold, device));
+	return result;
+}
 
+// exclusive prefix sum of a host array on one device
+void strComGPU_PrefixSum(hpc::Span<const int> input, hpc::Span<int> output, const cl::Device& device)
+{
 	try
 	{
-		cl::CommandQueue queue(context, default_device, 0, &err);
-		// create buffers on device (allocate space on GPU)
+		strComGPU_Scan(input, output, device);
+	}
+	catch (cl::Error err)
+	{
+		Errorhandling(err);
+	}
+}
+
+void strComGPU_Scan(hpc::Span<const int> input, hpc::Span<int> output, const cl::Device& device)
+{
+	assert(output.size() >= input.size());
+	if (input.empty())
+		return;
+
+	cl::CommandQueue queue(context, device, 0, &err);
+	cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, sizeof(cl_int) * input.size());
+	cl::Buffer buffer_OUTPUT(context, CL_MEM_READ_WRITE, sizeof(cl_int) * input.size());
+
+	queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), input.data());
+	strComGPU_Step2_PrefixSum(queue, buffer_INPUT, buffer_OUTPUT, input.size());
+	queue.enqueueReadBuffer(buffer_OUTPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), output.data());
+}
+
+void strComGPU_Step2_PrefixSum(cl::CommandQueue& queue, const cl::Buffer& input, const cl::Buffer& output, size_t n)
+{
+	size_t groups = (n + config.sizeBlock - 1) / config.sizeBlock;
+	if (groups == 0)
+		groups = 1;
+
+	cl::Buffer buffer_GROUPSUMS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * groups);
+	CalcPrefixSum(queue, input, output, buffer_GROUPSUMS, n);
+	if (groups <= 1)
+		return;
+
+	// every block starts at the exclusive prefix sum of the block sums before it,
+	// recursing handles any number of blocks for any block size
+	cl::Buffer buffer_OFFSETS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * groups);
+	strComGPU_Step2_PrefixSum(queue, buffer_GROUPSUMS, buffer_OFFSETS, groups);
+
+	ApplyGroupSums(queue, output, buffer_OFFSETS, n);
+}
+
+void CalcPrefixSum(cl::CommandQueue& queue, const cl::Buffer& input, const cl::Buffer& output, const cl::Buffer& groupSums, size_t n)
+{
+	const std::string KERNEL = "blelloch_simple";
+	size_t groups = (n + config.sizeBlock - 1) / config.sizeBlock;
+	if (groups == 0)
+		groups = 1;
+
+	cl::Kernel kernel(program, KERNEL.c_str(), &err);
+
+	kernel.setArg(0, input);
+	kernel.setArg(1, output);
+	kernel.setArg(2, groupSums);
+	kernel.setArg(3, cl::LocalSpaceArg(cl::Local(sizeof(cl_int) * config.sizeBlock)));
+	kernel.setArg(4, config.sizeBlock);
+	kernel.setArg(5, (cl_int)n);
+
+	cl::NDRange global(groups * config.sizeBlock);
+	cl::NDRange local(config.sizeBlock);
+
+	queue.enqueueNDRangeKernel(kernel, 0, global, local);
+}
+
+// adds the offset of every block in place, each item reads and writes only its own element
+void ApplyGroupSums(cl::CommandQueue& queue, const cl::Buffer& data, const cl::Buffer& groupOffsets, size_t n)
+{
+	const std::string KERNEL = "ApplyGroupSums";
+
+	cl::Kernel kernel(program, KERNEL.c_str(), &err);
+
+	kernel.setArg(0, data);
+	kernel.setArg(1, groupOffsets);
+	kernel.setArg(2, data);
+	kernel.setArg(3, (cl_int)n);
+
+	cl::NDRange global(RoundUp(n, config.sizeBlock));
+	cl::NDRange local(config.sizeBlock);
+
+	queue.enqueueNDRangeKernel(kernel, 0, global, local);
+}
+
+// one bit per element, every work-group packs sizeWG * itemsPerThread elements into whole words
+void strComGPU_Step1_FilterBits(cl::CommandQueue& queue, const cl::Buffer& input, const cl::Buffer& bits, const cl::Buffer& counts, size_t n, const int threshold, const PredicateMode predicate)
+{
+	const size_t groupElements = (size_t)config.sizeWG * config.itemsPerThread;
+	assert(groupElements % MASK_WORD_BITS == 0);
+
+	cl::Kernel kernel(ProgramVariant(predicate), "predicate_bits", &err);
+
+	kernel.setArg(0, input);
+	kernel.setArg(1, bits);
+	kernel.setArg(2, counts);
+	kernel.setArg(3, cl::LocalSpaceArg(cl::Local(sizeof(cl_uint) * groupElements / MASK_WORD_BITS)));
+	kernel.setArg(4, threshold);
+	kernel.setArg(5, (cl_int)n);
+
+	cl::NDRange global((n + groupElements - 1) / groupElements * config.sizeWG);
+	cl::NDRange local(config.sizeWG);
+
+	queue.enqueueNDRangeKernel(kernel, 0, global, local);
+}
+
+void strComGPU_Step3_ScatterBits(cl::CommandQueue& queue, const cl::Buffer& input, const cl::Buffer& bits, const cl::Buffer& wordOffsets, const cl::Buffer& output, size_t n)
+{
+	const std::string KERNEL = "scatter_bits";
+
+	cl::Kernel kernel(program, KERNEL.c_str(), &err);
+
+	kernel.setArg(0, input);
+	kernel.setArg(1, bits);
+	kernel.setArg(2, wordOffsets);
+	kernel.setArg(3, output);
+	kernel.setArg(4, (cl_int)n);
+
+	cl::NDRange global(RoundUp((n + config.itemsPerThread - 1) / config.itemsPerThread, config.sizeWG));
+	cl::NDRange local(config.sizeWG);
+
+	queue.enqueueNDRangeKernel(kernel, 0, global, local);
+}
+
+// predicate_bits on a frame-of-reference packed input, same launch shape
+void strComGPU_Step1_FilterPacked(cl::CommandQueue& queue, const cl::Buffer& packed, int base, int width, const cl::Buffer& bits, const cl::Buffer& counts, size_t n, const int threshold, const PredicateMode predicate)
+{
+	const size_t groupElements = (size_t)config.sizeWG * config.itemsPerThread;
+	assert(groupElements % MASK_WORD_BITS == 0);
+
+	cl::Kernel kernel(ProgramVariant(predicate), "predicate_packed", &err);
+
+	kernel.setArg(0, packed);
+	kernel.setArg(1, bits);
+	kernel.setArg(2, counts);
+	kernel.setArg(3, cl::LocalSpaceArg(cl::Local(sizeof(cl_uint) * groupElements / MASK_WORD_BITS)));
+	kernel.setArg(4, base);
+	kernel.setArg(5, width);
+	kernel.setArg(6, threshold);
+	kernel.setArg(7, (cl_int)n);
+
+	cl::NDRange global((n + groupElements - 1) / groupElements * config.sizeWG);
+	cl::NDRange local(config.sizeWG);
+
+	queue.enqueueNDRangeKernel(kernel, 0, global, local);
+}
+
+void strComGPU_Step3_ScatterPacked(cl::CommandQueue& queue, const cl::Buffer& packed, int base, int width, const cl::Buffer& bits, const cl::Buffer& wordOffsets, const cl::Buffer& output, size_t n)
+{
+	cl::Kernel kernel(program, "scatter_packed", &err);
+
+	kernel.setArg(0, packed);
+	kernel.setArg(1, base);
+	kernel.setArg(2, width);
+	kernel.setArg(3, bits);
+	kernel.setArg(4, wordOffsets);
+	kernel.setArg(5, output);
+	kernel.setArg(6, (cl_int)n);
+
+	cl::NDRange global(RoundUp((n + config.itemsPerThread - 1) / config.itemsPerThread, config.sizeWG));
+	cl::NDRange local(config.sizeWG);
+
+	queue.enqueueNDRangeKernel(kernel, 0, global, local);
+}
+
+// bins are privatized per work-group in local memory, falls back to the host if they don't fit
+// bins per value of the histogram kernel, the range is taken in double so a full-range int column doesn't overflow
+float HistogramScale(size_t bins, int minValue, int maxValue)
+{
+	return (float)((double)bins / ((double)maxValue - (double)minValue));
+}
+
+void histogram_GPU(hpc::Span<const int> input, hpc::Span<unsigned int> bins, int minValue, int maxValue, const cl::Device& device)
+{
+	assert(!bins.empty() && maxValue > minValue);
+	if (sizeof(cl_uint) * bins.size() > device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+	{
+		histogram_CPU(input, bins, minValue, maxValue);
+		return;
+	}
+
+	std::fill(bins.begin(), bins.end(), 0u);
+	if (input.empty())
+		return;
+
+	try
+	{
+		cl::CommandQueue queue(context, device, 0, &err);
 		cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, sizeof(cl_int) * input.size());
-		cl::Buffer buffer_OUTPUT(context, CL_MEM_READ_WRITE, sizeof(cl_int) * input.size());
+		cl::Buffer buffer_BINS(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * bins.size());
 
-		// push write commands to queue
-		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), &input[0]);
+		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), input.data());
+		queue.enqueueWriteBuffer(buffer_BINS, CL_TRUE, 0, sizeof(cl_uint) * bins.size(), bins.data());
 
-		cl::Kernel kernel(program, predicateKernel.c_str(), &err);
+		cl::Kernel kernel(program, "histogram", &err);
 
 		kernel.setArg(0, buffer_INPUT);
-		kernel.setArg(1, buffer_OUTPUT);
-		kernel.setArg(2, threshold);
-
-		cl::NDRange global(input.size());
+		kernel.setArg(1, buffer_BINS);
+		kernel.setArg(2, cl::LocalSpaceArg(cl::Local(sizeof(cl_uint) * bins.size())));
+		kernel.setArg(3, minValue);
+		kernel.setArg(4, maxValue);
+		kernel.setArg(5, HistogramScale(bins.size(), minValue, maxValue));
+		kernel.setArg(6, (cl_int)bins.size());
+		kernel.setArg(7, (cl_int)input.size());
+
+		// a few groups per compute unit, every group loops over its share so the merge cost stays small
+		size_t groups = std::min(RoundUp(input.size(), config.sizeWG) / config.sizeWG,
+			(size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4);
+		cl::NDRange global(groups * config.sizeWG);
+		cl::NDRange local(config.sizeWG);
 
-		queue.enqueueNDRangeKernel(kernel, 0, global);
+		queue.enqueueNDRangeKernel(kernel, 0, global, local);
 
-		cl::Event readBufferEvent;
-		queue.enqueueReadBuffer(buffer_OUTPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), &result[0], NULL, &readBufferEvent);
-		readBufferEvent.wait();
+		queue.enqueueReadBuffer(buffer_BINS, CL_TRUE, 0, sizeof(cl_uint) * bins.size(), bins.data());
 	}
 	catch (cl::Error err)
 	{
 		Errorhandling(err);
+		histogram_CPU(input, bins, minValue, maxValue);
 	}
+}
 
-	return result;
+// every host thread counts its range into its own bins, merged at the end
+// uses the same bin arithmetic as the kernel so both give identical counts
+void histogram_CPU(hpc::Span<const int> input, hpc::Span<unsigned int> bins, int minValue, int maxValue)
+{
+	assert(!bins.empty() && maxValue > minValue);
+	const float scale = HistogramScale(bins.size(), minValue, maxValue);
+	const int numBins = (int)bins.size();
+
+	unsigned int threads = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<size_t> bounds = hpc::SplitRange(input.size(), std::vector<double>(threads, 1.0 / threads), 1);
+	std::vector<std::vector<unsigned int> > partial(threads, std::vector<unsigned int>(bins.size(), 0));
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < threads; ++t)
+	{
+		workers.push_back(std::thread([&, t]()
+		{
+			for (size_t i = bounds[t]; i < bounds[t + 1]; ++i)
+			{
+				int x = input[i];
+				if (x >= minValue && x < maxValue)
+					++partial[t][std::min((int)(((float)x - (float)minValue) * scale), numBins - 1)];
+			}
+		}));
+	}
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
 
+	std::fill(bins.begin(), bins.end(), 0u);
+	for (unsigned int t = 0; t < threads; ++t)
+	{
+		for (size_t b = 0; b < bins.size(); ++b)
+			bins[b] += partial[t][b];
+	}
 }
 
- //Idead for handling stuff over 1024 elements...
-//std::vector<int> CalcGroupSums(PrefixSumResult base)
-//{
-//	PrefixSumResult result = CalcPrefixSum(base.groupSums);
-//	if (result.groupSums.size() > 1)
-//	{
-//		result.groupSums = CalcGroupSums(result);
-//	}
-//	std::vector<int> groupSums(result.result.begin() + 1, result.result.end());
-//	groupSums.push_back(result.groupSums[0]);
-//
-//	std::vector<int> output = ApplyGroupSums(base.result, groupSums);
-//	return output;
-//}
-//
-//std::vector<int> strComGPU_Step2_PrefixSum(std::vector<int> input)
-//{
-//	PrefixSumResult sumResult_Base = CalcPrefixSum(input);
-//
-//	return CalcGroupSums(sumResult_Base);
-//}
-
-std::vector<int> strComGPU_Step2_PrefixSum(std::vector<int> input)
+// smallest bin edge where at most the given fraction of the counted values lies above it,
+// usable directly as the threshold of the greater-than predicate
+int ThresholdForSelectivity(hpc::Span<const unsigned int> bins, int minValue, int maxValue, double selectivity)
 {
-	PrefixSumResult sumResult_Base = CalcPrefixSum(input);
-	PrefixSumResult sumResult_GroupSums = CalcPrefixSum(sumResult_Base.groupSums);
+	size_t total = 0;
+	for (size_t b = 0; b < bins.size(); ++b)
+		total += bins[b];
 
-	std::vector<int> groupSums(sumResult_GroupSums.result.begin() + 1, sumResult_GroupSums.result.end());
-	groupSums.push_back(sumResult_GroupSums.groupSums[0]);
+	size_t above = 0;
+	for (size_t b = bins.size(); b > 0; --b)
+	{
+		if (above + bins[b - 1] > selectivity * total)
+		{
+			// values of bin b - 1 and below are dropped, its upper edge is the threshold
+			return (int)(minValue + std::ceil((double)b * ((double)maxValue - (double)minValue) / bins.size()) - 1);
+		}
+		above += bins[b - 1];
+	}
+	return minValue - 1;
+}
 
-	std::vector<int> output = ApplyGroupSums(sumResult_Base.result, groupSums);
-	return output;
+// flags the first element of every run of equal keys, scans the flags and scatters
+// key and first index of every run, returns the number of runs
+size_t strComGPU_FindRuns(cl::CommandQueue& queue, const cl::Buffer& keys, const cl::Buffer& runKeys, const cl::Buffer& runStarts, size_t n)
+{
+	cl::Buffer buffer_FLAGS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+	cl::Buffer buffer_ADDR(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+	cl::NDRange global(RoundUp((n + config.itemsPerThread - 1) / config.itemsPerThread, config.sizeWG));
+	cl::NDRange local(config.sizeWG);
+
+	cl::Kernel heads(program, "run_heads", &err);
+	heads.setArg(0, keys);
+	heads.setArg(1, buffer_FLAGS);
+	heads.setArg(2, (cl_int)n);
+	queue.enqueueNDRangeKernel(heads, 0, global, local);
+
+	strComGPU_Step2_PrefixSum(queue, buffer_FLAGS, buffer_ADDR, n);
+
+	cl::Kernel scatter(program, "scatter_runs", &err);
+	scatter.setArg(0, keys);
+	scatter.setArg(1, buffer_FLAGS);
+	scatter.setArg(2, buffer_ADDR);
+	scatter.setArg(3, runKeys);
+	scatter.setArg(4, runStarts);
+	scatter.setArg(5, (cl_int)n);
+	queue.enqueueNDRangeKernel(scatter, 0, global, local);
+
+	cl_int last[2];
+	queue.enqueueReadBuffer(buffer_ADDR, CL_FALSE, sizeof(cl_int) * (n - 1), sizeof(cl_int), &last[0]);
+	queue.enqueueReadBuffer(buffer_FLAGS, CL_TRUE, sizeof(cl_int) * (n - 1), sizeof(cl_int), &last[1]);
+	return (size_t)(last[0] + last[1]);
 }
 
-PrefixSumResult CalcPrefixSum(std::vector<int> input)
+size_t rle_encode_GPU(hpc::Span<const int> input, hpc::Span<int> values, hpc::Span<int> lengths, const cl::Device& device)
 {
-	int groupSumsSize = ceil(input.size() / SIZE_BLOCK);
-	if (groupSumsSize == 0)
-		groupSumsSize = 1;
+	assert(values.size() >= input.size() && lengths.size() >= input.size());
+	if (input.empty())
+		return 0;
 
-	const std::string KERNEL = "blelloch_simple";
-	PrefixSumResult sumResult;
-	sumResult.result = std::vector<int>(input.size());
-	sumResult.groupSums = std::vector<int>(groupSumsSize);
+	const size_t n = input.size();
+	size_t runs = 0;
+	try
+	{
+		cl::CommandQueue queue(context, device, 0, &err);
+		cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, sizeof(cl_int) * n);
+		cl::Buffer buffer_VALUES(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+		cl::Buffer buffer_STARTS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+		cl::Buffer buffer_LENGTHS(context, CL_MEM_WRITE_ONLY, sizeof(cl_int) * n);
+
+		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * n, input.data());
+		runs = strComGPU_FindRuns(queue, buffer_INPUT, buffer_VALUES, buffer_STARTS, n);
+
+		cl::Kernel kernel(program, "run_lengths", &err);
+		kernel.setArg(0, buffer_STARTS);
+		kernel.setArg(1, buffer_LENGTHS);
+		kernel.setArg(2, (cl_int)runs);
+		kernel.setArg(3, (cl_int)n);
+		queue.enqueueNDRangeKernel(kernel, 0, cl::NDRange(RoundUp(runs, config.sizeWG)), cl::NDRange(config.sizeWG));
+
+		queue.enqueueReadBuffer(buffer_VALUES, CL_FALSE, 0, sizeof(cl_int) * runs, values.data());
+		queue.enqueueReadBuffer(buffer_LENGTHS, CL_TRUE, 0, sizeof(cl_int) * runs, lengths.data());
+	}
+	catch (cl::Error err)
+	{
+		Errorhandling(err);
+	}
+
+	return runs;
+}
+
+// returns the decoded size, output needs room for the sum of the lengths
+size_t rle_decode_GPU(hpc::Span<const int> values, hpc::Span<const int> lengths, hpc::Span<int> output, const cl::Device& device)
+{
+	assert(values.size() == lengths.size());
+	if (values.empty())
+		return 0;
 
+	const size_t runs = values.size();
+	size_t total = 0;
 	try
 	{
-		cl::CommandQueue queue(context, default_device, 0, &err);
-		// create buffers on device (allocate space on GPU)
-		cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, sizeof(cl_int) * input.size());
-		cl::Buffer buffer_OUTPUT(context, CL_MEM_READ_WRITE, sizeof(cl_int) * input.size());
-		cl::Buffer buffer_GROUPSUMS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * input.size());
+		cl::CommandQueue queue(context, device, 0, &err);
+		cl::Buffer buffer_VALUES(context, CL_MEM_READ_ONLY, sizeof(cl_int) * runs);
+		cl::Buffer buffer_LENGTHS(context, CL_MEM_READ_ONLY, sizeof(cl_int) * runs);
+		cl::Buffer buffer_OFFSETS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * runs);
+
+		queue.enqueueWriteBuffer(buffer_VALUES, CL_FALSE, 0, sizeof(cl_int) * runs, values.data());
+		queue.enqueueWriteBuffer(buffer_LENGTHS, CL_TRUE, 0, sizeof(cl_int) * runs, lengths.data());
+
+		// every run starts at the exclusive prefix sum of the lengths before it
+		strComGPU_Step2_PrefixSum(queue, buffer_LENGTHS, buffer_OFFSETS, runs);
+		cl_int lastOffset;
+		queue.enqueueReadBuffer(buffer_OFFSETS, CL_TRUE, sizeof(cl_int) * (runs - 1), sizeof(cl_int), &lastOffset);
+		total = (size_t)(lastOffset + lengths[runs - 1]);
+		assert(output.size() >= total);
+		if (total == 0)
+			return 0;
+
+		cl::Buffer buffer_OUTPUT(context, CL_MEM_WRITE_ONLY, sizeof(cl_int) * total);
+		cl::Kernel kernel(program, "expand_runs", &err);
+		kernel.setArg(0, buffer_VALUES);
+		kernel.setArg(1, buffer_OFFSETS);
+		kernel.setArg(2, buffer_OUTPUT);
+		kernel.setArg(3, (cl_int)runs);
+		kernel.setArg(4, (cl_int)total);
+		queue.enqueueNDRangeKernel(kernel, 0, cl::NDRange(RoundUp(total, config.sizeWG)), cl::NDRange(config.sizeWG));
+
+		queue.enqueueReadBuffer(buffer_OUTPUT, CL_TRUE, 0, sizeof(cl_int) * total, output.data());
+	}
+	catch (cl::Error err)
+	{
+		Errorhandling(err);
+	}
 
-		// push write commands to queue
-		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), &input[0]);
+	return total;
+}
 
-		cl::Kernel kernel(program, KERNEL.c_str(), &err);
+// first element of every run of equal adjacent elements
+size_t unique_GPU(hpc::Span<const int> input, hpc::Span<int> output, const cl::Device& device)
+{
+	assert(output.size() >= input.size());
+	if (input.empty())
+		return 0;
 
-		kernel.setArg(0, buffer_INPUT);
-		kernel.setArg(1, buffer_OUTPUT);
-		kernel.setArg(2, buffer_GROUPSUMS);
-		kernel.setArg(3, cl::LocalSpaceArg(cl::Local(sizeof(cl_int) * SIZE_BLOCK)));
-		kernel.setArg(4, SIZE_BLOCK);
+	const size_t n = input.size();
+	size_t runs = 0;
+	try
+	{
+		cl::CommandQueue queue(context, device, 0, &err);
+		cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, sizeof(cl_int) * n);
+		cl::Buffer buffer_VALUES(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+		cl::Buffer buffer_STARTS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+
+		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * n, input.data());
+		runs = strComGPU_FindRuns(queue, buffer_INPUT, buffer_VALUES, buffer_STARTS, n);
+		if (runs > 0)
+			queue.enqueueReadBuffer(buffer_VALUES, CL_TRUE, 0, sizeof(cl_int) * runs, output.data());
+	}
+	catch (cl::Error err)
+	{
+		Errorhandling(err);
+	}
 
-		cl::NDRange global(input.size());
-		cl::NDRange local(SIZE_BLOCK);
+	return runs;
+}
 
-		queue.enqueueNDRangeKernel(kernel, 1, global, local);
+// sum of the values of every run of equal adjacent keys
+size_t reduce_by_key_GPU(hpc::Span<const int> keys, hpc::Span<const int> values, hpc::Span<int> runKeys, hpc::Span<int> sums, const cl::Device& device)
+{
+	assert(keys.size() == values.size() && runKeys.size() >= keys.size() && sums.size() >= keys.size());
+	if (keys.empty())
+		return 0;
 
-		cl::Event readBufferEvent_output;
-		queue.enqueueReadBuffer(buffer_OUTPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), &sumResult.result[0], NULL, &readBufferEvent_output);
-		readBufferEvent_output.wait();
-		cl::Event readBufferEvent_groupSums;
-		queue.enqueueReadBuffer(buffer_GROUPSUMS, CL_TRUE, 0, sizeof(cl_int) * groupSumsSize, &sumResult.groupSums[0], NULL, &readBufferEvent_groupSums);
-		readBufferEvent_groupSums.wait();
+	const size_t n = keys.size();
+	size_t runs = 0;
+	try
+	{
+		cl::CommandQueue queue(context, device, 0, &err);
+		cl::Buffer buffer_KEYS(context, CL_MEM_READ_ONLY, sizeof(cl_int) * n);
+		cl::Buffer buffer_VALUES(context, CL_MEM_READ_ONLY, sizeof(cl_int) * n);
+		cl::Buffer buffer_SCAN(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+		cl::Buffer buffer_RUNKEYS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+		cl::Buffer buffer_STARTS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+		cl::Buffer buffer_SUMS(context, CL_MEM_WRITE_ONLY, sizeof(cl_int) * n);
+
+		queue.enqueueWriteBuffer(buffer_KEYS, CL_FALSE, 0, sizeof(cl_int) * n, keys.data());
+		queue.enqueueWriteBuffer(buffer_VALUES, CL_TRUE, 0, sizeof(cl_int) * n, values.data());
+
+		// a run sums to the difference of the value scan at its end and its start
+		strComGPU_Step2_PrefixSum(queue, buffer_VALUES, buffer_SCAN, n);
+		runs = strComGPU_FindRuns(queue, buffer_KEYS, buffer_RUNKEYS, buffer_STARTS, n);
+
+		cl::Kernel kernel(program, "run_sums", &err);
+		kernel.setArg(0, buffer_STARTS);
+		kernel.setArg(1, buffer_SCAN);
+		kernel.setArg(2, buffer_VALUES);
+		kernel.setArg(3, buffer_SUMS);
+		kernel.setArg(4, (cl_int)runs);
+		kernel.setArg(5, (cl_int)n);
+		queue.enqueueNDRangeKernel(kernel, 0, cl::NDRange(RoundUp(runs, config.sizeWG)), cl::NDRange(config.sizeWG));
+
+		queue.enqueueReadBuffer(buffer_RUNKEYS, CL_FALSE, 0, sizeof(cl_int) * runs, runKeys.data());
+		queue.enqueueReadBuffer(buffer_SUMS, CL_TRUE, 0, sizeof(cl_int) * runs, sums.data());
+	}
+	catch (cl::Error err)
+	{
+		Errorhandling(err);
+	}
+
+	return runs;
+}
 
+// three launches for the whole batch: compact every array inside its own range,
+// scan the counts into packed offsets and move the arrays there
+size_t stream_compaction_BATCH(hpc::Span<const int> input, hpc::Span<const int> offsets, hpc::Span<int> output,
+	hpc::Span<int> outOffsets, hpc::Span<int> counts, int threshold, const cl::Device& device)
+{
+	try
+	{
+		return strComGPU_CompactBatch(input, offsets, output, outOffsets, counts, threshold, device);
 	}
 	catch (cl::Error err)
 	{
 		Errorhandling(err);
+		return 0;
+	}
+}
+
+size_t strComGPU_CompactBatch(hpc::Span<const int> input, hpc::Span<const int> offsets, hpc::Span<int> output,
+	hpc::Span<int> outOffsets, hpc::Span<int> counts, int threshold, const cl::Device& device)
+{
+	assert(!offsets.empty() && (size_t)offsets[offsets.size() - 1] == input.size());
+	const size_t arrays = offsets.size() - 1;
+	assert(output.size() >= input.size() && outOffsets.size() >= arrays && counts.size() >= arrays);
+	if (arrays == 0 || input.empty())
+	{
+		std::fill(outOffsets.begin(), outOffsets.begin() + arrays, 0);
+		std::fill(counts.begin(), counts.begin() + arrays, 0);
+		return 0;
 	}
 
-	return sumResult;
+	const size_t n = input.size();
+	cl::CommandQueue queue(context, device, 0, &err);
+	cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, sizeof(cl_int) * n);
+	cl::Buffer buffer_OFFSETS(context, CL_MEM_READ_ONLY, sizeof(cl_int) * offsets.size());
+	cl::Buffer buffer_COMPACTED(context, CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+	cl::Buffer buffer_COUNTS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * arrays);
+	cl::Buffer buffer_OUTOFFSETS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * arrays);
+	cl::Buffer buffer_OUTPUT(context, CL_MEM_WRITE_ONLY, sizeof(cl_int) * n);
+
+	queue.enqueueWriteBuffer(buffer_INPUT, CL_FALSE, 0, sizeof(cl_int) * n, input.data());
+	queue.enqueueWriteBuffer(buffer_OFFSETS, CL_TRUE, 0, sizeof(cl_int) * offsets.size(), offsets.data());
+
+	// one work-group per array, a few groups per compute unit loop over all arrays
+	size_t groups = std::min(arrays, (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 16);
+	cl::NDRange global(groups * config.sizeWG);
+	cl::NDRange local(config.sizeWG);
+
+	cl::Kernel compact(program, "compact_batch", &err);
+	compact.setArg(0, buffer_INPUT);
+	compact.setArg(1, buffer_OFFSETS);
+	compact.setArg(2, buffer_COMPACTED);
+	compact.setArg(3, buffer_COUNTS);
+	compact.setArg(4, cl::LocalSpaceArg(cl::Local(sizeof(cl_int) * config.sizeWG)));
+	compact.setArg(5, threshold);
+	compact.setArg(6, (cl_int)arrays);
+	queue.enqueueNDRangeKernel(compact, 0, global, local);
+
+	strComGPU_Step2_PrefixSum(queue, buffer_COUNTS, buffer_OUTOFFSETS, arrays);
+
+	cl::Kernel pack(program, "pack_batch", &err);
+	pack.setArg(0, buffer_COMPACTED);
+	pack.setArg(1, buffer_OFFSETS);
+	pack.setArg(2, buffer_OUTOFFSETS);
+	pack.setArg(3, buffer_COUNTS);
+	pack.setArg(4, buffer_OUTPUT);
+	pack.setArg(5, (cl_int)arrays);
+	queue.enqueueNDRangeKernel(pack, 0, global, local);
+
+	queue.enqueueReadBuffer(buffer_COUNTS, CL_FALSE, 0, sizeof(cl_int) * arrays, counts.data());
+	queue.enqueueReadBuffer(buffer_OUTOFFSETS, CL_TRUE, 0, sizeof(cl_int) * arrays, outOffsets.data());
+	const size_t total = (size_t)(outOffsets[arrays - 1] + counts[arrays - 1]);
+	if (total > 0)
+		queue.enqueueReadBuffer(buffer_OUTPUT, CL_TRUE, 0, sizeof(cl_int) * total, output.data());
+
+	return total;
 }
 
-std::vector<int> ApplyGroupSums(std::vector<int> input, std::vector<int> groupSums)
+// most significant digit first: histogram the digit of the candidates, everything above the digit
+// that contains the k-th largest key is part of the result, the keys with that digit stay candidates
+// the candidates shrink with every pass and never leave the device, returns the k-th largest key
+// resultKeys / resultIndices receive the k largest keys and their positions
+int strComGPU_RadixSelect(cl::CommandQueue& queue, const cl::Device& device, const cl::Buffer& keys, size_t n, size_t k, const cl::Buffer& resultKeys, const cl::Buffer& resultIndices)
 {
-	const std::string KERNEL = "ApplyGroupSums";
-	std::vector<int> result(input.size());
+	const int BINS = 1 << RADIX_BITS;
+	cl::Buffer candKeys = keys, candIndices = keys;
+	bool hasIndices = false;
+	size_t candidates = n;
+	size_t need = k;
+	size_t written = 0;
+	cl_uint prefix = 0;
+
+	cl::Buffer buffer_BINS(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * BINS);
+	cl::Kernel histogram(program, "radix_histogram", &err);
+	cl::Kernel flags(program, "radix_flags", &err);
+	cl::Kernel scatter(program, "scatter_pairs", &err);
+	const size_t groups = std::min(RoundUp(n, config.sizeWG) / config.sizeWG, (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4);
+	std::vector<cl_uint> bins(BINS);
+
+	for (int shift = 32 - RADIX_BITS; shift >= 0; shift -= RADIX_BITS)
+	{
+		std::fill(bins.begin(), bins.end(), 0u);
+		queue.enqueueWriteBuffer(buffer_BINS, CL_FALSE, 0, sizeof(cl_uint) * BINS, &bins[0]);
+		histogram.setArg(0, candKeys);
+		histogram.setArg(1, buffer_BINS);
+		histogram.setArg(2, shift);
+		histogram.setArg(3, (cl_int)candidates);
+		queue.enqueueNDRangeKernel(histogram, 0, cl::NDRange(groups * config.sizeWG), cl::NDRange(config.sizeWG));
+		queue.enqueueReadBuffer(buffer_BINS, CL_TRUE, 0, sizeof(cl_uint) * BINS, &bins[0]);
+
+		// digit of the k-th largest key, the keys with larger digits are all in the result
+		size_t above = 0;
+		int target = BINS - 1;
+		while (above + bins[target] < need)
+			above += bins[target--];
+		prefix |= (cl_uint)target << shift;
+
+		cl::Buffer buffer_FLAGS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * candidates);
+		cl::Buffer buffer_ADDR(context, CL_MEM_READ_WRITE, sizeof(cl_int) * candidates);
+		cl::NDRange global(RoundUp((candidates + config.itemsPerThread - 1) / config.itemsPerThread, config.sizeWG));
+		cl::NDRange local(config.sizeWG);
+		auto compact = [&](int mode, const cl::Buffer& outKeys, const cl::Buffer& outIndices, size_t base)
+		{
+			flags.setArg(0, candKeys);
+			flags.setArg(1, buffer_FLAGS);
+			flags.setArg(2, shift);
+			flags.setArg(3, (cl_uint)target);
+			flags.setArg(4, mode);
+			flags.setArg(5, (cl_int)candidates);
+			queue.enqueueNDRangeKernel(flags, 0, global, local);
+
+			strComGPU_Step2_PrefixSum(queue, buffer_FLAGS, buffer_ADDR, candidates);
+
+			scatter.setArg(0, candKeys);
+			scatter.setArg(1, candIndices);
+			scatter.setArg(2, buffer_ADDR);
+			scatter.setArg(3, buffer_FLAGS);
+			scatter.setArg(4, outKeys);
+			scatter.setArg(5, outIndices);
+			scatter.setArg(6, (cl_int)base);
+			scatter.setArg(7, (cl_int)hasIndices);
+			scatter.setArg(8, (cl_int)candidates);
+			queue.enqueueNDRangeKernel(scatter, 0, global, local);
+		};
+
+		if (above > 0)
+		{
+			compact(0, resultKeys, resultIndices, written);
+			written += above;
+			need -= above;
+		}
+
+		cl::Buffer nextKeys(context, CL_MEM_READ_WRITE, sizeof(cl_int) * bins[target]);
+		cl::Buffer nextIndices(context, CL_MEM_READ_WRITE, sizeof(cl_int) * bins[target]);
+		compact(1, nextKeys, nextIndices, 0);
+		candKeys = nextKeys;
+		candIndices = nextIndices;
+		hasIndices = true;
+		candidates = bins[target];
+	}
+
+	// every remaining candidate has the k-th largest key, the first ones fill the result
+	if (need > 0)
+	{
+		queue.enqueueCopyBuffer(candKeys, resultKeys, 0, sizeof(cl_int) * written, sizeof(cl_int) * need);
+		queue.enqueueCopyBuffer(candIndices, resultIndices, 0, sizeof(cl_int) * written, sizeof(cl_int) * need);
+	}
+	return (int)(prefix ^ 0x80000000u);
+}
+
+size_t top_k_GPU(hpc::Span<const int> input, size_t k, hpc::Span<int> values, hpc::Span<int> indices, const cl::Device& device)
+{
+	k = std::min(k, input.size());
+	assert(values.size() >= k && (indices.empty() || indices.size() >= k));
+	if (k == 0)
+		return 0;
 
 	try
 	{
-		cl::CommandQueue queue(context, default_device, 0, &err);
-		// create buffers on device (allocate space on GPU)
+		cl::CommandQueue queue(context, device, 0, &err);
 		cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, sizeof(cl_int) * input.size());
-		cl::Buffer buffer_OUTPUT(context, CL_MEM_READ_WRITE, sizeof(cl_int) * input.size());
-		cl::Buffer buffer_SUMS(context, CL_MEM_READ_ONLY, sizeof(cl_int) * groupSums.size());
-
-		// push write commands to queue
-		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), &input[0]);
-		queue.enqueueWriteBuffer(buffer_SUMS, CL_TRUE, 0, sizeof(cl_int) * groupSums.size(), &groupSums[0]);
+		cl::Buffer buffer_VALUES(context, CL_MEM_READ_WRITE, sizeof(cl_int) * k);
+		cl::Buffer buffer_INDICES(context, CL_MEM_READ_WRITE, sizeof(cl_int) * k);
 
-		cl::Kernel kernel(program, KERNEL.c_str(), &err);
+		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), input.data());
+		strComGPU_RadixSelect(queue, device, buffer_INPUT, input.size(), k, buffer_VALUES, buffer_INDICES);
 
-		kernel.setArg(0, buffer_INPUT);
-		kernel.setArg(1, buffer_SUMS);
-		kernel.setArg(2, buffer_OUTPUT);
+		if (!indices.empty())
+			queue.enqueueReadBuffer(buffer_INDICES, CL_FALSE, 0, sizeof(cl_int) * k, indices.data());
+		queue.enqueueReadBuffer(buffer_VALUES, CL_TRUE, 0, sizeof(cl_int) * k, values.data());
+	}
+	catch (cl::Error err)
+	{
+		Errorhandling(err);
+		return 0;
+	}
 
-		cl::NDRange global(input.size());
-		cl::NDRange local(SIZE_BLOCK);
+	return k;
+}
 
-		queue.enqueueNDRangeKernel(kernel, 0, global, local);
+bool select_kth_GPU(hpc::Span<const int> input, size_t k, int * kth, const cl::Device& device)
+{
+	assert(k >= 1 && k <= input.size());
+	try
+	{
+		cl::CommandQueue queue(context, device, 0, &err);
+		cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, sizeof(cl_int) * input.size());
+		cl::Buffer buffer_VALUES(context, CL_MEM_READ_WRITE, sizeof(cl_int) * k);
+		cl::Buffer buffer_INDICES(context, CL_MEM_READ_WRITE, sizeof(cl_int) * k);
 
-		cl::Event readBufferEvent;
-		queue.enqueueReadBuffer(buffer_OUTPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), &result[0], NULL, &readBufferEvent);
-		readBufferEvent.wait();
+		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), input.data());
+		*kth = strComGPU_RadixSelect(queue, device, buffer_INPUT, input.size(), k, buffer_VALUES, buffer_INDICES);
+		queue.finish();
 	}
 	catch (cl::Error err)
 	{
 		Errorhandling(err);
+		return false;
 	}
 
-	return result;
+	return true;
 }
 
-std::vector<int> strComGPU_Step3_Scatter(std::vector<int> input, std::vector<int> addr, std::vector<int> mask)
+// bitmask filter and scan like stream_compaction_GPU, the scatter writes positions instead of values
+// returns the number of selected elements
+size_t strComGPU_SelectIndices(cl::CommandQueue& queue, const cl::Buffer& input, size_t n, const int threshold, const PredicateMode predicate, const cl::Buffer& indices)
 {
-	const std::string KERNEL = "scatter";
-	std::vector<int> result(input.size());
+	const size_t words = (n + MASK_WORD_BITS - 1) / MASK_WORD_BITS;
+	cl::Buffer buffer_BITS(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * words);
+	cl::Buffer buffer_COUNTS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * words);
+	cl::Buffer buffer_OFFSETS(context, CL_MEM_READ_WRITE, sizeof(cl_int) * words);
+
+	strComGPU_Step1_FilterBits(queue, input, buffer_BITS, buffer_COUNTS, n, threshold, predicate);
+	strComGPU_Step2_PrefixSum(queue, buffer_COUNTS, buffer_OFFSETS, words);
+
+	cl::Kernel kernel(program, "scatter_bits_indices", &err);
+	kernel.setArg(0, buffer_BITS);
+	kernel.setArg(1, buffer_OFFSETS);
+	kernel.setArg(2, indices);
+	kernel.setArg(3, (cl_int)n);
+	cl::NDRange global(RoundUp((n + config.itemsPerThread - 1) / config.itemsPerThread, config.sizeWG));
+	queue.enqueueNDRangeKernel(kernel, 0, global, cl::NDRange(config.sizeWG));
+
+	cl_int last[2];
+	queue.enqueueReadBuffer(buffer_OFFSETS, CL_FALSE, sizeof(cl_int) * (words - 1), sizeof(cl_int), &last[0]);
+	queue.enqueueReadBuffer(buffer_COUNTS, CL_TRUE, sizeof(cl_int) * (words - 1), sizeof(cl_int), &last[1]);
+	return (size_t)(last[0] + last[1]);
+}
+
+void strComGPU_GatherColumns(cl::CommandQueue& queue, const cl::Buffer& table, size_t rows, size_t columns, const cl::Buffer& indices, size_t count, const cl::Buffer& output)
+{
+	cl::Kernel kernel(program, "gather_columns", &err);
+	kernel.setArg(0, table);
+	kernel.setArg(1, indices);
+	kernel.setArg(2, output);
+	kernel.setArg(3, (cl_int)rows);
+	kernel.setArg(4, (cl_int)columns);
+	kernel.setArg(5, (cl_int)count);
+	queue.enqueueNDRangeKernel(kernel, 0, cl::NDRange(RoundUp(count, config.sizeWG)), cl::NDRange(config.sizeWG));
+}
+
+size_t stream_compaction_INDICES(hpc::Span<const int> input, hpc::Span<int> indices, int threshold, const cl::Device& device)
+{
+	assert(indices.size() >= input.size());
+	if (input.empty())
+		return 0;
 
+	size_t count = 0;
 	try
 	{
-		cl::CommandQueue queue(context, default_device, 0, &err);
-		// create buffers on device (allocate space on GPU)
+		cl::CommandQueue queue(context, device, 0, &err);
 		cl::Buffer buffer_INPUT(context, CL_MEM_READ_ONLY, sizeof(cl_int) * input.size());
-		cl::Buffer buffer_OUTPUT(context, CL_MEM_READ_WRITE, sizeof(cl_int) * input.size());
-		cl::Buffer buffer_ADDR(context, CL_MEM_READ_ONLY, sizeof(cl_int) * addr.size());
-		cl::Buffer buffer_MASK(context, CL_MEM_READ_WRITE, sizeof(cl_int) * mask.size());
+		cl::Buffer buffer_INDICES(context, CL_MEM_WRITE_ONLY, sizeof(cl_int) * input.size());
 
-		// push write commands to queue
-		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), &input[0]);
-		queue.enqueueWriteBuffer(buffer_ADDR, CL_TRUE, 0, sizeof(cl_int) * addr.size(), &addr[0]);
-		queue.enqueueWriteBuffer(buffer_MASK, CL_TRUE, 0, sizeof(cl_int) * mask.size(), &mask[0]);
+		queue.enqueueWriteBuffer(buffer_INPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), input.data());
+		count = strComGPU_SelectIndices(queue, buffer_INPUT, input.size(), threshold, PREDICATE_GREATER, buffer_INDICES);
+		if (count > 0)
+			queue.enqueueReadBuffer(buffer_INDICES, CL_TRUE, 0, sizeof(cl_int) * count, indices.data());
+	}
+	catch (cl::Error err)
+	{
+		Errorhandling(err);
+	}
 
-		cl::Kernel kernel(program, KERNEL.c_str(), &err);
+	return count;
+}
 
-		kernel.setArg(0, buffer_INPUT);
-		kernel.setArg(1, buffer_ADDR);
-		kernel.setArg(2, buffer_MASK);
-		kernel.setArg(3, buffer_OUTPUT);
+// the predicate runs once on the filter column, only the selected rows come back
+size_t filter_table_GPU(hpc::Span<const int> filterColumn, hpc::Span<const int> table, size_t columns,
+	hpc::Span<int> output, int threshold, const cl::Device& device)
+{
+	const size_t rows = filterColumn.size();
+	assert(table.size() == rows * columns && output.size() >= table.size());
+	if (rows == 0 || columns == 0)
+		return 0;
 
-		cl::NDRange global(input.size());
+	size_t count = 0;
+	try
+	{
+		cl::CommandQueue queue(context, device, 0, &err);
+		cl::Buffer buffer_FILTER(context, CL_MEM_READ_ONLY, sizeof(cl_int) * rows);
+		cl::Buffer buffer_TABLE(context, CL_MEM_READ_ONLY, sizeof(cl_int) * table.size());
+		cl::Buffer buffer_INDICES(context, CL_MEM_READ_WRITE, sizeof(cl_int) * rows);
+		cl::Buffer buffer_OUTPUT(context, CL_MEM_WRITE_ONLY, sizeof(cl_int) * table.size());
 
-		queue.enqueueNDRangeKernel(kernel, 0, global);
+		queue.enqueueWriteBuffer(buffer_FILTER, CL_FALSE, 0, sizeof(cl_int) * rows, filterColumn.data());
+		queue.enqueueWriteBuffer(buffer_TABLE, CL_TRUE, 0, sizeof(cl_int) * table.size(), table.data());
 
-		cl::Event readBufferEvent;
-		queue.enqueueReadBuffer(buffer_OUTPUT, CL_TRUE, 0, sizeof(cl_int) * input.size(), &result[0], NULL, &readBufferEvent);
-		readBufferEvent.wait();
+		count = strComGPU_SelectIndices(queue, buffer_FILTER, rows, threshold, PREDICATE_GREATER, buffer_INDICES);
+		if (count > 0)
+		{
+			strComGPU_GatherColumns(queue, buffer_TABLE, rows, columns, buffer_INDICES, count, buffer_OUTPUT);
+			queue.enqueueReadBuffer(buffer_OUTPUT, CL_TRUE, 0, sizeof(cl_int) * count * columns, output.data());
+		}
 	}
 	catch (cl::Error err)
 	{
 		Errorhandling(err);
 	}
 
-	return result;
-}
\ No newline at end of file
+	return count;
+}
@@ -0,0 +1,71 @@
+// host API of the stream compaction, also used by the allocation test (StreamCompactionTest)
+// which builds main.cpp with STREAM_COMPACTION_NO_MAIN
+
+#pragma once
+
+// NVidia only supports OpenCL 1.2
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+#include "../HighPerformanceComputing/span.h"
+#include "../HighPerformanceComputing/tuning.h"
+#include <vector>
+
+// values of PREDICATE_MODE in kernel.cl
+enum PredicateMode
+{
+	PREDICATE_GREATER = 0,
+	PREDICATE_SMALLER = 1,
+	PREDICATE_EQUALS = 2
+};
+
+// how stream_compaction_GPU uploads its input
+enum TransferEncoding
+{
+	TRANSFER_PLAIN,		// 32 bit ints
+	TRANSFER_PACKED		// frame-of-reference bit-packed (bit_pack.h), unpacked inside the predicate and scatter kernels
+};
+
+// picks the device, creates the context, loads the tuned configuration and builds the program
+// false if there is no OpenCL platform or the program doesn't build
+bool InitOpenCL(hpc::Tuning& tuning);
+
+// host APIs read through a span and write into a caller-provided output with room for
+// input.size() elements, they return the number of elements written
+size_t stream_compaction_GPU(hpc::Span<const int> input, hpc::Span<int> output, int threshold, const cl::Device& device, TransferEncoding encoding = TRANSFER_PLAIN);
+std::vector<int> stream_compaction_GPU(hpc::Span<const int> input, int threshold, const cl::Device& device);
+size_t stream_compaction_SEQ(hpc::Span<const int> input, hpc::Span<int> output, int threshold);
+std::vector<int> stream_compaction_SEQ(hpc::Span<const int> input, int threshold);
+size_t stream_compaction_MULTI(hpc::Span<const int> input, hpc::Span<int> output, int threshold);
+size_t stream_compaction_HETERO(hpc::Span<const int> input, hpc::Span<int> output, int threshold);
+void strComGPU_PrefixSum(hpc::Span<const int> input, hpc::Span<int> output, const cl::Device& device);
+void strComGPU_PrefixSum_MULTI(hpc::Span<const int> input, hpc::Span<int> output);
+
+// positions of the elements passing the predicate, indices needs room for input.size() entries
+size_t stream_compaction_INDICES(hpc::Span<const int> input, hpc::Span<int> indices, int threshold, const cl::Device& device);
+// filters the rows of a table by one column, the table holds columns of filterColumn.size() rows
+// one after the other, output receives the selected rows of every column packed the same way
+// and needs room for table.size() elements, returns the number of selected rows
+size_t filter_table_GPU(hpc::Span<const int> filterColumn, hpc::Span<const int> table, size_t columns,
+	hpc::Span<int> output, int threshold, const cl::Device& device);
+// the same on columns that already live on the device, they enqueue on the caller's queue
+// indices needs room for n entries, SelectIndices returns the number of selected rows
+size_t strComGPU_SelectIndices(cl::CommandQueue& queue, const cl::Buffer& input, size_t n, const int threshold, const PredicateMode predicate, const cl::Buffer& indices);
+void strComGPU_GatherColumns(cl::CommandQueue& queue, const cl::Buffer& table, size_t rows, size_t columns, const cl::Buffer& indices, size_t count, const cl::Buffer& output);
+
+// run-length primitives, the outputs need room for input.size() runs and return the run count
+size_t rle_encode_GPU(hpc::Span<const int> input, hpc::Span<int> values, hpc::Span<int> lengths, const cl::Device& device);
+size_t rle_decode_GPU(hpc::Span<const int> values, hpc::Span<const int> lengths, hpc::Span<int> output, const cl::Device& device);
+// first element of every run of equal adjacent elements
+size_t unique_GPU(hpc::Span<const int> input, hpc::Span<int> output, const cl::Device& device);
+// key and sum of the values of every run of equal adjacent keys
+size_t reduce_by_key_GPU(hpc::Span<const int> keys, hpc::Span<const int> values, hpc::Span<int> runKeys, hpc::Span<int> sums, const cl::Device& device);
+
+// the device the host APIs run on by default, set by InitOpenCL
+extern cl::Device default_device;
@@ -0,0 +1,90 @@
+// checks that the span host APIs compact into the caller's output without copying the input on the host
+// replaces the global operator new with a counting one and fails on any allocation of input size
+
+#include "../StreamCompaction/main.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+static std::atomic<bool> counting(false);
+static std::atomic<size_t> largeAllocations(0);
+static size_t largeBytes = 0;
+
+void * operator new(size_t size)
+{
+	if (counting && size >= largeBytes)
+		++largeAllocations;
+	void * p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void * p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void * p, size_t) noexcept
+{
+	free(p);
+}
+
+// runs run() once with counting on, it has to return the element count and fill output
+template <typename Run>
+static bool CheckNoCopy(const char * name, const std::vector<int>& expected, std::vector<int>& output, Run run)
+{
+	std::fill(output.begin(), output.end(), -1);
+	largeAllocations = 0;
+	counting = true;
+	const size_t count = run();
+	counting = false;
+
+	const bool same = count == expected.size() && std::equal(expected.begin(), expected.end(), output.begin());
+	std::cout << name << ": " << largeAllocations << " allocations of input size, output " << (same ? "matches" : "differs") << std::endl;
+	return same && largeAllocations == 0;
+}
+
+int main()
+{
+	const size_t testSize = 1 << 20;
+	const int threshold = 5;
+
+	std::vector<int> input(testSize);
+	for (size_t i = 0; i < testSize; ++i)
+		input[i] = rand() % 10;
+	std::vector<int> expected;
+	for (size_t i = 0; i < testSize; ++i)
+	{
+		if (input[i] > threshold)
+			expected.push_back(input[i]);
+	}
+	std::vector<int> output(testSize);
+	const hpc::Span<const int> in(input);
+	const hpc::Span<int> out(output);
+
+	// half the input catches a copy of the input or of a full-size output
+	largeBytes = sizeof(int) * testSize / 2;
+	bool ok = CheckNoCopy("stream_compaction_SEQ", expected, output, [&] { return stream_compaction_SEQ(in, out, threshold); });
+
+	hpc::Tuning tuning;
+	if (InitOpenCL(tuning))
+	{
+		// the first run builds the kernels, the program cache may allocate there
+		stream_compaction_GPU(in, out, threshold, default_device);
+		ok &= CheckNoCopy("stream_compaction_GPU", expected, output, [&] { return stream_compaction_GPU(in, out, threshold, default_device); });
+		// the packed words are a fraction of the input
+		stream_compaction_GPU(in, out, threshold, default_device, TRANSFER_PACKED);
+		ok &= CheckNoCopy("stream_compaction_GPU packed", expected, output, [&] { return stream_compaction_GPU(in, out, threshold, default_device, TRANSFER_PACKED); });
+	}
+	else
+	{
+		std::cout << "no OpenCL device, stream_compaction_GPU skipped" << std::endl;
+	}
+
+	std::cout << (ok ? "passed" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -27,6 +27,14 @@ __kernel void scan_nvidia(
 	g_odata[thid] = temp[pout * n + thid];
 }
 
+// scan length as a build option (-DSCAN_N=...) lets the sweeps unroll completely,
+// without it the kernel argument is used
+#ifdef SCAN_N
+#define SCAN_ITEMS SCAN_N
+#else
+#define SCAN_ITEMS n_items
+#endif
+
 __kernel void scan(
 	__global int *input,
 	__global int *result,
@@ -47,7 +55,8 @@ __kernel void scan(
 
 	// GO UP
 	// loop with half jumps
-	for (uint s = n_items >> 1; s > 0; s >>= 1) 
+	#pragma unroll
+	for (uint s = SCAN_ITEMS >> 1; s > 0; s >>= 1) 
 	{
 		barrier(CLK_LOCAL_MEM_FENCE); // wait for all threads so all use the same index multiplier
 
@@ -64,10 +73,11 @@ __kernel void scan(
 	// AND BACK DOWN
 
 	// set last item to 0
-	if (lid == 0) tmpBuffer[n_items - 1] = 0;
+	if (lid == 0) tmpBuffer[SCAN_ITEMS - 1] = 0;
 
 	// start at 1 and double the index with each step
-	for (uint s = 1; s < n_items; s <<= 1) 
+	#pragma unroll
+	for (uint s = 1; s < SCAN_ITEMS; s <<= 1) 
 	{
 		// half the sumHelper with each step
 		sumHelper >>= 1;
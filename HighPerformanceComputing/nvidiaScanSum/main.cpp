@@ -20,52 +20,114 @@
 #include <fstream>
 #include <cmath>
 #include <stdio.h>
+#include "../HighPerformanceComputing/device_select.h"
+#include "../HighPerformanceComputing/program_cache.h"
+#include "../HighPerformanceComputing/compute_service.h"
+#include <map>
+#include <sstream>
+#include "kernel_cl.h"
+
+// daemon mode, the context and one program per scan length stay built between jobs
+// "scan": ints as input and output, the length has to be a power of two
+// jobs of the same length are packed back to back and scanned in one launch, one work-group each
+int serve(const std::string& socketPath) {
+	hpc::DeviceScore selected = hpc::SelectDevice(hpc::WORKLOAD_MEMORY);
+	cl_context_properties properties[] =
+	{ CL_CONTEXT_PLATFORM, (cl_context_properties)(selected.platform)(), 0 };
+	cl::Context context(CL_DEVICE_TYPE_ALL, properties);
+	std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+	cl::Device device = selected.device;
+	cl::CommandQueue queue(context, device);
+	hpc::ProgramVariants programs(KERNEL_SOURCE);
+
+	hpc::ComputeService service;
+	service.handle("scan", [&](std::vector<hpc::Job *>& batch) {
+		std::map<size_t, std::vector<hpc::Job *> > byLength;
+		for (size_t i = 0; i < batch.size(); i++) {
+			const size_t n = batch[i]->inputBytes / sizeof(int);
+			if (n < 2 || (n & (n - 1)) != 0 || batch[i]->outputBytes < n * sizeof(int)) {
+				batch[i]->reply.status = -1;
+				continue;
+			}
+			byLength[n].push_back(batch[i]);
+		}
+
+		for (std::map<size_t, std::vector<hpc::Job *> >::iterator it = byLength.begin(); it != byLength.end(); ++it) {
+			const size_t n = it->first;
+			std::vector<hpc::Job *>& jobs = it->second;
+			std::ostringstream options;
+			options << "-DSCAN_N=" << n;
+			cl::Kernel kernel(programs.get(context, devices, options.str()), "scan");
+			if (n / 2 > kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)) {
+				for (size_t j = 0; j < jobs.size(); j++) {
+					jobs[j]->reply.status = -1;
+				}
+				continue;
+			}
+
+			const size_t bytes = n * sizeof(int);
+			cl::Buffer bufferA(context, CL_MEM_READ_ONLY, jobs.size() * bytes);
+			cl::Buffer bufferB(context, CL_MEM_WRITE_ONLY, jobs.size() * bytes);
+			for (size_t j = 0; j < jobs.size(); j++) {
+				queue.enqueueWriteBuffer(bufferA, CL_FALSE, j * bytes, bytes, jobs[j]->input);
+			}
+			kernel.setArg(0, bufferA);
+			kernel.setArg(1, bufferB);
+			kernel.setArg(2, bytes, NULL);
+			kernel.setArg(3, (cl_int)n);
+			queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(jobs.size() * n / 2), cl::NDRange(n / 2));
+			for (size_t j = 0; j < jobs.size(); j++) {
+				queue.enqueueReadBuffer(bufferB, CL_FALSE, j * bytes, bytes, jobs[j]->output);
+			}
+			queue.finish();
+		}
+	});
+	return service.serve(socketPath);
+}
 
 int main(int argc, char **argv) {
-	const std::string KERNEL_FILE = "kernel.cl";
 	cl_int err = CL_SUCCESS;
 	cl::Program program;
 	std::vector<cl::Device> devices;
+	cl::Device device;
 
 	try {
+		// --serve [socket] keeps the context warm and takes scan jobs until shut down
+		if (argc > 1 && std::string(argv[1]) == "--serve") {
+			return serve(argc > 2 ? argv[2] : hpc::DefaultSocketPath("scan"));
+		}
+
 		std::vector<int> input, output;
 		input.assign({ 3, 1, 7, 0, 4, 1, 6, 3 });
 		output.resize(input.size());
 
-		// get available platforms ( NVIDIA, Intel, AMD,...)
-		std::vector<cl::Platform> platforms;
-		cl::Platform::get(&platforms);
-		if (platforms.size() == 0) {
+		// pick the platform/device with the best memory throughput ( NVIDIA, Intel, AMD,...)
+		hpc::DeviceScore selected;
+		try {
+			selected = hpc::SelectDevice(hpc::WORKLOAD_MEMORY);
+		}
+		catch (cl::Error) {
 			std::cout << "No OpenCL platforms available!\n";
 			return 1;
 		}
 
 		// create a context and get available devices
-		int platFormNr = 1;
-		cl::Platform platform = platforms[platFormNr]; // on a different machine, you may have to select a different platform!
+		cl::Platform platform = selected.platform;
 		cl_context_properties properties[] =
-		{ CL_CONTEXT_PLATFORM, (cl_context_properties)(platforms[platFormNr])(), 0 };
+		{ CL_CONTEXT_PLATFORM, (cl_context_properties)(platform)(), 0 };
 		cl::Context context(CL_DEVICE_TYPE_ALL, properties);
 
 		devices = context.getInfo<CL_CONTEXT_DEVICES>();
+		device = selected.device;
 
-		// load and build the kernel
-		std::ifstream sourceFile(KERNEL_FILE);
-		if (!sourceFile)
-		{
-			std::cout << "kernel source file " << KERNEL_FILE << " not found!" << std::endl;
-			return 1;
-		}
-		std::string sourceCode(
-			std::istreambuf_iterator<char>(sourceFile),
-			(std::istreambuf_iterator<char>()));
-		cl::Program::Sources source(1, std::make_pair(sourceCode.c_str(), sourceCode.length() + 1));
-		program = cl::Program(context, source);
-		program.build(devices);
+		// build the embedded kernel specialised for the scan length
+		std::ostringstream options;
+		options << "-DSCAN_N=" << input.size();
+		program = hpc::BuildProgram(context, devices, KERNEL_SOURCE, options.str());
 		//create kernels
 		cl::Kernel kernel(program, "scan", &err);
 		cl::Event event;
-		cl::CommandQueue queue(context, devices[0], 0, &err);
+		cl::CommandQueue queue(context, device, 0, &err);
 
 		// input buffers
 		cl::Buffer bufferA = cl::Buffer(context, CL_MEM_READ_ONLY, input.size() * sizeof(int));
@@ -83,13 +145,19 @@ int main(int argc, char **argv) {
 		cl::Kernel addKernel(program, "scan", &err);
 		addKernel.setArg(0, bufferA);
 		addKernel.setArg(1, bufferB);
-		addKernel.setArg(2, input.size(), NULL);
-		addKernel.setArg(3, input.size());
+		addKernel.setArg(2, input.size() * sizeof(int), NULL);
+		addKernel.setArg(3, (cl_int)input.size());
 
 		// launch add kernel
-		// Run the kernel on specific ND range
-		cl::NDRange global(input.size());
-		cl::NDRange local(input.size());
+		// the scan runs in one work-group and every item handles two elements,
+		// so the group is half the input and has to fit the device
+		const size_t groupSize = input.size() / 2;
+		if (groupSize > addKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)) {
+			std::cout << "Input too large for one work-group on this device" << std::endl;
+			return 1;
+		}
+		cl::NDRange global(groupSize);
+		cl::NDRange local(groupSize);
 		std::cout << "nvidia Scan Sum" << std::endl;
 		queue.enqueueNDRangeKernel(addKernel, 0, global, local);
 
@@ -101,9 +169,9 @@ int main(int argc, char **argv) {
 		// error handling
 		// if the kernel has failed to compile, print the error log
 		std::string s;
-		program.getBuildInfo(devices[0], CL_PROGRAM_BUILD_LOG, &s);
+		program.getBuildInfo(device, CL_PROGRAM_BUILD_LOG, &s);
 		std::cout << s << std::endl;
-		program.getBuildInfo(devices[0], CL_PROGRAM_BUILD_OPTIONS, &s);
+		program.getBuildInfo(device, CL_PROGRAM_BUILD_OPTIONS, &s);
 		std::cout << s << std::endl;
 
 		std::cerr